@@ -12,13 +12,13 @@ EOL =
 MY_pgm_VALA = main.vala
 
 # src/app
-MY_app_VALA = pfft.vala myconfig.vapi
+MY_app_VALA = pfft.vala server.vala doc-cache.vala myconfig.vapi
 # myconfig.vapi is under source control, so make sure to update it manually
 # if you add symbols to config.h.
-MY_app_EXTRASOURCES = pfft-shim.c
+MY_app_EXTRASOURCES =
 
 # src/core
-MY_core_VALA = el.vala reader.vala registry.vala template.vala units.vala util.vala writer.vala
+MY_core_VALA = doctree.vala el.vala reader.vala registry.vala stats.vala template.vala units.vala util.vala writer.vala
 MY_core_EXTRASOURCES = registry-impl.cpp
 
 # src/logging
@@ -27,6 +27,8 @@ MY_logging_EXTRASOURCES = logging-c.h logging-c.c
 
 # src/reader
 MY_reader_VALA = md4c-reader.vala \
+		 doctree-reader.vala \
+		 text-reader.vala \
 		 md4c.vapi \
 		 $(EOL)
 MY_reader_EXTRASOURCES = register.c \
@@ -37,9 +39,11 @@ MY_reader_EXTRASOURCES = register.c \
 			 $(EOL)
 
 # src/writer
-MY_writer_VALA = pango-markup.vala pango-blocks.vala \
+MY_writer_VALA = pango-markup.vala pango-blocks.vala layout-cache.vala \
+		 layout-shaper.vala styled-text.vala \
+		 image-cache.vala png-writer.vala \
 		 dumper.vala
-MY_writer_EXTRASOURCES = register.c
+MY_writer_EXTRASOURCES = register.c text-scan.c text-scan.h
 
 # subdirs.  Listed in the order they should appear on link lines.
 MY_subdirs = app reader writer core logging
@@ -61,12 +65,19 @@ MY_vala_TESTS = \
 	020-registry-t \
 	021-registry-classmap-t \
 	050-core-el-t \
+	051-core-doctree-t \
 	055-core-units-t \
+	056-core-stats-t \
 	060-core-template-t \
 	070-core-writer-t \
 	071-core-writer-emit-t \
 	100-logging-t \
+	110-startup-t \
+	120-serve-t \
+	130-doc-cache-t \
+	140-jobs-t \
 	200-md4c-reader-t \
+	210-text-reader-t \
 	300-pango-markup-writer-t \
 	305-pango-markup-utils-t \
 	$(EOL)
@@ -82,6 +93,7 @@ MY_VALA_PKGS = \
 	--pkg gstreamer-1.0 \
 	--pkg gobject-2.0 \
 	--pkg gio-2.0 \
+	--pkg json-glib-1.0 \
 	$(EOL)
 
 # Vala settings.
@@ -105,7 +117,7 @@ AM_VALAFLAGS = \
 # by each Makefile.am.
 AM_CFLAGS = $(LOCAL_CFLAGS) $(INPUT_CFLAGS) $(RENDER_CFLAGS) $(BASE_CFLAGS) $(CODE_COVERAGE_CFLAGS)
 AM_CXXFLAGS = $(AM_CFLAGS) $(CODE_COVERAGE_CXXFLAGS)
-AM_CPPFLAGS = $(CODE_COVERAGE_CPPFLAGS)
+AM_CPPFLAGS = $(LOGGING_CPPFLAGS) $(CODE_COVERAGE_CPPFLAGS)
 LIBS = $(INPUT_LIBS) $(RENDER_LIBS) $(BASE_LIBS) $(CODE_COVERAGE_LIBS)
 
 # Flags used by both the program and the tests --- anything that links
@@ -0,0 +1,111 @@
+// doc-cache.vala - the --doc-cache option of pfft
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+using My.Log;
+
+namespace My {
+
+    /**
+     * Cache of parsed documents.
+     *
+     * Each document read through the cache is saved in DocTree's binary
+     * format, along with a hash of its source.  Reading the same source
+     * again with the same reader loads the saved tree instead of parsing.
+     * The saved tree is memory-mapped, so loading it is cheap even for
+     * large documents.
+     *
+     * There is one file per source file, reader, and set of reader
+     * options, named for a hash of all three.  Files are replaced
+     * atomically, so several pfft processes can share a cache directory.
+     */
+    public class DocCache : Object {
+        /** Where the cached trees are */
+        private string dir_;
+
+        /** The default cache directory */
+        public static string default_dir()
+        {
+            return Path.build_filename(Environment.get_user_cache_dir(),
+                "pfft", "doctrees");
+        }
+
+        /**
+         * Create a cache.
+         * @param dir   Where to keep the cached trees.  Created if necessary.
+         */
+        public DocCache(string dir)
+        {
+            dir_ = dir;
+        }
+
+        /**
+         * Read a document, from the cache if possible.
+         *
+         * If the cache does not have an up-to-date tree for @filename, the
+         * document is read with @reader and saved in the cache.  Errors
+         * saving the tree are logged but otherwise ignored.
+         */
+        public Doc read_document(string filename, Reader reader)
+        throws FileError, MarkupError
+        {
+            var source = load_file(filename);
+            var hash = DocTree.hash_source(source);
+            var cachefn = cache_filename(filename, reader);
+
+            if(FileUtils.test(cachefn, FileTest.IS_REGULAR)) {
+                try {
+                    var t = Stats.start();
+                    var tree = DocTree.deserialize(load_file(cachefn));
+                    if(tree.get_source_hash() == hash) {
+                        Stats.stop("doccache.load", t);
+                        Stats.count("doccache.hits");
+                        linfoo(this, "Using cached tree %s for %s", cachefn, filename);
+                        return new Doc.from_tree(tree);
+                    }
+                } catch(GLib.Error e) {
+                    lwarningo(this, "Ignoring cached tree %s: %s", cachefn, e.message);
+                }
+            }
+
+            Stats.count("doccache.misses");
+            var doc = reader.read_document(filename);
+            var tree = doc.get_tree();
+            if(tree != null) {
+                try {
+                    DirUtils.create_with_parents(dir_, 0755);
+                    FileUtils.set_data(cachefn, tree.serialize(hash).get_data());
+                } catch(FileError e) {
+                    lwarningo(this, "Could not save %s to the document cache: %s",
+                        filename, e.message);
+                }
+            }
+            return doc;
+        } // read_document()
+
+        /**
+         * Where the cached tree for @filename, read by @reader, goes.
+         *
+         * The reader's options are part of the name, since they can change
+         * the tree that results from the same source.
+         */
+        private string cache_filename(string filename, Reader reader)
+        {
+            var key = new StringBuilder(My.canonicalize_filename(filename));
+            key.append_printf("\n%s", reader.get_type().name());
+
+            var ocl = (ObjectClass) reader.get_type().class_ref();
+            foreach(var spec in ocl.list_properties()) {
+                if((spec.flags & ParamFlags.READWRITE) != ParamFlags.READWRITE) {
+                    continue;   // e.g., meta
+                }
+                var v = Value(spec.value_type);
+                reader.get_property(spec.get_name(), ref v);
+                key.append_printf("\n%s=%s", spec.get_name(), serialize_value(v));
+            }
+
+            return Path.build_filename(dir_,
+                Checksum.compute_for_string(ChecksumType.SHA256, key.str) + ".pfftdoc");
+        }
+    } // class DocCache
+} // My
@@ -6,8 +6,6 @@ using My.Log;
 
 namespace My {
 
-    extern void init_gstreamer();   // from pfft-shim.c
-
     /**
      * Main application class for pfft
      */
@@ -62,6 +60,55 @@ namespace My {
         /** Template filename */
         private string opt_templatefn = "";
 
+        /**
+         * How many files to convert at once.
+         *
+         * 0 means one per processor.
+         */
+        private int opt_jobs = 1;
+
+        /** Whether to render blocks as they are read */
+        private bool opt_stream = false;
+
+        /** Whether to keep running and re-render files when they change */
+        private bool opt_watch = false;
+
+        /** Whether to report page counts instead of writing PDFs */
+        private bool opt_count_pages = false;
+
+        /**
+         * How to report statistics: null (don't), "table", or "json".
+         *
+         * Static for the same reason as opt_verbose.
+         */
+        private static string? opt_stats = null;
+
+        /**
+         * Where to serve requests: null (don't), "" (stdin/stdout), or
+         * the path of a Unix socket.
+         *
+         * Static for the same reason as opt_verbose.
+         */
+        private static string? opt_serve = null;
+
+        /**
+         * Where to cache parsed documents: null (don't), or a directory.
+         *
+         * Static for the same reason as opt_verbose.
+         */
+        private static string? opt_doc_cache = null;
+
+        /** The document cache, if --doc-cache was given */
+        private DocCache doc_cache_ = null;
+
+        /**
+         * The pages to output, from --pages.  0 means "not specified".
+         *
+         * Static for the same reason as opt_verbose.
+         */
+        private static int opt_first_page = 0;
+        private static int opt_last_page = 0;  ///< ditto
+
         /**
          * Make command-line option descriptors
          *
@@ -72,6 +119,40 @@ namespace My {
         private GLib.OptionEntry[] get_options()
         {
             OptionArgFunc cb_verbose = () => { ++opt_verbose; return true; };
+            OptionArgFunc cb_stats = (option_name, val) => {
+                var format = val ?? "table";
+                if(format != "table" && format != "json") {
+                    throw new OptionError.BAD_VALUE(
+                        "--stats: unknown format '%s' (expected table or json)".printf(format));
+                }
+                opt_stats = format;
+                return true;
+            };
+            OptionArgFunc cb_pages = (option_name, val) => {
+                MatchInfo m;
+                var ok = /^(\d*)(-?)(\d*)$/.match(val, 0, out m);
+                if(!ok || val == "" || val == "-") {
+                    throw new OptionError.BAD_VALUE(
+                        "--pages: invalid range '%s' (expected N, A-B, A-, or -B)".printf(val));
+                }
+                var first = m.fetch(1), last = m.fetch(3);
+                opt_first_page = (first == "") ? 1 : int.parse(first);
+                opt_last_page = (m.fetch(2) == "") ? opt_first_page :
+                    (last == "") ? 0 : int.parse(last);
+                if(opt_first_page < 1 || (opt_last_page != 0 && opt_last_page < opt_first_page)) {
+                    throw new OptionError.BAD_VALUE(
+                        "--pages: invalid range '%s'".printf(val));
+                }
+                return true;
+            };
+            OptionArgFunc cb_doc_cache = (option_name, val) => {
+                opt_doc_cache = val ?? DocCache.default_dir();
+                return true;
+            };
+            OptionArgFunc cb_serve = (option_name, val) => {
+                opt_serve = val ?? "";
+                return true;
+            };
             return {
                        // --version
                        { "version", 'V', 0, OptionArg.NONE, &opt_version, "Display version number", null },
@@ -98,6 +179,33 @@ namespace My {
                        // --template, -t FIlENAME
                        { "template", 't', 0, OptionArg.FILENAME, &opt_templatefn, "Template filename", "FILENAME" },
 
+                       // --jobs, -j N
+                       { "jobs", 'j', 0, OptionArg.INT, &opt_jobs, "Convert up to N files at once (0 = one per processor)", "N" },
+
+                       // --stream
+                       { "stream", 0, 0, OptionArg.NONE, &opt_stream, "Write each block as soon as it has been read (uses less memory)", null },
+
+                       // --watch
+                       { "watch", 0, 0, OptionArg.NONE, &opt_watch, "Keep running, and re-render each file whenever it changes", null },
+
+                       // --pages A-B
+                       { "pages", 0, 0, OptionArg.CALLBACK, (void *)cb_pages, "Only output pages A through B (earlier pages are laid out but not drawn)", "A-B" },
+
+                       // --doc-cache[=DIR]
+                       { "doc-cache", 0, OptionFlags.OPTIONAL_ARG | OptionFlags.FILENAME, OptionArg.CALLBACK,
+                         (void *)cb_doc_cache, "Save parsed documents in DIR, and reuse them when the input has not changed", "DIR" },
+
+                       // --count-pages
+                       { "count-pages", 0, 0, OptionArg.NONE, &opt_count_pages, "Print the number of pages each file would have, without writing any PDFs", null },
+
+                       // --stats[=FORMAT]
+                       { "stats", 0, OptionFlags.OPTIONAL_ARG, OptionArg.CALLBACK,
+                         (void *)cb_stats, "Report time spent and work done, on stderr (FORMAT: table [default] or json)", "FORMAT" },
+
+                       // --serve[=SOCKET]
+                       { "serve", 0, OptionFlags.OPTIONAL_ARG, OptionArg.CALLBACK,
+                         (void *)cb_serve, "Keep running, and convert documents on request (JSON lines on stdin, or on SOCKET)", "SOCKET" },
+
                        // FILENAME* (non-option arg(s) - inputs)
                        { OPTION_REMAINING, 0, 0, OptionArg.FILENAME_ARRAY, &opt_infns, "Filename(s) to process", "FILENAME..." },
 
@@ -118,10 +226,16 @@ namespace My {
         // }}}1
         // Main routines {{{1
 
+        /**
+         * Process-wide initialization.
+         *
+         * Keep this cheap --- it runs on every invocation.  In particular,
+         * GStreamer is not initialized.  Logging and value parsing
+         * (deserialize_value()) do not need it.
+         */
         public static void init_before_run()
         {
             Intl.setlocale (LocaleCategory.ALL, "");    // init locale from environment
-            init_gstreamer();
             Log.linit();
         }
 
@@ -165,7 +279,7 @@ namespace My {
             }
 
             var num_infns = (opt_infns == null) ? 0 : strv_length(opt_infns);
-            if(num_infns < 1) {
+            if(num_infns < 1 && opt_serve == null) {
                 printerr("Usage: %s FILENAME\n", args[0]);
                 return 2;
             }
@@ -175,9 +289,21 @@ namespace My {
                 return 2;
             }
 
+            if(opt_doc_cache != null) {
+                doc_cache_ = new DocCache(opt_doc_cache);
+            }
+
+            // --pages is shorthand for writer options
+            if(opt_first_page != 0) {
+                opt_writer_options += "firstpage=%d".printf(opt_first_page);
+                opt_writer_options += "lastpage=%d".printf(opt_last_page);
+            }
+
             // Convert verbosity into GST_DEBUG levels
             set_verbosity();
 
+            Stats.enabled = (opt_stats != null);
+
             // Load the template
             if(opt_templatefn == "") {
                 ldebugo(this, "Using default template");
@@ -196,61 +322,364 @@ namespace My {
                 }
             }
 
+            var reader_name = opt_reader_name ?? reader_default_;
+            var writer_name = opt_writer_name ?? writer_default_;
+
+            int status;
+            if(opt_serve != null) {
+                // The server runs indefinitely, on files that may be edited
+                // at any time, so don't map them.  A mapped file truncated
+                // in place raises SIGBUS, which would kill every request in
+                // progress, not just the one reading that file.
+                map_input_files = false;
+
+                var server = new Server(readers_, writers_, reader_name,
+                    writer_name, template_, opt_reader_options,
+                    opt_writer_options, (uint)int.max(opt_jobs, 0));
+                status = (opt_serve == "") ? server.serve_stdio() :
+                    server.serve_socket(opt_serve);
+            } else {
+                status = process_files(num_infns, reader_name, writer_name);
+            }
+            print_stats();
+            return status;
+        } // run()
+
+        /**
+         * Process all the input files.
+         * @return The exit status
+         */
+        private int process_files(uint num_infns, string reader_name,
+            string writer_name)
+        {
             // Create the plugins
+            uint njobs = (opt_jobs > 0) ? opt_jobs : get_num_processors();
+            njobs = uint.min(njobs, num_infns);
+            if(njobs > 1 && !opt_watch) {
+                return run_parallel(njobs, reader_name, writer_name);
+            }
+
             Reader reader;
-            var reader_name = opt_reader_name ?? reader_default_;
+            Writer writer;
+            if(!create_plugins(reader_name, writer_name, out reader, out writer)) {
+                return 1;
+            }
+
+            linfo("Using reader %s, writer %s", reader_name, writer_name);
+
+            if(opt_watch) {
+                // The files will be edited while we are running, so don't
+                // map them.  Editors may truncate a file when saving it.
+                map_input_files = false;
+            }
+
+            /* Do the work */
+            for(uint i=0; i<num_infns; ++i) {
+                if(!try_process_file(opt_infns[i], reader, writer) && !opt_watch) {
+                    return 1;
+                }
+            }
+
+            if(opt_watch) {
+                watch_files(reader, writer);
+            }
+
+            return 0;
+        } // process_files()
+
+        /** Report the statistics, if the user asked for them */
+        private void print_stats()
+        {
+            if(opt_stats == null) {
+                return;
+            }
+
+            if(opt_stats == "json") {
+                printerr("%s", Stats.to_json());
+            } else {
+                printerr("%s", Stats.to_table());
+            }
+        }
+
+        // --watch support {{{2
+
+        /** How often to check for changes in --watch mode, in microseconds */
+        private const ulong WATCH_INTERVAL_US = 250000;
+
+        /**
+         * How many shaped layouts to keep in --watch mode.
+         *
+         * This should cover all the paragraphs of a large document, so that
+         * only the paragraphs that changed have to be laid out again.
+         */
+        private const uint WATCH_LAYOUT_CACHE_CAPACITY = 65536;
+
+        /**
+         * Re-render the input files whenever they change.  Does not return.
+         *
+         * The same reader and writer are used for every pass, so anything
+         * they cache persists between passes.  In particular, the
+         * pango-markup writer keeps the shaped layouts of paragraphs that
+         * did not change, so it only has to lay out the changed ones.
+         *
+         * A file is re-rendered when its modification time changes, unless
+         * its contents are the same as when it was last rendered.
+         *
+         * With --stats, the statistics are reported after each re-render.
+         */
+        private void watch_files(Reader reader, Writer writer)
+        {
+            var num_infns = strv_length(opt_infns);
+
+            var pmw = writer as PangoMarkupWriter;
+            if(pmw != null) {
+                pmw.get_layout_cache().capacity = WATCH_LAYOUT_CACHE_CAPACITY;
+            }
+
+            // What we last rendered
+            uint64[] mtimes = {};
+            string[] checksums = {};
+            for(uint i=0; i<num_infns; ++i) {
+                mtimes += get_mtime(opt_infns[i]);
+                checksums += get_checksum(opt_infns[i]);
+            }
+
+            print_stats();
+            Stats.reset();
+
+            linfo("Watching %u file(s) for changes", num_infns);
+            while(true) {
+                Thread.usleep(WATCH_INTERVAL_US);
+
+                for(uint i=0; i<num_infns; ++i) {
+                    var mtime = get_mtime(opt_infns[i]);
+                    if(mtime == mtimes[i]) {
+                        continue;
+                    }
+                    mtimes[i] = mtime;
+
+                    var checksum = get_checksum(opt_infns[i]);
+                    if(checksum == checksums[i]) {
+                        linfo("%s was saved but not changed", opt_infns[i]);
+                        continue;
+                    }
+                    checksums[i] = checksum;
+
+                    var timer = new Timer();
+                    if(try_process_file(opt_infns[i], reader, writer)) {
+                        linfo("Re-rendered %s in %f s", opt_infns[i], timer.elapsed());
+                    }
+                    print_stats();
+                    Stats.reset();
+                }
+            }
+        } // watch_files()
+
+        /**
+         * Get the modification time of a file, in microseconds.
+         * @return The time, or 0 if it cannot be determined
+         */
+        private static uint64 get_mtime(string fn)
+        {
+            try {
+                var info = File.new_for_path(fn).query_info(
+                    FileAttribute.TIME_MODIFIED + "," + FileAttribute.TIME_MODIFIED_USEC,
+                    FileQueryInfoFlags.NONE);
+                return info.get_attribute_uint64(FileAttribute.TIME_MODIFIED) * 1000000 +
+                       info.get_attribute_uint32(FileAttribute.TIME_MODIFIED_USEC);
+            } catch(GLib.Error e) {
+                return 0;   // e.g., in the middle of being saved
+            }
+        } // get_mtime()
+
+        /**
+         * Get a checksum of the contents of a file.
+         * @return The checksum, or "" if the file cannot be read
+         */
+        private static string get_checksum(string fn)
+        {
+            try {
+                var bytes = load_file(fn);
+                return Checksum.compute_for_bytes(ChecksumType.SHA256, bytes);
+            } catch(FileError e) {
+                return "";
+            }
+        } // get_checksum()
+
+        // }}}2
+
+        /**
+         * Create a reader and a writer.
+         *
+         * Reports any errors to stderr.
+         * @return true on success
+         */
+        private bool create_plugins(string reader_name, string writer_name,
+            out Reader? reader, out Writer? writer)
+        {
+            reader = null;
+            writer = null;
+
             try {
                 reader = readers_.create_instance(
                     reader_name, template_, opt_reader_options) as Reader;
             } catch(KeyFileError e) {
                 printerr ("Could not create reader: %s\n", e.message);
-                return 1;
+                return false;
             }
 
-            Writer writer;
-            var writer_name = opt_writer_name ?? writer_default_;
             try {
                 writer = writers_.create_instance(
                     writer_name, template_, opt_writer_options) as Writer;
             } catch(KeyFileError e) {
                 printerr ("Could not create writer: %s\n", e.message);
-                return 1;
+                return false;
             }
 
             if(reader == null) {
                 printerr("Could not create reader %s\n", reader_name);
-                return 1;
+                return false;
             }
 
             if(writer == null) {
                 printerr("Could not create writer %s\n", writer_name);
-                return 1;
+                return false;
             }
 
-            linfo("Using reader %s, writer %s", reader_name, writer_name);
+            return true;
+        } // create_plugins()
 
-            /* Do the work */
-            for(uint i=0; i<num_infns; ++i) {
-                var infn = opt_infns[i];
-                try {
-                    process_file(infn, reader, writer);
-                } catch (FileError e) {
-                    printerr ("file error while processing %s: %s\n", infn, e.message);
-                    return 1;
-                } catch(MarkupError e) {
-                    printerr ("markup error while processing %s: %s\n", infn, e.message);
-                    return 1;
-                } catch(RegexError e) {
-                    printerr ("regex error while processing %s: %s\n", infn, e.message);
-                    return 1;
-                } catch(My.Error e) {
-                    printerr ("error while processing %s: %s\n", infn, e.message);
+        /**
+         * Convert several files at once.
+         *
+         * Each worker thread has its own reader and writer, since neither
+         * is required to be reentrant.  The workers pull filenames from a
+         * shared queue.  An error in one file is reported, but does not stop
+         * the other files from being processed.
+         *
+         * @param njobs         How many worker threads to use
+         * @return The exit status for run()
+         */
+        private int run_parallel(uint njobs, string reader_name, string writer_name)
+        {
+            // Create all the plugins up front so that option errors are
+            // reported once, before any work is done.
+            Reader[] readers = {};
+            Writer[] writers = {};
+            for(uint i=0; i<njobs; ++i) {
+                Reader reader;
+                Writer writer;
+                if(!create_plugins(reader_name, writer_name, out reader, out writer)) {
                     return 1;
                 }
+                limit_threads(writer, opt_writer_options);
+                readers += reader;
+                writers += writer;
+            }
+
+            linfo("Using reader %s, writer %s, %u jobs", reader_name,
+                writer_name, njobs);
+
+            var queue = new AsyncQueue<string>();
+            var num_infns = strv_length(opt_infns);
+            for(uint i=0; i<num_infns; ++i) {
+                queue.push(opt_infns[i]);
             }
 
+            nfailed_ = 0;
+            Thread<bool>[] workers = {};
+            for(uint i=0; i<njobs; ++i) {
+                workers += start_worker(i, queue, readers[i], writers[i]);
+            }
+            foreach(var worker in workers) {
+                worker.join();
+            }
+
+            var nfailed = AtomicInt.get(ref nfailed_);
+            if(nfailed != 0) {
+                printerr("%d of %u file(s) could not be processed\n",
+                    nfailed, num_infns);
+                return 1;
+            }
             return 0;
-        } // run()
+        } // run_parallel()
+
+        /**
+         * Keep a writer from starting a thread per processor.
+         *
+         * For use when several writers run at once, e.g., with --jobs, so
+         * that the threads do not multiply.  Sets layoutthreads, and the png
+         * writer's rasterthreads, to 1 unless @options sets them.
+         *
+         * @param writer    The writer.  Anything but a PangoMarkupWriter is
+         *                  left alone.
+         * @param options   The options @writer was created with
+         */
+        internal static void limit_threads(Object writer, string[] options)
+        {
+            var pmw = writer as PangoMarkupWriter;
+            if(pmw == null) {
+                return;
+            }
+
+            bool has_layoutthreads = false;
+            bool has_rasterthreads = false;
+            foreach(var opt in options) {
+                has_layoutthreads |= opt.has_prefix("layoutthreads=");
+                has_rasterthreads |= opt.has_prefix("rasterthreads=");
+            }
+            if(!has_layoutthreads) {
+                pmw.layoutthreads = 1;
+            }
+
+            var png = writer as PngWriter;
+            if(png != null && !has_rasterthreads) {
+                png.rasterthreads = 1;
+            }
+        } // limit_threads()
+
+        /** How many files failed in run_parallel().  Access atomically. */
+        private int nfailed_ = 0;
+
+        /** Start a thread that processes files from @queue until it is empty */
+        private Thread<bool> start_worker(uint idx, AsyncQueue<string> queue,
+            Reader reader, Writer writer)
+        {
+            return new Thread<bool>("pfft-job-%u".printf(idx), () => {
+                string? infn;
+                while((infn = queue.try_pop()) != null) {
+                    if(!try_process_file(infn, reader, writer)) {
+                        AtomicInt.inc(ref nfailed_);
+                    }
+                }
+                return true;
+            });
+        } // start_worker()
+
+        /**
+         * Process a file, reporting any errors.
+         *
+         * @return true on success
+         */
+        private bool try_process_file(string infn, Reader reader, Writer writer)
+        {
+            try {
+                process_file(infn, reader, writer);
+            } catch (FileError e) {
+                printerr ("file error while processing %s: %s\n", infn, e.message);
+                return false;
+            } catch(MarkupError e) {
+                printerr ("markup error while processing %s: %s\n", infn, e.message);
+                return false;
+            } catch(RegexError e) {
+                printerr ("regex error while processing %s: %s\n", infn, e.message);
+                return false;
+            } catch(My.Error e) {
+                printerr ("error while processing %s: %s\n", infn, e.message);
+                return false;
+            }
+            return true;
+        } // try_process_file()
 
         private void process_file(string infn, Reader reader, Writer writer)
         throws FileError, MarkupError, RegexError, My.Error
@@ -258,6 +687,12 @@ namespace My {
             linfo("Processing %s", infn);
 
             var infh = File.new_for_path(infn);
+
+            if(opt_count_pages) {
+                count_pages(infh, reader, writer);
+                return;
+            }
+
             string outfn;
 
             if(opt_outfn.length != 0) { // User provided outfn
@@ -287,20 +722,69 @@ namespace My {
 
             linfo("Processing %s to %s", infh.get_path(), outfn);
 
-            var doc = reader.read_document(infh.get_path());
+            if(opt_stream) {
+                var sreader = reader as StreamingReader;
+                var sink = writer as BlockSink;
+                if(sreader != null && sink != null) {
+                    sink.begin_document(outfn, infh.get_path());
+                    bool done = false;
+                    try {
+                        sreader.stream_document(infh.get_path(), sink);
+                        sink.end_document();
+                        done = true;
+                    } finally {
+                        if(!done) {     // don't leave a truncated PDF behind
+                            sink.abort_document();
+                        }
+                    }
+                    return;
+                }
+                lwarning("Reader or writer cannot stream --- reading the whole document");
+            }
+
+            var doc = read_document(infh.get_path(), reader);
             writer.write_document(outfn, doc, infh.get_path());
 
         } // process_file()
 
+        /** Read a document, using the document cache if there is one */
+        private Doc read_document(string filename, Reader reader)
+        throws FileError, MarkupError
+        {
+            if(doc_cache_ != null) {
+                return doc_cache_.read_document(filename, reader);
+            }
+            return reader.read_document(filename);
+        }
+
+        /** Print the number of pages @infh would have */
+        private void count_pages(File infh, Reader reader, Writer writer)
+        throws FileError, MarkupError, RegexError, My.Error
+        {
+            var pmw = writer as PangoMarkupWriter;
+            if(pmw == null) {
+                throw new My.Error.WRITER("--count-pages: writer " +
+                    writer.get_type().name() + " cannot count pages");
+            }
+
+            var doc = read_document(infh.get_path(), reader);
+            var npages = pmw.count_pages(doc, infh.get_path());
+            if(strv_length(opt_infns) > 1) {
+                print("%s: %d\n", infh.get_path(), npages);
+            } else {
+                print("%d\n", npages);
+            }
+        } // count_pages()
+
         private void set_verbosity()
         {
             if(opt_quiet) {
-                Log.category.set_threshold(NONE);
+                Log.set_level(NONE);
                 opt_verbose = 0;
                 return;
             }
 
-            int oldlevel = Log.category.get_threshold();
+            int oldlevel = Log.get_level();
             int newlevel = int.max(oldlevel, Gst.DebugLevel.WARNING);
 
             if(opt_verbose == 1) {
@@ -314,7 +798,7 @@ namespace My {
             } else if(opt_verbose > 0) {
                 newlevel = int.max(newlevel, Gst.DebugLevel.MEMDUMP);
             }
-            Log.category.set_threshold((Gst.DebugLevel)newlevel);
+            Log.set_level((Gst.DebugLevel)newlevel);
         }
         // }}}1
         // Registry functions {{{1
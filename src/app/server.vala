@@ -0,0 +1,590 @@
+// server.vala - the --serve mode of pfft
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+using My.Log;
+
+namespace My {
+
+    /**
+     * Converts documents on request, keeping state warm between requests.
+     *
+     * Requests and responses are newline-delimited JSON objects, one per
+     * line, read from stdin and written to stdout, or read from and written
+     * to connections on a Unix socket.
+     *
+     * Request members (all optional except input or markdown):
+     *
+     * * "id": anything; copied to the response
+     * * "input": the filename of the document to convert
+     * * "markdown": the document itself, instead of "input".  Relative
+     *   image paths are not supported.
+     * * "output": where to write the PDF.  If not given, the PDF is
+     *   returned in the response, base64-encoded.
+     * * "reader", "writer": which reader/writer to use
+     * * "template": template filename
+     * * "ro", "wo": arrays of "NAME=VALUE" reader/writer options, applied
+     *   after those given on the command line
+     *
+     * Response members:
+     *
+     * * "id": as in the request, if given
+     * * "ok": true or false
+     * * "error": the error message, if not ok
+     * * "output": the output filename, if one was given
+     * * "pdf": the base64-encoded PDF, if no output filename was given
+     * * "pages": the number of pages, if the writer reports it
+     * * "ms": how long the conversion took
+     *
+     * Requests are processed by a pool of worker threads, so responses may
+     * arrive in a different order than the requests.  Use "id" to match
+     * them up.
+     *
+     * Each worker keeps its own readers and writers, one per combination
+     * of plugin, template, and options, and reuses them for later
+     * requests.  Therefore, the font map and the writers' layout caches
+     * stay warm.  Parsed templates are shared by all the workers.
+     */
+    public class Server : Object {
+
+        // Configuration {{{1
+
+        private ClassMap readers_;
+        private ClassMap writers_;
+        private string reader_default_;
+        private string writer_default_;
+
+        /** The template from the command line */
+        private Template template_;
+
+        /** Options from the command line */
+        private string[] reader_options_;
+        private string[] writer_options_;
+
+        /** How many workers */
+        private uint nthreads_;
+
+        /**
+         * Constructor
+         * @param readers           Available readers
+         * @param writers           Available writers
+         * @param reader_default    Reader to use if a request doesn't say
+         * @param writer_default    Writer to use if a request doesn't say
+         * @param template          Template to use if a request doesn't say
+         * @param reader_options    Reader options for every request
+         * @param writer_options    Writer options for every request
+         * @param nthreads          How many workers; 0 = one per processor
+         */
+        public Server(ClassMap readers, ClassMap writers,
+            string reader_default, string writer_default, Template template,
+            string[]? reader_options, string[]? writer_options, uint nthreads)
+        {
+            readers_ = readers;
+            writers_ = writers;
+            reader_default_ = reader_default;
+            writer_default_ = writer_default;
+            template_ = template;
+            reader_options_ = copy_strv(reader_options);
+            writer_options_ = copy_strv(writer_options);
+            nthreads_ = (nthreads > 0) ? nthreads : get_num_processors();
+        }
+
+        /** Copy a null-terminated array, which may be null */
+        private static string[] copy_strv(string[]? strv)
+        {
+            string[] retval = {};
+            var n = (strv == null) ? 0 : strv_length(strv);
+            for(uint i=0; i<n; ++i) {
+                retval += strv[i];
+            }
+            return retval;
+        }
+
+        // }}}1
+        // Clients and requests {{{1
+
+        /** Somewhere to send responses: a socket, or stdout.  Thread-safe. */
+        private class Client {
+            private OutputStream? stream_ = null;
+            private Mutex mutex_;
+
+            /** Send to stdout */
+            public Client.stdout()
+            {
+            }
+
+            /** Send to a socket */
+            public Client(OutputStream stream)
+            {
+                stream_ = stream;
+            }
+
+            /** Send one response line.  Errors are logged and ignored. */
+            public void send(string json)
+            {
+                mutex_.lock();
+                if(stream_ == null) {
+                    stdout.printf("%s\n", json);
+                    stdout.flush();
+                } else {
+                    try {
+                        size_t written;
+                        stream_.write_all((json + "\n").data, out written);
+                        stream_.flush();
+                    } catch(IOError e) {
+                        lwarning("Could not send response: %s", e.message);
+                    }
+                }
+                mutex_.unlock();
+            }
+        }
+
+        /** One line from a client */
+        private class Request {
+            public Client? client;
+
+            /** The request.  null tells a worker to exit. */
+            public string? line;
+
+            public Request(Client? client, string? line)
+            {
+                this.client = client;
+                this.line = line;
+            }
+        }
+
+        /** Requests waiting for a worker */
+        private AsyncQueue<Request> queue_ = new AsyncQueue<Request>();
+
+        /** Queue a request, unless @line is blank */
+        private void add_request(Client client, string line)
+        {
+            if(line.strip() != "") {
+                queue_.push(new Request(client, line));
+            }
+        }
+
+        /** Read requests from @stream and queue them, until end of file */
+        private void read_requests(InputStream stream, Client client)
+        {
+            var input = new DataInputStream(stream);
+            try {
+                string? line;
+                while((line = input.read_line_utf8()) != null) {
+                    add_request(client, line);
+                }
+            } catch(GLib.Error e) {
+                lwarning("Could not read request: %s", e.message);
+            }
+        }
+
+        // }}}1
+        // Entry points {{{1
+
+        /**
+         * Serve requests from stdin, responding on stdout.
+         *
+         * Returns when stdin is closed and all the requests have been
+         * processed.
+         *
+         * @return The exit status
+         */
+        public int serve_stdio()
+        {
+            var workers = start_workers();
+            var client = new Client.stdout();
+            string? line;
+            while((line = stdin.read_line()) != null) {
+                add_request(client, line);
+            }
+            stop_workers(workers);
+            return 0;
+        }
+
+        /**
+         * Serve requests from connections to a Unix socket.  Does not return
+         * unless the socket cannot be opened.
+         *
+         * @param path  Where to create the socket.  An existing socket
+         *              there is replaced.
+         * @return The exit status
+         */
+        public int serve_socket(string path)
+        {
+            var listener = new SocketListener();
+            try {
+                if(FileUtils.test(path, FileTest.EXISTS) &&
+                    !FileUtils.test(path, FileTest.IS_REGULAR | FileTest.IS_DIR)) {
+                    FileUtils.unlink(path);     // a stale socket
+                }
+                listener.add_address(new UnixSocketAddress(path),
+                    SocketType.STREAM, SocketProtocol.DEFAULT, null, null);
+            } catch(GLib.Error e) {
+                printerr("Could not listen on %s: %s\n", path, e.message);
+                return 1;
+            }
+
+            start_workers();
+            linfo("Listening on %s", path);
+
+            while(true) {
+                SocketConnection conn;
+                try {
+                    conn = listener.accept();
+                } catch(GLib.Error e) {
+                    lwarning("Could not accept connection: %s", e.message);
+                    continue;
+                }
+
+                new Thread<bool>("pfft-client", () => {
+                    read_requests(conn.input_stream,
+                        new Client(conn.output_stream));
+                    return true;
+                });
+            }
+        } // serve_socket()
+
+        // }}}1
+        // Workers {{{1
+
+        /** A reader or writer that a worker has made */
+        private class Plugin {
+            public Object instance;
+
+            /** The template_id it was made with.  See get_template(). */
+            public string template_id;
+        }
+
+        /**
+         * How many readers and writers each worker keeps.
+         *
+         * Each writer has its own layout cache, so this limits how much
+         * memory a long-running server uses.
+         */
+        private const int MAX_PLUGINS_PER_WORKER = 8;
+
+        /** Per-worker state */
+        private class Worker {
+            /** Readers and writers, by the key get_plugin() makes */
+            public HashTable<string, Plugin> plugins =
+                new HashTable<string, Plugin>(str_hash, str_equal);
+
+            /** The keys of plugins, most recently used first */
+            public Gee.LinkedList<string> lru = new Gee.LinkedList<string>();
+        }
+
+        private Thread<bool>[] start_workers()
+        {
+            Thread<bool>[] workers = {};
+            ldebugo(this, "Starting %u workers", nthreads_);
+            for(uint i=0; i<nthreads_; ++i) {
+                workers += new Thread<bool>("pfft-serve-%u".printf(i), () => {
+                    var worker = new Worker();
+                    while(true) {
+                        var req = queue_.pop();
+                        if(req.line == null) {
+                            break;
+                        }
+                        req.client.send(process_request(worker, req.line));
+                    }
+                    return true;
+                });
+            }
+            return workers;
+        }
+
+        /** Finish the queued requests, then stop the workers */
+        private void stop_workers(Thread<bool>[] workers)
+        {
+            for(int i=0; i<workers.length; ++i) {
+                queue_.push(new Request(null, null));
+            }
+            foreach(var worker in workers) {
+                worker.join();
+            }
+        }
+
+        // }}}1
+        // Processing {{{1
+
+        /** Process one request and return the response */
+        private string process_request(Worker worker, string line)
+        {
+            var timer = new Timer();
+            var builder = new Json.Builder();
+            builder.begin_object();
+
+            Json.Object? req = null;
+            try {
+                var parser = new Json.Parser();
+                parser.load_from_data(line, -1);
+                var root = parser.get_root();
+                if(root == null || root.get_node_type() != Json.NodeType.OBJECT) {
+                    throw new My.Error.READER("Request is not a JSON object");
+                }
+                req = root.get_object();
+
+                if(req.has_member("id")) {
+                    builder.set_member_name("id");
+                    builder.add_value(req.get_member("id").copy());
+                }
+
+                convert(worker, req, builder);
+
+                builder.set_member_name("ok");
+                builder.add_boolean_value(true);
+
+            } catch(GLib.Error e) {
+                linfoo(this, "Request failed: %s", e.message);
+                builder.set_member_name("ok");
+                builder.add_boolean_value(false);
+                builder.set_member_name("error");
+                builder.add_string_value(e.message);
+            }
+
+            builder.set_member_name("ms");
+            builder.add_double_value(timer.elapsed() * 1000);
+            builder.end_object();
+
+            var generator = new Json.Generator();
+            generator.set_root(builder.get_root());
+            return generator.to_data(null);
+        } // process_request()
+
+        /** Convert a document as @req specifies, adding results to @builder */
+        private void convert(Worker worker, Json.Object req, Json.Builder builder)
+        throws GLib.Error
+        {
+            var templatefn = get_string_member(req, "template");
+            var template = template_;
+            string template_id = "";
+            if(templatefn != null) {
+                template = get_template(templatefn, out template_id);
+            }
+
+            var reader = get_plugin(worker, readers_,
+                    get_string_member(req, "reader") ?? reader_default_,
+                    template, template_id,
+                    get_options(req, "ro", reader_options_)) as Reader;
+            var writer = get_plugin(worker, writers_,
+                    get_string_member(req, "writer") ?? writer_default_,
+                    template, template_id,
+                    get_options(req, "wo", writer_options_)) as Writer;
+            if(reader == null || writer == null) {
+                throw new My.Error.UNIMPL("Not a reader or writer");
+            }
+
+            // Input
+            string? tempinfn = null;
+            var infn = get_string_member(req, "input");
+            var markdown = get_string_member(req, "markdown");
+            if(infn == null && markdown == null) {
+                throw new My.Error.READER("Request needs \"input\" or \"markdown\"");
+            }
+            if(infn == null) {
+                FileUtils.close(FileUtils.open_tmp("pfft-serve-XXXXXX.md", out tempinfn));
+                FileUtils.set_contents(tempinfn, markdown);
+                infn = tempinfn;
+            }
+
+            // Output.  The PDF writer can write to memory; other writers
+            // need a temporary file.
+            var pmw = writer as PangoMarkupWriter;
+            string? tempoutfn = null;
+            var outfn = get_string_member(req, "output");
+            if(outfn == null && pmw == null) {
+                FileUtils.close(FileUtils.open_tmp("pfft-serve-XXXXXX.pdf", out tempoutfn));
+                outfn = tempoutfn;
+            }
+
+            try {
+                var doc = reader.read_document(infn);
+
+                if(outfn == null) {
+                    var mem = new MemoryOutputStream.resizable();
+                    pmw.write_document_to_stream(mem, doc, infn);
+                    mem.close();
+                    builder.set_member_name("pdf");
+                    builder.add_string_value(Base64.encode(
+                        mem.steal_as_bytes().get_data()));
+                } else {
+                    writer.write_document(outfn, doc, infn);
+                    if(tempoutfn != null) {
+                        uint8[] pdf;
+                        FileUtils.get_data(tempoutfn, out pdf);
+                        builder.set_member_name("pdf");
+                        builder.add_string_value(Base64.encode(pdf));
+                    } else {
+                        builder.set_member_name("output");
+                        builder.add_string_value(outfn);
+                    }
+                }
+
+                if(pmw != null) {
+                    builder.set_member_name("pages");
+                    builder.add_int_value(pmw.get_page_count());
+                }
+            } finally {
+                if(tempinfn != null) {
+                    FileUtils.unlink(tempinfn);
+                }
+                if(tempoutfn != null) {
+                    FileUtils.unlink(tempoutfn);
+                }
+            }
+        } // convert()
+
+        /** Get a string member, or null if it doesn't exist */
+        private static string? get_string_member(Json.Object obj, string name)
+        throws My.Error
+        {
+            if(!obj.has_member(name)) {
+                return null;
+            }
+            var node = obj.get_member(name);
+            if(node.get_value_type() != typeof(string)) {
+                throw new My.Error.READER("\"%s\" must be a string".printf(name));
+            }
+            return node.get_string();
+        }
+
+        /** Get the options from the command line plus those in @req */
+        private static string[] get_options(Json.Object req, string name,
+            string[] defaults) throws My.Error
+        {
+            var retval = defaults;
+            if(!req.has_member(name)) {
+                return retval;
+            }
+
+            var node = req.get_member(name);
+            if(node.get_node_type() != Json.NodeType.ARRAY) {
+                throw new My.Error.READER("\"%s\" must be an array".printf(name));
+            }
+            foreach(var elem in node.get_array().get_elements()) {
+                if(elem.get_value_type() != typeof(string)) {
+                    throw new My.Error.READER(
+                              "\"%s\" must contain only strings".printf(name));
+                }
+                retval += elem.get_string();
+            }
+            return retval;
+        }
+
+        /**
+         * Get a reader or writer for @worker, creating it if necessary.
+         *
+         * Writers that use threads of their own are limited to one thread,
+         * since the workers already keep the processors busy.  See
+         * App.limit_threads().
+         *
+         * Each worker keeps the MAX_PLUGINS_PER_WORKER readers and writers
+         * it has used most recently.  Those made with an older version of
+         * a template are dropped as soon as the template changes.
+         */
+        private Object get_plugin(Worker worker, ClassMap map, string name,
+            Template template, string template_id, string[] options)
+        throws KeyFileError, My.Error
+        {
+            var key = string.joinv("\x1f", options) + "\x1e" + name +
+                "\x1e" + template_id;
+            var plugin = worker.plugins.lookup(key);
+            if(plugin != null) {
+                worker.lru.remove(key);
+                worker.lru.insert(0, key);
+                return plugin.instance;
+            }
+
+            drop_stale_plugins(worker, template_id);
+
+            var retval = map.create_instance(name, template, options);
+            if(retval == null) {
+                throw new My.Error.UNIMPL("Could not create %s".printf(name));  // LCOV_EXCL_LINE
+            }
+
+            App.limit_threads(retval, options);
+
+            while(worker.lru.size >= MAX_PLUGINS_PER_WORKER) {
+                worker.plugins.remove(worker.lru.poll_tail());
+            }
+            plugin = new Plugin();
+            plugin.instance = retval;
+            plugin.template_id = template_id;
+            worker.plugins.insert(key, plugin);
+            worker.lru.insert(0, key);
+            return retval;
+        } // get_plugin()
+
+        /**
+         * Drop @worker's plugins made with other versions of the template
+         * @template_id is a version of.
+         */
+        private static void drop_stale_plugins(Worker worker, string template_id)
+        {
+            var at = template_id.last_index_of_char('@');
+            if(at < 0) {
+                return;     // the default template, which doesn't change
+            }
+            var prefix = template_id.substring(0, at + 1);  // the filename and '@'
+
+            var iter = worker.lru.iterator();
+            while(iter.next()) {
+                var key = iter.get();
+                var plugin = worker.plugins.lookup(key);
+                if(plugin.template_id.has_prefix(prefix) &&
+                    plugin.template_id != template_id) {
+                    worker.plugins.remove(key);
+                    iter.remove();
+                }
+            }
+        } // drop_stale_plugins()
+
+        // }}}1
+        // Templates {{{1
+
+        /** A parsed template and when its file was last modified */
+        private class CachedTemplate {
+            public Template template;
+            public uint64 mtime;
+        }
+
+        /** Parsed templates, by filename */
+        private HashTable<string, CachedTemplate> templates_ =
+            new HashTable<string, CachedTemplate>(str_hash, str_equal);
+
+        private Mutex templates_mutex_;
+
+        /**
+         * Get a template, parsing it if it is new or has changed.
+         * @param filename      The template file
+         * @param template_id   Set to a string that changes whenever the
+         *                      template does
+         */
+        private Template get_template(string filename, out string template_id)
+        throws GLib.Error
+        {
+            var info = File.new_for_path(filename).query_info(
+                FileAttribute.TIME_MODIFIED, FileQueryInfoFlags.NONE);
+            var mtime = info.get_attribute_uint64(FileAttribute.TIME_MODIFIED);
+
+            templates_mutex_.lock();
+            try {
+                var cached = templates_.lookup(filename);
+                if(cached == null || cached.mtime != mtime) {
+                    cached = new CachedTemplate();
+                    cached.template = new Template.from_file(filename);
+                    cached.mtime = mtime;
+                    templates_.insert(filename, cached);
+                }
+                template_id = "%s@%s".printf(filename, mtime.to_string());
+                return cached.template;
+            } finally {
+                templates_mutex_.unlock();
+            }
+        } // get_template()
+
+        // }}}1
+    } // class Server
+} // My
+
+// vi: set fdm=marker: //
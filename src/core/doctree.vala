@@ -0,0 +1,852 @@
+// src/core/doctree.vala - part of pfft, https://github.com/cxw42/pfft
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+namespace My {
+
+    /**
+     * A compact document tree.
+     *
+     * This holds the same information as a GLib.Node<Elem> tree, but
+     * stores all the nodes in a single array and links them by index.
+     * Strings are stored as slices of the source text where possible,
+     * so reading a document does not require an allocation per node or
+     * per text run.
+     *
+     * Node 0 is always the root.  Nodes are only ever appended, so
+     * indices remain valid for the life of the tree.
+     *
+     * Strings not taken from the source are copied into a side buffer.
+     * Pointers returned by text_data() are valid only until the next
+     * call that modifies the tree.
+     */
+    public class DocTree {
+
+        /** Index value meaning "no node" */
+        public const int NONE = -1;
+
+        /**
+         * A string stored in the tree.
+         *
+         * If offset >= 0, the string is at that offset in the source.
+         * Otherwise, it is at offset -(offset+1) in the side buffer.
+         */
+        private struct Slice {
+            public int offset;
+            public int length;
+        }
+
+        /** One node of the tree */
+        private struct Node {
+            public Elem.Type ty;
+            public uint header_level;
+            public int parent;
+            public int first_child;
+            public int last_child;
+            public int next_sibling;
+            public Slice text;
+            public Slice info_string;
+            public Slice href;
+        }
+
+        /** The nodes.  Vala grows this array geometrically. */
+        private Node[] nodes = {};
+
+        /** The source text, if any.  Held so the slices remain valid. */
+        private Bytes source_ = null;
+
+        /** Start of the source text, or null */
+        private char *source_start_ = null;
+
+        /** Length of the source text */
+        private size_t source_length_ = 0;
+
+        /** Storage for strings that are not in the source */
+        private StringBuilder extra_ = new StringBuilder();
+
+        /** How many nodes are in the tree, including the root */
+        public int size { get { return nodes.length; } }
+
+        /** The source text, if any */
+        public Bytes? source { get { return source_; } }
+
+        /** Hash of the input the tree was made from, if known */
+        private string? source_hash_ = null;
+
+        /**
+         * Get the hash of the input the tree was made from, if known.
+         *
+         * Set by deserialize().  See serialize().
+         */
+        public unowned string? get_source_hash()
+        {
+            return source_hash_;
+        }
+
+        /**
+         * Create a tree with only a root node.
+         *
+         * @param source    The text the tree's strings will be sliced from.
+         *                  The tree holds a reference to it.
+         * @param root_ty   The type of the root node.  This should be ROOT
+         *                  except when converting malformed trees.
+         */
+        public DocTree(Bytes? source = null, Elem.Type root_ty = Elem.Type.ROOT)
+        {
+            source_ = source;
+            if(source != null) {
+                unowned uint8[] data = source.get_data();
+                source_start_ = (char *)data;
+                source_length_ = source.get_size();
+            }
+            add_node(NONE, root_ty);
+        }
+
+        /** Create a tree with no nodes, for deserialize() */
+        private DocTree.empty()
+        {
+        }
+
+        // --- Building -----------------------------------------------------
+
+        /** Add a node without linking it */
+        private int add_node(int parent, Elem.Type ty)
+        {
+            Node node = Node();     // zero-filled, so the strings are empty
+            node.ty = ty;
+            node.parent = parent;
+            node.first_child = NONE;
+            node.last_child = NONE;
+            node.next_sibling = NONE;
+            nodes += node;
+            return nodes.length - 1;
+        }
+
+        /**
+         * Add a new node as the last child of @parent.
+         * @return The index of the new node
+         */
+        public int append_child(int parent, Elem.Type ty)
+        {
+            var idx = add_node(parent, ty);
+            var last = nodes[parent].last_child;
+            if(last == NONE) {
+                nodes[parent].first_child = idx;
+            } else {
+                nodes[last].next_sibling = idx;
+            }
+            nodes[parent].last_child = idx;
+            return idx;
+        }
+
+        /**
+         * Unlink all the children of @idx.
+         *
+         * The children's storage is not reclaimed until the tree is freed.
+         * serialize() leaves out the unlinked nodes.
+         */
+        public void remove_children(int idx)
+        {
+            nodes[idx].first_child = NONE;
+            nodes[idx].last_child = NONE;
+        }
+
+        /** A point in the tree's history, for rewind() */
+        public struct Position {
+            public int nnodes;
+            public size_t nextra;
+        }
+
+        /** Get the current position, for a later rewind() */
+        public Position tell()
+        {
+            return Position() { nnodes = nodes.length, nextra = extra_.len };
+        }
+
+        /**
+         * Discard all nodes and copied strings added since @pos.
+         *
+         * Lets a streaming reader reuse the same storage for each block.
+         * Indices of the discarded nodes become invalid.
+         */
+        public void rewind(Position pos)
+        {
+            if(pos.nnodes >= nodes.length) {
+                return;
+            }
+
+            // Nodes are only appended, so the discarded nodes are a suffix
+            // of each surviving parent's list of children.
+            for(int idx = pos.nnodes; idx < nodes.length; ++idx) {
+                var parent = nodes[idx].parent;
+                if(parent == NONE || parent >= pos.nnodes ||
+                    nodes[parent].last_child < pos.nnodes) {
+                    continue;
+                }
+
+                int last = NONE;
+                for(int kid = nodes[parent].first_child;
+                    kid != NONE && kid < pos.nnodes;
+                    kid = nodes[kid].next_sibling) {
+                    last = kid;
+                }
+                nodes[parent].last_child = last;
+                if(last == NONE) {
+                    nodes[parent].first_child = NONE;
+                } else {
+                    nodes[last].next_sibling = NONE;
+                }
+            }
+
+            nodes.resize(pos.nnodes);
+            extra_.truncate(pos.nextra);
+        }
+
+        /** Make a slice for @len bytes at @ptr, copying if necessary */
+        private Slice slice_of(char *ptr, size_t len)
+        {
+            if(len == 0) {
+                return Slice() { offset = 0, length = 0 };
+            }
+
+            if(source_start_ != null && ptr >= source_start_ &&
+                ptr + len <= source_start_ + source_length_) {
+                return Slice() {
+                           offset = (int)(ptr - source_start_),
+                           length = (int)len
+                };
+            }
+
+            var retval = Slice() {
+                offset = -((int)extra_.len + 1),
+                length = (int)len
+            };
+            extra_.append_len((string)ptr, (ssize_t)len);
+            return retval;
+        }
+
+        /** Get a pointer to the first byte of @slice */
+        private char *slice_data(Slice slice)
+        {
+            if(slice.length == 0) {
+                return (char *)"";
+            } else if(slice.offset >= 0) {
+                return source_start_ + slice.offset;
+            } else {
+                return (char *)extra_.str + (-slice.offset - 1);
+            }
+        }
+
+        /** Copy the contents of @slice into a new string */
+        private string slice_string(Slice slice)
+        {
+            if(slice.length == 0) {
+                return "";
+            }
+            return ((string)slice_data(slice)).ndup(slice.length);
+        }
+
+        /**
+         * Set the text of @idx from @len bytes at @ptr.
+         *
+         * If those bytes are within the source text, no copy is made.
+         */
+        public void set_text_from(int idx, char *ptr, size_t len)
+        {
+            nodes[idx].text = slice_of(ptr, len);
+        }
+
+        public void set_text(int idx, string text)
+        {
+            nodes[idx].text = slice_of((char *)text, text.length);
+        }
+
+        public void set_info_string(int idx, string info_string)
+        {
+            nodes[idx].info_string = slice_of((char *)info_string, info_string.length);
+        }
+
+        public void set_href(int idx, string href)
+        {
+            nodes[idx].href = slice_of((char *)href, href.length);
+        }
+
+        public void set_header_level(int idx, uint header_level)
+        {
+            nodes[idx].header_level = header_level;
+        }
+
+        // --- Accessors ----------------------------------------------------
+
+        public Elem.Type get_ty(int idx)
+        {
+            return nodes[idx].ty;
+        }
+
+        /** Same as Elem.is_span */
+        public bool is_span(int idx)
+        {
+            var ty = nodes[idx].ty;
+            return (ty >= Elem.Type.SPAN_PLAIN) && (ty <= Elem.Type.SPAN_UNDERLINE);
+        }
+
+        public uint get_header_level(int idx)
+        {
+            return nodes[idx].header_level;
+        }
+
+        public int parent(int idx)
+        {
+            return nodes[idx].parent;
+        }
+
+        public int first_child(int idx)
+        {
+            return nodes[idx].first_child;
+        }
+
+        public int last_child(int idx)
+        {
+            return nodes[idx].last_child;
+        }
+
+        public int next_sibling(int idx)
+        {
+            return nodes[idx].next_sibling;
+        }
+
+        /** The depth of @idx.  The root has depth 0. */
+        public uint depth(int idx)
+        {
+            uint retval = 0;
+            for(idx = nodes[idx].parent; idx != NONE; idx = nodes[idx].parent) {
+                ++retval;
+            }
+            return retval;
+        }
+
+        /**
+         * Get the text of @idx without copying it.
+         *
+         * The returned text is NOT nul-terminated.  It is valid until
+         * the tree is next modified.
+         * @param idx       The node
+         * @param length    The number of bytes of text
+         */
+        public char *text_data(int idx, out size_t length)
+        {
+            length = nodes[idx].text.length;
+            return slice_data(nodes[idx].text);
+        }
+
+        /** Return a copy of the text of @idx */
+        public string get_text(int idx)
+        {
+            return slice_string(nodes[idx].text);
+        }
+
+        /** Append the text of @idx to @sb */
+        public void append_text_to(int idx, StringBuilder sb)
+        {
+            var slice = nodes[idx].text;
+            sb.append_len((string)slice_data(slice), slice.length);
+        }
+
+        public string get_info_string(int idx)
+        {
+            return slice_string(nodes[idx].info_string);
+        }
+
+        public string get_href(int idx)
+        {
+            return slice_string(nodes[idx].href);
+        }
+
+        // --- Traversal ----------------------------------------------------
+
+        /**
+         * Called for each node by foreach_preorder().
+         *
+         * @param tree      The tree being traversed
+         * @param idx       The current node
+         * @param depth     The depth of @idx relative to the start node
+         * @return true to stop the traversal, as with GLib.NodeTraverseFunc.
+         */
+        public delegate bool Visitor(DocTree tree, int idx, uint depth);
+
+        /**
+         * Visit @start and all its descendants in preorder.
+         *
+         * Does not use recursion, so works on arbitrarily-deep trees.
+         * @return true if @visitor stopped the traversal
+         */
+        public bool foreach_preorder(int start, Visitor visitor)
+        {
+            int idx = start;
+            uint depth = 0;
+
+            while(true) {
+                if(visitor(this, idx, depth)) {
+                    return true;
+                }
+
+                // Down
+                if(nodes[idx].first_child != NONE) {
+                    idx = nodes[idx].first_child;
+                    ++depth;
+                    continue;
+                }
+
+                // Across, or up and across
+                while(idx != start && nodes[idx].next_sibling == NONE) {
+                    idx = nodes[idx].parent;
+                    --depth;
+                }
+                if(idx == start) {
+                    return false;
+                }
+                idx = nodes[idx].next_sibling;
+            }
+        }
+
+        /**
+         * Copy the children of @from_idx in @other into new children of
+         * @to_idx in this tree.
+         *
+         * Strings are copied, since they refer to @other's source.
+         */
+        public void copy_children_from(int to_idx, DocTree other, int from_idx)
+        {
+            // Map from indices in @other to indices in this tree
+            var map = new int[other.nodes.length];
+            map[from_idx] = to_idx;
+
+            other.foreach_preorder(from_idx, (o, oidx, depth)=>{
+                if(oidx == from_idx) {
+                    return false;
+                }
+                var idx = append_child(map[o.parent(oidx)], o.get_ty(oidx));
+                map[oidx] = idx;
+                nodes[idx].header_level = o.nodes[oidx].header_level;
+                nodes[idx].text = slice_of(o.slice_data(o.nodes[oidx].text),
+                    o.nodes[oidx].text.length);
+                nodes[idx].info_string = slice_of(o.slice_data(o.nodes[oidx].info_string),
+                    o.nodes[oidx].info_string.length);
+                nodes[idx].href = slice_of(o.slice_data(o.nodes[oidx].href),
+                    o.nodes[oidx].href.length);
+                return false;
+            });
+        }
+
+        // --- Conversion ---------------------------------------------------
+
+        /** Make an Elem holding the data of @idx */
+        public Elem make_elem(int idx)
+        {
+            var retval = new Elem(nodes[idx].ty);
+            retval.text = get_text(idx);
+            retval.header_level = nodes[idx].header_level;
+            retval.info_string = get_info_string(idx);
+            retval.href = get_href(idx);
+            return retval;
+        }
+
+        /** Make an equivalent GLib.Node<Elem> tree */
+        public GLib.Node<Elem> to_nodes()
+        {
+            var retval = new GLib.Node<Elem>(make_elem(0));
+
+            // made[i] is the (unowned) GLib.Node for nodes[i], once it exists
+            var made = new void*[nodes.length];
+            made[0] = retval;
+
+            foreach_preorder(0, (tree, idx, depth)=>{
+                if(idx != 0) {
+                    var node = new GLib.Node<Elem>(make_elem(idx));
+                    made[idx] = node;
+                    unowned var parent = (GLib.Node<Elem>)made[nodes[idx].parent];
+                    parent.append((owned)node);
+                }
+                return false;
+            });
+
+            return retval;
+        }
+
+        /** Make a tree equivalent to a GLib.Node<Elem> tree */
+        public static DocTree from_nodes(GLib.Node<Elem> root)
+        {
+            var retval = new DocTree(null, root.data.ty);
+            retval.copy_elem(0, root.data);
+
+            // Iterative preorder walk, tracking the index of each node's parent
+            unowned GLib.Node<Elem> node = root.children;
+            int parent_idx = 0;
+            while(node != null) {
+                var idx = retval.append_child(parent_idx, node.data.ty);
+                retval.copy_elem(idx, node.data);
+
+                if(node.children != null) {     // down
+                    node = node.children;
+                    parent_idx = idx;
+                    continue;
+                }
+
+                // across, or up and across
+                while(node != root && node.next == null) {
+                    node = node.parent;
+                    parent_idx = retval.nodes[parent_idx].parent;
+                }
+                if(node == root) {
+                    break;
+                }
+                node = node.next;
+            }
+
+            return retval;
+        }
+
+        /** Copy the data from @el into @idx */
+        private void copy_elem(int idx, Elem el)
+        {
+            nodes[idx].header_level = el.header_level;
+            set_text(idx, el.text);
+            set_info_string(idx, el.info_string);
+            set_href(idx, el.href);
+        }
+
+        // --- Serialization ------------------------------------------------
+        //
+        // The binary format is:
+        //   FileHeader
+        //   nnodes Node structs
+        //   source_length bytes of source text
+        //   extra_length bytes of side buffer
+        // All in the native byte order, since the format is for caching and
+        // not for interchange.  Loading it copies the nodes and side
+        // buffer, but the source text is used in place.
+
+        /** Identifies the binary format */
+        private const string SERIAL_MAGIC = "PFFTDOC";     // + NUL = 8 bytes
+
+        /**
+         * Version of the binary format.  Bump this when Node or Elem.Type
+         * changes.
+         */
+        private const uint32 SERIAL_VERSION = 1;
+
+        /** Written in native byte order to detect a different one */
+        private const uint32 SERIAL_BYTE_ORDER = 0x01020304;
+
+        /** Start of a serialized tree.  All sizes are in bytes. */
+        private struct FileHeader {
+            public char magic[8];
+            public uint32 version;
+            public uint32 byte_order;
+            public uint32 node_size;
+            public uint32 nnodes;
+            public uint64 source_length;
+            public uint64 extra_length;
+            /** Hex SHA-256 of the input, or all NULs */
+            public char hash[64];
+        }
+
+        /** Hash @source for serialize() and source_hash */
+        public static string hash_source(Bytes source)
+        {
+            return Checksum.compute_for_bytes(ChecksumType.SHA256, source);
+        }
+
+        /**
+         * Serialize this tree in a binary format.
+         *
+         * Load the result with deserialize().  Nodes that have been
+         * unlinked by remove_children() are not saved.
+         *
+         * @param hash  Hash of the input the tree was made from, as from
+         *              hash_source().  If null, the tree's source is hashed.
+         */
+        public Bytes serialize(string? hash = null)
+        {
+            var hdr = FileHeader();     // zero-filled
+            for(int i = 0; i < SERIAL_MAGIC.length; ++i) {
+                hdr.magic[i] = SERIAL_MAGIC[i];
+            }
+            hdr.version = SERIAL_VERSION;
+            hdr.byte_order = SERIAL_BYTE_ORDER;
+            hdr.node_size = (uint32)sizeof(Node);
+
+            var saved = reachable_nodes();
+            hdr.nnodes = (uint32)saved.length;
+            hdr.source_length = source_length_;
+            hdr.extra_length = extra_.len;
+
+            if(hash == null && source_ != null) {
+                hash = hash_source(source_);
+            }
+            for(int i = 0; hash != null && i < hash.length && i < 64; ++i) {
+                hdr.hash[i] = hash[i];
+            }
+
+            var retval = new ByteArray.sized((uint)(sizeof(FileHeader) +
+                saved.length*sizeof(Node) + source_length_ + extra_.len));
+            append_raw(retval, &hdr, sizeof(FileHeader));
+            append_raw(retval, (void *)saved, saved.length*sizeof(Node));
+            append_raw(retval, source_start_, source_length_);
+            append_raw(retval, (void *)extra_.str, extra_.len);
+            return ByteArray.free_to_bytes((owned)retval);
+        }
+
+        /**
+         * The nodes reachable from the root, renumbered to be contiguous.
+         *
+         * The nodes stay in the same order, so links still point forward.
+         * If every node is reachable, returns a copy of nodes.
+         */
+        private Node[] reachable_nodes()
+        {
+            int n = nodes.length;
+
+            // Parents come before their children, so one pass finds
+            // every reachable node.  newidx[i] is i's new index, or NONE.
+            var newidx = new int[n];
+            for(int idx = 1; idx < n; ++idx) {
+                newidx[idx] = NONE;
+            }
+            newidx[0] = 0;
+            int nreached = 1;
+            for(int idx = 0; idx < n; ++idx) {
+                if(newidx[idx] == NONE) {
+                    continue;
+                }
+                for(int kid = nodes[idx].first_child; kid != NONE;
+                    kid = nodes[kid].next_sibling) {
+                    newidx[kid] = 0;    // reachable; numbered below
+                    ++nreached;
+                }
+            }
+
+            if(nreached == n) {
+                return nodes;
+            }
+
+            int next = 0;
+            for(int idx = 0; idx < n; ++idx) {
+                if(newidx[idx] != NONE) {
+                    newidx[idx] = next++;
+                }
+            }
+
+            var retval = new Node[nreached];
+            for(int idx = 0; idx < n; ++idx) {
+                if(newidx[idx] == NONE) {
+                    continue;
+                }
+                var node = nodes[idx];
+                node.parent = renumber(newidx, node.parent);
+                node.first_child = renumber(newidx, node.first_child);
+                node.last_child = renumber(newidx, node.last_child);
+                node.next_sibling = renumber(newidx, node.next_sibling);
+                retval[newidx[idx]] = node;
+            }
+            return retval;
+        }
+
+        /** Map link @link through @newidx, as for reachable_nodes() */
+        private static int renumber(int[] newidx, int link)
+        {
+            return (link == NONE) ? NONE : newidx[link];
+        }
+
+        /** Append @len bytes at @ptr to @ba */
+        private static void append_raw(ByteArray ba, void *ptr, size_t len)
+        {
+            if(len == 0) {
+                return;
+            }
+            unowned uint8[] data = (uint8[])ptr;
+            data.length = (int)len;
+            ba.append(data);
+        }
+
+        /**
+         * Load a tree saved by serialize().
+         *
+         * The tree holds a reference to @data and uses its source text in
+         * place.  If @data is a memory-mapped file, the source text is not
+         * read until it is used.
+         *
+         * @throws MarkupError.INVALID_CONTENT if @data is not a valid tree
+         *      for this version of pfft
+         */
+        public static DocTree deserialize(Bytes data) throws MarkupError
+        {
+            unowned uint8[] buf = data.get_data();
+            size_t size = data.get_size();
+
+            if(size < sizeof(FileHeader)) {
+                throw new MarkupError.INVALID_CONTENT("Not a serialized document: too short");
+            }
+            var hdr = FileHeader();
+            Memory.copy(&hdr, (void *)buf, sizeof(FileHeader));
+
+            for(int i = 0; i < 8; ++i) {
+                if(hdr.magic[i] != (i < SERIAL_MAGIC.length ? SERIAL_MAGIC[i] : '\0')) {
+                    throw new MarkupError.INVALID_CONTENT("Not a serialized document");
+                }
+            }
+            if(hdr.version != SERIAL_VERSION || hdr.byte_order != SERIAL_BYTE_ORDER ||
+                hdr.node_size != sizeof(Node)) {
+                throw new MarkupError.INVALID_CONTENT(
+                    "Serialized document is from an incompatible version of pfft");
+            }
+
+            // Sizes are checked in 64 bits so they can't overflow
+            uint64 nodes_off = sizeof(FileHeader);
+            uint64 source_off = nodes_off + (uint64)hdr.nnodes * sizeof(Node);
+            uint64 extra_off = source_off + hdr.source_length;
+            if(hdr.nnodes < 1 || hdr.nnodes > int.MAX ||
+                hdr.source_length > int.MAX || hdr.extra_length > int.MAX ||
+                extra_off + hdr.extra_length != size) {
+                throw new MarkupError.INVALID_CONTENT("Serialized document is corrupt (size)");
+            }
+
+            var retval = new DocTree.empty();
+            retval.nodes = new Node[(int)hdr.nnodes];
+            Memory.copy((void *)retval.nodes, (uint8 *)buf + nodes_off,
+                (size_t)hdr.nnodes * sizeof(Node));
+
+            if(hdr.source_length > 0) {
+                retval.source_ = new Bytes.from_bytes(data, (size_t)source_off,
+                        (size_t)hdr.source_length);
+                unowned uint8[] src = retval.source_.get_data();
+                retval.source_start_ = (char *)src;
+                retval.source_length_ = (size_t)hdr.source_length;
+            }
+            retval.extra_.append_len((string)((uint8 *)buf + extra_off),
+                (ssize_t)hdr.extra_length);
+
+            if(hdr.hash[0] != '\0') {
+                var sb = new StringBuilder.sized(65);
+                for(int i = 0; i < 64 && hdr.hash[i] != '\0'; ++i) {
+                    sb.append_c(hdr.hash[i]);
+                }
+                retval.source_hash_ = sb.str;
+            }
+
+            if(!retval.is_well_formed()) {
+                throw new MarkupError.INVALID_CONTENT("Serialized document is corrupt");
+            }
+            return retval;
+        }
+
+        /** Headers can be level 1 through this, as in HTML.  0 for non-headers. */
+        private const uint MAX_HEADER_LEVEL = 6;
+
+        /**
+         * Check that the tree is consistent.
+         *
+         * Checks that the links and slices are in range, and that children
+         * and later siblings come after their parents and earlier siblings,
+         * as they do in trees built by appending.  That rules out cycles.
+         *
+         * Also checks that each node is in the child list of its parent and
+         * no other, that each child list ends at its parent's last_child,
+         * and that types and header levels are valid.
+         */
+        private bool is_well_formed()
+        {
+            int n = nodes.length;
+            if(nodes[0].parent != NONE) {
+                return false;
+            }
+
+            var types = (EnumClass) typeof(Elem.Type).class_ref();
+            int nreached = 0;   // nodes found by walking child lists
+
+            for(int idx = 0; idx < n; ++idx) {
+                var node = nodes[idx];
+                if((idx > 0 && (node.parent < 0 || node.parent >= idx)) ||
+                    !is_later_link(node.first_child, idx, n) ||
+                    !is_later_link(node.last_child, idx, n) ||
+                    !is_later_link(node.next_sibling, idx, n) ||
+                    (node.first_child == NONE) != (node.last_child == NONE) ||
+                    node.ty == Elem.Type.INVALID ||
+                    types.get_value(node.ty) == null ||
+                    node.header_level > MAX_HEADER_LEVEL ||
+                    !is_valid_slice(node.text) ||
+                    !is_valid_slice(node.info_string) ||
+                    !is_valid_slice(node.href)) {
+                    return false;
+                }
+
+                // The links all point forward, so this terminates
+                int last = NONE;
+                for(int kid = node.first_child; kid != NONE; kid = nodes[kid].next_sibling) {
+                    if(nodes[kid].parent != idx) {
+                        return false;
+                    }
+                    last = kid;
+                    ++nreached;
+                }
+                if(last != node.last_child) {
+                    return false;
+                }
+            }
+
+            // Each node's parent check passed only in its parent's list, so
+            // a node can't be counted twice.  Therefore, this means every
+            // node other than the root is reachable.
+            return nreached == n - 1;
+        }
+
+        /** Whether @link is NONE or a node after @idx */
+        private static bool is_later_link(int link, int idx, int n)
+        {
+            return link == NONE || (link > idx && link < n);
+        }
+
+        /** Whether @slice is within the source or side buffer */
+        private bool is_valid_slice(Slice slice)
+        {
+            if(slice.length < 0) {
+                return false;
+            }
+            if(slice.length == 0) {
+                return true;
+            }
+            if(slice.offset >= 0) {
+                return (size_t)slice.offset + slice.length <= source_length_;
+            }
+            return (size_t)(-(slice.offset + 1)) + slice.length <= extra_.len;
+        }
+
+        /** The deepest level that as_string() indents further */
+        private const uint MAX_STRING_INDENT = 32;
+
+        /**
+         * Return a string representation of this tree.
+         *
+         * The format is the same as Doc.as_string() had for GLib.Node trees,
+         * except that nodes deeper than MAX_STRING_INDENT are indented no
+         * further and are labeled with their depth.  Otherwise the string
+         * would be quadratic in the depth of the tree.
+         */
+        public string as_string()
+        {
+            var sb = new StringBuilder();
+            sb.append("Document:\n");
+            foreach_preorder(0, (tree, idx, depth)=>{
+                sb.append(string.nfill(2*uint.min(depth, MAX_STRING_INDENT), ' '));
+                if(depth > MAX_STRING_INDENT) {
+                    sb.append_printf("(depth %u) ", depth);
+                }
+                sb.append_printf("Node: type %s, text -", nodes[idx].ty.to_string());
+                append_text_to(idx, sb);
+                sb.append("-\n");
+                return false;
+            });
+            return sb.str;
+        }
+    } // class DocTree
+} // My
@@ -11,15 +11,6 @@ namespace My {
     public const string INFOSTR_HTML = "html";
     public const string INFOSTR_NOP = "nop";
 
-    /**
-     * Our own definition for gst_value_deserialize().
-     *
-     * Per [[https://gitlab.gnome.org/GNOME/vala/-/issues/1014]], older
-     * valac versions have an incorrect binding for gst_value_deserialize().
-     */
-    [CCode (cheader_filename = "gst/gst.h", cname = "gst_value_deserialize")]
-    public extern bool deserialize_value (ref GLib.Value dest, string src);
-
     /**
      * Data of a node in the Markdown tree.
      *
@@ -196,22 +187,63 @@ namespace My {
     /**
      * A document to be rendered
      *
-     * Parent-child relationships are handled by GLib.Node.  This is just
-     * a convenience class for holding a GLib.Node<Elem> tree.  It provides
-     * some debugging methods and saves typing.
+     * A Doc is backed either by a DocTree or by a GLib.Node<Elem> tree.
+     * Readers produce DocTrees, which are compact.  The GLib.Node tree
+     * is created on demand when the root property is read, and is
+     * convenient for tests and for building small documents by hand.
+     * Once root has been read or set, it is the authoritative copy.
      */
     public class Doc {
+        /** Storage for root */
+        private GLib.Node<Elem> root_ = null;
+
+        /** The compact tree, if this doc is backed by one */
+        private DocTree tree_ = null;
+
         /**
          * The root element of the document tree.
          *
          * Assumption: root does not have any siblings.
          */
-        public GLib.Node<Elem> root;
+        public GLib.Node<Elem> root {
+            get {
+                if(root_ == null && tree_ != null) {
+                    root_ = tree_.to_nodes();
+                    tree_ = null;
+                }
+                return root_;
+            }
+            owned set {
+                root_ = (owned)value;
+                tree_ = null;
+            }
+        }
 
         /** Create a doc owning a node tree */
         public Doc(owned GLib.Node<Elem> new_root)
         {
-            root = (owned)new_root;
+            root_ = (owned)new_root;
+        }
+
+        /** Create a doc backed by a compact tree */
+        public Doc.from_tree(DocTree tree)
+        {
+            tree_ = tree;
+        }
+
+        /**
+         * Get the document as a compact tree.
+         *
+         * If the document is backed by a node tree, this makes a new
+         * DocTree each time it is called.
+         * @return The tree, or null if the document is empty.
+         */
+        public DocTree? get_tree()
+        {
+            if(root_ != null) {
+                return DocTree.from_nodes(root_);
+            }
+            return tree_;
         }
 
         /**
@@ -232,17 +264,13 @@ namespace My {
 
         /**
          * Return a string representation of this document
+         *
+         * A GLib.Node tree is converted to a DocTree first, since
+         * GLib.Node.traverse() recurses and cannot handle deep trees.
          */
         public string as_string()
         {
-            var sb = new StringBuilder();
-            sb.append("Document:\n");
-            GLib.NodeTraverseFunc cb =
-                (node)=>{
-                return dump_node_into(sb, node);
-            };
-            root.traverse(TraverseType.PRE_ORDER, TraverseFlags.ALL, -1, cb);
-            return sb.str;
+            return get_tree().as_string();
         } // as_string
 
     } // class Doc
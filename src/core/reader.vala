@@ -15,4 +15,19 @@ namespace My {
          */
         public abstract Doc read_document(string filename) throws FileError, MarkupError;
     }
+
+    /**
+     * Document reader that can hand off blocks as it reads them.
+     */
+    public interface StreamingReader : Reader {
+        /**
+         * Read a document, passing each top-level block to @sink as soon
+         * as it is complete.
+         *
+         * The caller is responsible for calling BlockSink.begin_document()
+         * and BlockSink.end_document().
+         */
+        public abstract void stream_document(string filename, BlockSink sink)
+        throws FileError, MarkupError, My.Error;
+    }
 } // My
@@ -57,7 +57,7 @@ namespace My {
                 target.set_property(nv[0], val);
                 linfoo(target, "Set property %s from command line to %s",
                     nv[0], val.type() == typeof(string) ? @"'$(val.get_string())'" :
-                    Gst.Value.serialize(val)    // LCOV_EXCL_LINE - can't guarantee this will fire during tests
+                    serialize_value(val)    // LCOV_EXCL_LINE - can't guarantee this will fire during tests
                 );
 
             } // foreach option
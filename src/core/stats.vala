@@ -0,0 +1,202 @@
+// core/stats.vala - Timing and counters for --stats
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+namespace My {
+
+    /**
+     * Process-wide timers and counters.
+     *
+     * Collection is off by default.  When it is off, each call costs one
+     * check of Stats.enabled.  Callers that have to do work to compute a
+     * key (e.g., concatenating a type name) should check Stats.enabled
+     * themselves first.
+     *
+     * Timers are keyed by phase, e.g., "read" or "render.ParaBlk".  Each
+     * timer records how many times it ran, the total time, and the
+     * longest time.  Counters are keyed by what they count, e.g., "pages".
+     *
+     * Usage:
+     * {{{
+     *     var t = Stats.start();
+     *     do_something();
+     *     Stats.stop("something", t);
+     *     Stats.count("widgets", nwidgets);
+     * }}}
+     *
+     * All functions are thread-safe.  Everything is static.
+     */
+    public class Stats {
+        /** Whether to collect statistics.  Set before starting work. */
+        public static bool enabled = false;
+
+        /** One timer or counter */
+        private class Entry {
+            public bool is_timer = false;
+            /** How many times the timer ran, or the count */
+            public uint64 n = 0;
+            public int64 total_us = 0;
+            public int64 max_us = 0;
+        }
+
+        /** Guards entries_.  Statically allocated, so needs no init. */
+        private static Mutex mutex_;
+
+        /** The timers and counters, created on first use */
+        private static HashTable<string, Entry> entries_ = null;
+
+        /** Get the entry for @key.  Call with mutex_ held. */
+        private static Entry get_entry_locked(string key)
+        {
+            if(entries_ == null) {
+                entries_ = new HashTable<string, Entry>(str_hash, str_equal);
+            }
+            var retval = entries_.lookup(key);
+            if(retval == null) {
+                retval = new Entry();
+                entries_.insert(key, retval);
+            }
+            return retval;
+        }
+
+        /**
+         * Start timing.
+         * @return The start time, to pass to stop(), or 0 if disabled
+         */
+        public static int64 start()
+        {
+            return enabled ? get_monotonic_time() : 0;
+        }
+
+        /**
+         * Stop timing.
+         * @param key       Which timer
+         * @param start_us  The return value of the corresponding start()
+         */
+        public static void stop(string key, int64 start_us)
+        {
+            if(!enabled) {
+                return;
+            }
+            var elapsed = get_monotonic_time() - start_us;
+
+            mutex_.lock();
+            var entry = get_entry_locked(key);
+            entry.is_timer = true;
+            ++entry.n;
+            entry.total_us += elapsed;
+            if(elapsed > entry.max_us) {
+                entry.max_us = elapsed;
+            }
+            mutex_.unlock();
+        }
+
+        /** Add @n to counter @key */
+        public static void count(string key, uint64 n = 1)
+        {
+            if(!enabled) {
+                return;
+            }
+
+            mutex_.lock();
+            get_entry_locked(key).n += n;
+            mutex_.unlock();
+        }
+
+        /** Get the total time for timer @key, in seconds */
+        public static double get_seconds(string key)
+        {
+            mutex_.lock();
+            var entry = (entries_ == null) ? null : entries_.lookup(key);
+            double retval = (entry == null) ? 0 : entry.total_us / 1e6;
+            mutex_.unlock();
+            return retval;
+        }
+
+        /** Get the value of counter @key, or the number of runs of timer @key */
+        public static uint64 get_count(string key)
+        {
+            mutex_.lock();
+            var entry = (entries_ == null) ? null : entries_.lookup(key);
+            uint64 retval = (entry == null) ? 0 : entry.n;
+            mutex_.unlock();
+            return retval;
+        }
+
+        /** Forget all the timers and counters */
+        public static void reset()
+        {
+            mutex_.lock();
+            entries_ = null;
+            mutex_.unlock();
+        }
+
+        /** Get the keys in order.  Call with mutex_ held. */
+        private static List<unowned string> sorted_keys_locked()
+        {
+            if(entries_ == null) {
+                return new List<unowned string>();
+            }
+            var retval = entries_.get_keys();
+            retval.sort(strcmp);
+            return retval;
+        }
+
+        /** Report the statistics as a human-readable table */
+        public static string to_table()
+        {
+            var sb = new StringBuilder();
+            mutex_.lock();
+            var keys = sorted_keys_locked();
+
+            sb.append_printf("%-32s %10s %12s %12s %12s\n", "Timer", "calls",
+                "total (s)", "mean (ms)", "max (ms)");
+            foreach(var key in keys) {
+                var entry = entries_.lookup(key);
+                if(entry.is_timer) {
+                    sb.append_printf("%-32s %10s %12.6f %12.3f %12.3f\n", key,
+                        entry.n.to_string(), entry.total_us / 1e6,
+                        entry.total_us / 1e3 / entry.n, entry.max_us / 1e3);
+                }
+            }
+
+            sb.append_printf("\n%-32s %10s\n", "Counter", "count");
+            foreach(var key in keys) {
+                var entry = entries_.lookup(key);
+                if(!entry.is_timer) {
+                    sb.append_printf("%-32s %10s\n", key, entry.n.to_string());
+                }
+            }
+
+            mutex_.unlock();
+            return sb.str;
+        }
+
+        /** Report the statistics as JSON */
+        public static string to_json()
+        {
+            var timers = new StringBuilder();
+            var counters = new StringBuilder();
+            mutex_.lock();
+
+            foreach(var key in sorted_keys_locked()) {
+                var entry = entries_.lookup(key);
+                if(entry.is_timer) {
+                    timers.append_printf(
+                        "%s\n    \"%s\": { \"calls\": %s, \"total_s\": %s, \"max_s\": %s }",
+                        timers.len > 0 ? "," : "", key.escape(),
+                        entry.n.to_string(), (entry.total_us / 1e6).to_string(),
+                        (entry.max_us / 1e6).to_string());
+                } else {
+                    counters.append_printf("%s\n    \"%s\": %s",
+                        counters.len > 0 ? "," : "", key.escape(),
+                        entry.n.to_string());
+                }
+            }
+
+            mutex_.unlock();
+            return "{\n  \"timers\": {%s\n  },\n  \"counters\": {%s\n  }\n}\n".printf(
+                timers.str, counters.str);
+        }
+    } // class Stats
+} // My
@@ -373,7 +373,7 @@ namespace My {
                 this.get_property(propname, ref v);
                 target.set_property(propname, v);
                 linfoo(target, "Set property %s from template to %s",
-                    propname, Gst.Value.serialize(v));
+                    propname, serialize_value(v));
             }
         } // set_props_on()
 
@@ -38,6 +38,240 @@ namespace My {
         return new GLib.Node<Elem>(new Elem(newty));
     }
 
+    // --- Files ----------------------------------------------------------
+
+    /**
+     * Whether load_file() may memory-map files.
+     *
+     * Set this to false if the input files are likely to change while they
+     * are being read, e.g., in --watch mode.  A mapped file that is
+     * truncated in place (as some editors save) raises SIGBUS when the
+     * mapping is read.
+     */
+    public bool map_input_files = true;
+
+    /**
+     * Get the contents of a file.
+     *
+     * Regular files are memory-mapped if map_input_files is set, so they
+     * are not copied.  Anything that cannot be mapped, e.g., a pipe, a FIFO,
+     * or /dev/stdin, is read into memory instead.
+     */
+    public Bytes load_file(string filename) throws FileError
+    {
+        if(map_input_files && FileUtils.test(filename, FileTest.IS_REGULAR)) {
+            try {
+                return new MappedFile(filename, false).get_bytes();
+            } catch(FileError e) {
+                // Fall through, e.g., for file systems that can't map
+            }
+        }
+
+        uint8[] contents;
+        FileUtils.get_data(filename, out contents);
+        return new Bytes.take((owned)contents);
+    }
+
+    // --- Values ---------------------------------------------------------
+
+    /**
+     * Parse an integer.
+     *
+     * Accepts an optional sign, then decimal digits or "0x" and hex digits.
+     *
+     * @param text      The text, without surrounding whitespace
+     * @param negative  Whether the number is negative (never true for 0)
+     * @param magnitude The absolute value of the number
+     * @return True on success
+     */
+    private bool parse_integer(string text, out bool negative,
+        out uint64 magnitude)
+    {
+        negative = false;
+        magnitude = 0;
+
+        int i = 0;
+        if(text[0] == '-' || text[0] == '+') {
+            negative = (text[0] == '-');
+            ++i;
+        }
+
+        uint64 radix = 10;
+        if(text[i] == '0' && (text[i+1] == 'x' || text[i+1] == 'X')) {
+            radix = 16;
+            i += 2;
+        }
+
+        if(text[i] == '\0') {
+            return false;
+        }
+
+        for(; text[i] != '\0'; ++i) {
+            int digit = (radix == 16) ? text[i].xdigit_value() : text[i].digit_value();
+            if(digit < 0 || magnitude > (uint64.MAX - (uint64)digit) / radix) {
+                return false;
+            }
+            magnitude = magnitude * radix + (uint64)digit;
+        }
+
+        if(magnitude == 0) {
+            negative = false;
+        }
+        return true;
+    }
+
+    /**
+     * Convert the result of parse_integer() to an int64, if it is in range.
+     *
+     * Numbers between int64.MAX and @max are returned cast to int64,
+     * for the benefit of unsigned types.
+     */
+    private bool integer_in_range(bool negative, uint64 magnitude,
+        int64 min, uint64 max, out int64 result)
+    {
+        result = 0;
+        if(negative) {
+            if(min >= 0 || magnitude - 1 > (uint64)(-(min + 1))) {
+                return false;
+            }
+            result = -(int64)(magnitude - 1) - 1;
+        } else {
+            if(magnitude > max) {
+                return false;
+            }
+            result = (int64)magnitude;
+        }
+        return true;
+    }
+
+    /**
+     * Fill in a value from its string representation.
+     *
+     * Supports the property types pfft uses: strings, booleans, integers,
+     * floating-point numbers, and enums.  The syntax is compatible with
+     * gst_value_deserialize() for those types, but does not require
+     * GStreamer.
+     *
+     * - Strings are used as is, unless they are in double quotes,
+     *   in which case backslash escapes are processed.
+     * - Booleans are true/yes/t/1 or false/no/f/0, in any case.
+     * - Integers are decimal, or hex with a "0x" prefix.
+     * - Enums are by name, nick, or number.
+     *
+     * @param dest  The value to fill in.  Must already be initialized
+     *              with the desired type.
+     * @param src   The string representation
+     * @return True on success; false if @src could not be parsed
+     */
+    public bool deserialize_value(ref GLib.Value dest, string src)
+    {
+        var ty = dest.type();
+
+        if(ty == typeof(string)) {
+            if(src.length >= 2 && src[0] == '"' && src[src.length-1] == '"') {
+                dest.set_string(src.substring(1, src.length-2).compress());
+            } else if(src.validate()) {
+                dest.set_string(src);
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        var text = src.strip();
+
+        if(ty == typeof(bool)) {
+            var lc = text.ascii_down();
+            if(lc == "true" || lc == "yes" || lc == "t" || lc == "1") {
+                dest.set_boolean(true);
+            } else if(lc == "false" || lc == "no" || lc == "f" || lc == "0") {
+                dest.set_boolean(false);
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        if(ty == typeof(double) || ty == typeof(float)) {
+            double d;
+            if(text == "" || !double.try_parse(text, out d)) {
+                return false;
+            }
+            if(ty == typeof(double)) {
+                dest.set_double(d);
+            } else {
+                dest.set_float((float)d);
+            }
+            return true;
+        }
+
+        bool negative;
+        uint64 magnitude;
+        int64 n;
+
+        if(ty.is_enum()) {
+            var klass = (EnumClass)ty.class_ref();
+            unowned EnumValue? ev = klass.get_value_by_name(text);
+            if(ev == null) {
+                ev = klass.get_value_by_nick(text);
+            }
+            if(ev == null && parse_integer(text, out negative, out magnitude) &&
+                integer_in_range(negative, magnitude, int.MIN, int.MAX, out n)) {
+                ev = klass.get_value((int)n);
+            }
+            if(ev == null) {
+                return false;
+            }
+            dest.set_enum(ev.value);
+            return true;
+        }
+
+        if(!parse_integer(text, out negative, out magnitude)) {
+            return false;
+        }
+
+        if(ty == typeof(int)) {
+            if(!integer_in_range(negative, magnitude, int.MIN, int.MAX, out n)) {
+                return false;
+            }
+            dest.set_int((int)n);
+        } else if(ty == typeof(uint)) {
+            if(!integer_in_range(negative, magnitude, 0, uint.MAX, out n)) {
+                return false;
+            }
+            dest.set_uint((uint)n);
+        } else if(ty == typeof(long)) {
+            if(!integer_in_range(negative, magnitude, long.MIN, long.MAX, out n)) {
+                return false;
+            }
+            dest.set_long((long)n);
+        } else if(ty == typeof(ulong)) {
+            if(!integer_in_range(negative, magnitude, 0, ulong.MAX, out n)) {
+                return false;
+            }
+            dest.set_ulong((ulong)n);
+        } else if(ty == typeof(int64)) {
+            if(!integer_in_range(negative, magnitude, int64.MIN, int64.MAX, out n)) {
+                return false;
+            }
+            dest.set_int64(n);
+        } else if(ty == typeof(uint64)) {
+            if(!integer_in_range(negative, magnitude, 0, uint64.MAX, out n)) {
+                return false;
+            }
+            dest.set_uint64((uint64)n);
+        } else {
+            return false;   // unsupported type
+        }
+        return true;
+    } // deserialize_value()
+
+    /** Describe a value, for log messages */
+    public string serialize_value(GLib.Value val)
+    {
+        return val.strdup_contents();
+    }
+
     /**
      * Wrap a string in TAP markers.
      *
@@ -34,5 +34,64 @@ namespace My {
                 FileUtils.set_contents(filename, contents);
             }
         } // emit()
+
+        /**
+         * As emit(), but for binary data
+         */
+        public static void emit_data(string filename, Bytes contents)
+        throws FileError
+        {
+            unowned uint8[] data = contents.get_data();
+            if(filename == "-") {
+                stdout.write(data);
+                stdout.flush();
+            } else {
+                FileUtils.set_data(filename, data);
+            }
+        } // emit_data()
+    }
+
+    /**
+     * Consumer of a document one top-level block at a time.
+     *
+     * A writer that implements this can start producing output before the
+     * whole document has been read.  A StreamingReader calls
+     * add_block() for each top-level block, in order, between calls to
+     * begin_document() and end_document().
+     */
+    public interface BlockSink : Object {
+        /**
+         * Start writing a document.
+         * @param filename  The name of the file to write
+         * @param sourcefn  The filename of the source, as for
+         *                  Writer.write_document().
+         */
+        public abstract void begin_document(string filename,
+            string? sourcefn = null)
+        throws FileError, My.Error;
+
+        /**
+         * Process one top-level block.
+         *
+         * @param tree  The tree holding the block.  The caller may reuse
+         *              the tree's storage after this returns, so
+         *              implementations must not keep references into it.
+         * @param idx   The block, a child of the root of @tree
+         */
+        public abstract void add_block(DocTree tree, int idx)
+        throws My.Error;
+
+        /** Finish the document begun by begin_document() */
+        public abstract void end_document()
+        throws FileError, My.Error;
+
+        /**
+         * Stop writing the document begun by begin_document() without
+         * finishing it, e.g., because reading it failed.
+         *
+         * Any partial output file is removed.  Does nothing if no document
+         * has been begun.
+         */
+        public abstract void abort_document();
     }
 } // My
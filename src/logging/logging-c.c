@@ -6,12 +6,193 @@
 
 #include "logging-c.h"
 
-GST_DEBUG_CATEGORY(my_log_category);
+#include <stdio.h>
+#include <unistd.h>
+
+volatile gint my_log_threshold = GST_LEVEL_NONE;
+
+/** When logging started, for timestamps */
+static gint64 my_log_start_us = 0;
+
+/** Serializes output so lines from different threads don't interleave */
+static GMutex my_log_mutex;
+
+/** Names of the levels, as printed and as accepted in GST_DEBUG */
+static const gchar *my_log_level_names[] = {
+    "NONE", "ERROR", "WARNING", "FIXME", "INFO", "DEBUG", "LOG", "TRACE",
+    NULL, "MEMDUMP"
+};
+
+static const gchar *
+my_log_level_name(GstDebugLevel level)
+{
+    if(level >= 0 && level < (gint)G_N_ELEMENTS(my_log_level_names) &&
+        my_log_level_names[level] != NULL) {
+        return my_log_level_names[level];
+    }
+    return "?";
+}
+
+/**
+ * Parse a level, by number or by name.
+ * Returns: the level, or -1 if @text is not a level.
+ */
+static gint
+my_log_parse_level(const gchar *text)
+{
+    gchar *end = NULL;
+    gint64 n = g_ascii_strtoll(text, &end, 10);
+    if(end != text && *end == '\0') {
+        return (gint)CLAMP(n, GST_LEVEL_NONE, GST_LEVEL_MEMDUMP);
+    }
+
+    for(guint i = 0; i < G_N_ELEMENTS(my_log_level_names); ++i) {
+        if(my_log_level_names[i] != NULL &&
+            g_ascii_strcasecmp(text, my_log_level_names[i]) == 0) {
+            return (gint)i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Get the threshold from @spec, which has the same format as GST_DEBUG:
+ * comma-separated `pattern:level` entries, or a bare `level` for all
+ * categories.  Entries that match "pfft" apply; the last one wins.
+ */
+static gint
+my_log_threshold_from_spec(const gchar *spec)
+{
+    gint retval = GST_LEVEL_NONE;
+    gchar **entries;
+
+    if(spec == NULL) {
+        return retval;
+    }
+
+    entries = g_strsplit(spec, ",", -1);
+    for(gchar **entry = entries; *entry != NULL; ++entry) {
+        gchar **parts = g_strsplit(g_strstrip(*entry), ":", 2);
+        gint level = -1;
+
+        if(parts[0] != NULL && parts[1] == NULL) {  // bare level
+            level = my_log_parse_level(parts[0]);
+        } else if(parts[0] != NULL &&
+            g_pattern_match_simple(g_strstrip(parts[0]), "pfft")) {
+            level = my_log_parse_level(g_strstrip(parts[1]));
+        }
+
+        if(level >= 0) {
+            retval = level;
+        }
+        g_strfreev(parts);
+    }
+    g_strfreev(entries);
+
+    return retval;
+}
 
 void my_log_linit()
 {
-    GST_DEBUG_CATEGORY_INIT(my_log_category, "pfft", 0, "");
-    GST_INFO("pfft logging initialized");
+    my_log_start_us = g_get_monotonic_time();
+    g_atomic_int_set(&my_log_threshold,
+        my_log_threshold_from_spec(g_getenv("GST_DEBUG")));
+    MY_INFO("pfft logging initialized");
+}
+
+void my_log_set_level(GstDebugLevel level)
+{
+    g_atomic_int_set(&my_log_threshold, level);
+}
+
+GstDebugLevel my_log_get_level()
+{
+    return (GstDebugLevel)g_atomic_int_get(&my_log_threshold);
+}
+
+/** Describe @obj, GStreamer-style.  Returns a new string. */
+static gchar *
+my_log_describe_object(gconstpointer obj)
+{
+    if(obj == NULL) {
+        return g_strdup("");
+    }
+    if(G_IS_OBJECT(obj)) {
+        return g_strdup_printf("<%s@%p>", G_OBJECT_TYPE_NAME(obj), obj);
+    }
+    return g_strdup_printf("<%p>", obj);
+}
+
+/** Write the prefix of a log line.  Call with my_log_mutex held. */
+static void
+my_log_write_prefix_locked(GstDebugLevel level, const gchar *file,
+    const gchar *func, gint line, const gchar *objdesc)
+{
+    gint64 us = g_get_monotonic_time() - my_log_start_us;
+    const gchar *basename = strrchr(file, G_DIR_SEPARATOR);
+
+    fprintf(stderr, "%u:%02u:%02u.%06u %5d %p %7s %20s %s:%d:%s:%s ",
+        (guint)(us / G_USEC_PER_SEC / 3600),
+        (guint)(us / G_USEC_PER_SEC / 60 % 60),
+        (guint)(us / G_USEC_PER_SEC % 60),
+        (guint)(us % G_USEC_PER_SEC),
+        (gint)getpid(), (void *)g_thread_self(),
+        my_log_level_name(level), "pfft",
+        basename ? basename + 1 : file, line, func, objdesc);
+}
+
+void my_log_emit(GstDebugLevel level, const gchar *file, const gchar *func,
+    gint line, gconstpointer obj, const gchar *format, ...)
+{
+    va_list args;
+    gchar *message;
+    gchar *objdesc = my_log_describe_object(obj);
+
+    va_start(args, format);
+    message = g_strdup_vprintf(format, args);
+    va_end(args);
+
+    g_mutex_lock(&my_log_mutex);
+    my_log_write_prefix_locked(level, file, func, line, objdesc);
+    fprintf(stderr, "%s\n", message);
+    g_mutex_unlock(&my_log_mutex);
+
+    g_free(message);
+    g_free(objdesc);
+}
+
+void my_log_memdump(const gchar *file, const gchar *func, gint line,
+    gconstpointer obj, const gchar *message, const guint8 *data, gint length)
+{
+    gchar *objdesc = my_log_describe_object(obj);
+
+    g_mutex_lock(&my_log_mutex);
+    my_log_write_prefix_locked(GST_LEVEL_MEMDUMP, file, func, line, objdesc);
+    fprintf(stderr, "---------------------------------------------------------------------------\n");
+    my_log_write_prefix_locked(GST_LEVEL_MEMDUMP, file, func, line, objdesc);
+    fprintf(stderr, "%s (%d bytes)\n", message, length);
+
+    for(gint off = 0; data != NULL && off < length; off += 16) {
+        gchar hex[16*3 + 1], ascii[16 + 1];
+        gint i;
+
+        for(i = 0; i < 16 && off + i < length; ++i) {
+            guint8 c = data[off + i];
+            g_snprintf(hex + i*3, 4, "%02x ", c);
+            ascii[i] = g_ascii_isprint(c) ? (gchar)c : '.';
+        }
+        hex[i*3] = '\0';
+        ascii[i] = '\0';
+
+        my_log_write_prefix_locked(GST_LEVEL_MEMDUMP, file, func, line, objdesc);
+        fprintf(stderr, "%08x: %-48.48s %-16.16s\n", off, hex, ascii);
+    }
+
+    my_log_write_prefix_locked(GST_LEVEL_MEMDUMP, file, func, line, objdesc);
+    fprintf(stderr, "---------------------------------------------------------------------------\n");
+    g_mutex_unlock(&my_log_mutex);
+
+    g_free(objdesc);
 }
 
 // the following is copied from
@@ -90,44 +90,135 @@
 #ifndef G_LOG_DOMAIN
 #define G_LOG_DOMAIN "pfft"
 #endif
-#define GST_CAT_DEFAULT my_log_category
 
 #include <float.h>
 #include <string.h>
+#include <glib.h>
+#include <glib-object.h>
+
+// Only for the GstDebugLevel enum.  pfft does not initialize GStreamer.
 #include <gst/gst.h>
 
 /**
- * my_log_category:
+ * my_log_threshold:
+ *
+ * The most verbose level that will be logged.  Updated by my_log_linit()
+ * and my_log_set_level().  Read without locking: a stale value only
+ * means a message is dropped or emitted while the threshold is changing.
+ */
+extern volatile gint my_log_threshold;
+
+/**
+ * MY_LOG_MAX_LEVEL:
  *
- * Log category for messages from the pfft logging API
+ * The most verbose level that is compiled in.  Configure with
+ * --disable-trace-logging to define MY_LOG_NO_TRACE, which compiles out
+ * TRACE and MEMDUMP messages, and anything guarded by
+ * `lenabled(TRACE)` or `lenabled(MEMDUMP)`.
  */
-GST_DEBUG_CATEGORY_EXTERN(my_log_category);
+#ifdef MY_LOG_NO_TRACE
+#define MY_LOG_MAX_LEVEL GST_LEVEL_LOG
+#else
+#define MY_LOG_MAX_LEVEL GST_LEVEL_MAX
+#endif
 
 /**
  * my_log_lenabled:
  * @level: the severity of the message
  *
- * Conditional to determine whether logging is enabled for my_log_category
- * at the given @level.
+ * Conditional to determine whether logging is enabled at the given @level.
  *
- * Modified from gst/gstinfo.h, macro GST_CAT_LEVEL_LOG(), as of
- * <https://gitlab.freedesktop.org/gstreamer/gstreamer/-/merge_requests/403>.
- * I am using the version from before
- * <https://gitlab.freedesktop.org/gstreamer/gstreamer/-/issues/564>
- * since this function is expressly meant to guard expensive debug statements.
+ * When @level is a constant above MY_LOG_MAX_LEVEL, this is constant
+ * false, so the compiler drops the code it guards.  Otherwise, it is
+ * one comparison against my_log_threshold.  Based on gst/gstinfo.h,
+ * macro GST_CAT_LEVEL_LOG().
  */
 #define my_log_lenabled(level) ( \
-  (G_UNLIKELY ((level) <= GST_LEVEL_MAX)) && ((level) <= _gst_debug_min) && \
-  ((level) <= gst_debug_category_get_threshold (my_log_category)) \
+  ((level) <= MY_LOG_MAX_LEVEL) && \
+  G_UNLIKELY ((gint)(level) <= my_log_threshold) \
   )
 
+/**
+ * my_log_emit:
+ *
+ * Write a message to stderr in the same format as GStreamer's default
+ * log function.  Does not check the threshold; use the macros below.
+ */
+void my_log_emit(GstDebugLevel level, const gchar *file, const gchar *func,
+    gint line, gconstpointer obj, const gchar *format, ...) G_GNUC_PRINTF(6, 7);
+
+/**
+ * my_log_memdump:
+ *
+ * Write @message and a hex dump of @data to stderr.  Does not check the
+ * threshold; use MY_MEMDUMP_OBJECT().
+ */
+void my_log_memdump(const gchar *file, const gchar *func, gint line,
+    gconstpointer obj, const gchar *message, const guint8 *data, gint length);
+
+/**
+ * MY_LOG_LEVEL_OBJECT:
+ * @level: the severity of the message
+ * @obj: (nullable): the object the message is about
+ *
+ * Log a message if @level is enabled.  The arguments are only evaluated
+ * if the message will be emitted.  Used by the MY_* macros below,
+ * which the Vala bindings in logging.vala refer to.
+ */
+#define MY_LOG_LEVEL_OBJECT(level, obj, ...) G_STMT_START { \
+  if (my_log_lenabled (level)) { \
+    my_log_emit ((level), __FILE__, G_STRFUNC, __LINE__, \
+        (gconstpointer) (obj), __VA_ARGS__); \
+  } \
+} G_STMT_END
+
+#define MY_ERROR(...)               MY_LOG_LEVEL_OBJECT (GST_LEVEL_ERROR, NULL, __VA_ARGS__)
+#define MY_WARNING(...)             MY_LOG_LEVEL_OBJECT (GST_LEVEL_WARNING, NULL, __VA_ARGS__)
+#define MY_FIXME(...)               MY_LOG_LEVEL_OBJECT (GST_LEVEL_FIXME, NULL, __VA_ARGS__)
+#define MY_INFO(...)                MY_LOG_LEVEL_OBJECT (GST_LEVEL_INFO, NULL, __VA_ARGS__)
+#define MY_DEBUG(...)               MY_LOG_LEVEL_OBJECT (GST_LEVEL_DEBUG, NULL, __VA_ARGS__)
+#define MY_LOG(...)                 MY_LOG_LEVEL_OBJECT (GST_LEVEL_LOG, NULL, __VA_ARGS__)
+#define MY_TRACE(...)               MY_LOG_LEVEL_OBJECT (GST_LEVEL_TRACE, NULL, __VA_ARGS__)
+
+#define MY_ERROR_OBJECT(obj, ...)   MY_LOG_LEVEL_OBJECT (GST_LEVEL_ERROR, obj, __VA_ARGS__)
+#define MY_WARNING_OBJECT(obj, ...) MY_LOG_LEVEL_OBJECT (GST_LEVEL_WARNING, obj, __VA_ARGS__)
+#define MY_FIXME_OBJECT(obj, ...)   MY_LOG_LEVEL_OBJECT (GST_LEVEL_FIXME, obj, __VA_ARGS__)
+#define MY_INFO_OBJECT(obj, ...)    MY_LOG_LEVEL_OBJECT (GST_LEVEL_INFO, obj, __VA_ARGS__)
+#define MY_DEBUG_OBJECT(obj, ...)   MY_LOG_LEVEL_OBJECT (GST_LEVEL_DEBUG, obj, __VA_ARGS__)
+#define MY_LOG_OBJECT(obj, ...)     MY_LOG_LEVEL_OBJECT (GST_LEVEL_LOG, obj, __VA_ARGS__)
+#define MY_TRACE_OBJECT(obj, ...)   MY_LOG_LEVEL_OBJECT (GST_LEVEL_TRACE, obj, __VA_ARGS__)
+
+#define MY_MEMDUMP_OBJECT(obj, msg, data, length) G_STMT_START { \
+  if (my_log_lenabled (GST_LEVEL_MEMDUMP)) { \
+    my_log_memdump (__FILE__, G_STRFUNC, __LINE__, (gconstpointer) (obj), \
+        (msg), (const guint8 *) (data), (length)); \
+  } \
+} G_STMT_END
+
+#define MY_MEMDUMP(msg, data, length) MY_MEMDUMP_OBJECT (NULL, msg, data, length)
+
 /**
  * my_log_linit:
  *
- * Initialize my_log_category.  Call gst_init() first.
+ * Initialize logging.  Reads the initial threshold from the `pfft`
+ * entries in the GST_DEBUG environment variable, if any.  Does not
+ * initialize GStreamer.
  */
 extern void my_log_linit();
 
+/**
+ * my_log_set_level:
+ * @level: the new threshold
+ */
+extern void my_log_set_level(GstDebugLevel level);
+
+/**
+ * my_log_get_level:
+ *
+ * Returns: the current threshold
+ */
+extern GstDebugLevel my_log_get_level();
+
 /**
  * my_canonicalize_filename:
  *
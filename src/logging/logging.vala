@@ -12,79 +12,82 @@
 // cheaders for other parts of My.
 namespace My {
     namespace Log {
-        public extern Gst.DebugCategory? category;
-
         // === Logging functions ===
-        // These are all defined in gst/gst.h.  However, we include them
-        // from logging-c.h.  That file defines the default debug
-        // category, then pulls in gst.h.
+        // These are all macros defined in logging-c.h.  Each checks a
+        // cached copy of the threshold before evaluating its arguments,
+        // so a disabled message costs one comparison.  However, valac
+        // evaluates some arguments before the call (e.g., owned strings
+        // returned by functions).  Wrap such calls in `if(lenabled(...))`.
 
-        [CCode(cname="GST_ERROR", cheader_filename = "logging-c.h")]
+        [CCode(cname="MY_ERROR", cheader_filename = "logging-c.h")]
         [PrintfFormat]
         public extern void lerror (string format, ...);
 
-        [CCode(cname="GST_WARNING", cheader_filename = "logging-c.h")]
+        [CCode(cname="MY_WARNING", cheader_filename = "logging-c.h")]
         [PrintfFormat]
         public extern void lwarning (string format, ...);
 
-        [CCode(cname="GST_FIXME", cheader_filename = "logging-c.h")]
+        [CCode(cname="MY_FIXME", cheader_filename = "logging-c.h")]
         [PrintfFormat]
         public extern void lfixme (string format, ...);
 
-        [CCode(cname="GST_INFO", cheader_filename = "logging-c.h")]
+        [CCode(cname="MY_INFO", cheader_filename = "logging-c.h")]
         [PrintfFormat]
         public extern void linfo (string format, ...);
 
-        [CCode(cname="GST_DEBUG", cheader_filename = "logging-c.h")]
+        [CCode(cname="MY_DEBUG", cheader_filename = "logging-c.h")]
         [PrintfFormat]
         public extern void ldebug (string format, ...);
 
-        [CCode(cname="GST_LOG", cheader_filename = "logging-c.h")]
+        [CCode(cname="MY_LOG", cheader_filename = "logging-c.h")]
         [PrintfFormat]
         public extern void llog (string format, ...);
 
-        [CCode(cname="GST_TRACE", cheader_filename = "logging-c.h")]
+        [CCode(cname="MY_TRACE", cheader_filename = "logging-c.h")]
         [PrintfFormat]
         public extern void ltrace (string format, ...);
 
-        [CCode(cname="GST_MEMDUMP", cheader_filename = "logging-c.h")]
+        [CCode(cname="MY_MEMDUMP", cheader_filename = "logging-c.h")]
         public extern void lmemdump (string message, string data, int length);
 
-        [CCode(cname="GST_ERROR_OBJECT", cheader_filename = "logging-c.h", simple_generics = true)]
+        [CCode(cname="MY_ERROR_OBJECT", cheader_filename = "logging-c.h", simple_generics = true)]
         [PrintfFormat]
         public extern void lerroro<T>(T obj, string format, ...);
 
-        [CCode(cname="GST_WARNING_OBJECT", cheader_filename = "logging-c.h", simple_generics = true)]
+        [CCode(cname="MY_WARNING_OBJECT", cheader_filename = "logging-c.h", simple_generics = true)]
         [PrintfFormat]
         public extern void lwarningo<T>(T obj, string format, ...);
 
-        [CCode(cname="GST_FIXME_OBJECT", cheader_filename = "logging-c.h", simple_generics = true)]
+        [CCode(cname="MY_FIXME_OBJECT", cheader_filename = "logging-c.h", simple_generics = true)]
         [PrintfFormat]
         public extern void lfixmeo<T>(T obj, string format, ...);
 
-        [CCode(cname="GST_INFO_OBJECT", cheader_filename = "logging-c.h", simple_generics = true)]
+        [CCode(cname="MY_INFO_OBJECT", cheader_filename = "logging-c.h", simple_generics = true)]
         [PrintfFormat]
         public extern void linfoo<T>(T obj, string format, ...);
 
-        [CCode(cname="GST_DEBUG_OBJECT", cheader_filename = "logging-c.h", simple_generics = true)]
+        [CCode(cname="MY_DEBUG_OBJECT", cheader_filename = "logging-c.h", simple_generics = true)]
         [PrintfFormat]
         public extern void ldebugo<T>(T obj, string format, ...);
 
-        [CCode(cname="GST_LOG_OBJECT", cheader_filename = "logging-c.h", simple_generics = true)]
+        [CCode(cname="MY_LOG_OBJECT", cheader_filename = "logging-c.h", simple_generics = true)]
         [PrintfFormat]
         public extern void llogo<T>(T obj, string format, ...);
 
-        [CCode(cname="GST_TRACE_OBJECT", cheader_filename = "logging-c.h", simple_generics = true)]
+        [CCode(cname="MY_TRACE_OBJECT", cheader_filename = "logging-c.h", simple_generics = true)]
         [PrintfFormat]
         public extern void ltraceo<T>(T obj, string format, ...);
 
-        [CCode(cname="GST_MEMDUMP_OBJECT", cheader_filename = "logging-c.h", simple_generics = true)]
+        [CCode(cname="MY_MEMDUMP_OBJECT", cheader_filename = "logging-c.h", simple_generics = true)]
         public extern void lmemdumpo<T>(T obj, string message, string data, int length);
 
         /**
          * Initialize the logging subsystem.
          *
-         * Call this after Gst.init() and before any of the above logging functions.
+         * Call this before any of the above logging functions.  The initial
+         * level comes from the `pfft` entries in the GST_DEBUG environment
+         * variable, for compatibility with earlier versions.  GStreamer
+         * itself is not initialized.
          *
          * NOTE: To get Vala filenames and line numbers, you need to pass
          * the "-g" option to valac.  Otherwise, you will get the filenames and
@@ -96,12 +99,25 @@ namespace My {
         /**
          * Determine whether a log level is enabled for our debug category.
          *
-         * This function is expressly meant to guard expensive debug statements,
-         * so may cause slowdown when debugging is enabled.
+         * Use this to guard expensive debug statements.  It is a single
+         * comparison, and is constant false for TRACE and MEMDUMP if
+         * pfft was configured with --disable-trace-logging.
          */
         [CCode (cheader_filename = "logging-c.h")]
         public extern bool lenabled(Gst.DebugLevel level);
 
+        /**
+         * Set the threshold for our debug category.
+         *
+         * Messages at this level and more severe levels are logged.
+         */
+        [CCode (cheader_filename = "logging-c.h")]
+        public extern void set_level(Gst.DebugLevel level);
+
+        /** Get the current threshold.  See set_level(). */
+        [CCode (cheader_filename = "logging-c.h")]
+        public extern Gst.DebugLevel get_level();
+
     } // Log
 
     ////////////////////////////////////////////////////////////////////////
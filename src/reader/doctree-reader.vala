@@ -0,0 +1,29 @@
+// src/reader/doctree-reader.vala
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+namespace My
+{
+    /**
+     * Reader for documents saved in DocTree's binary format.
+     *
+     * The file is memory-mapped, and its text is used in place, so loading
+     * even a large document takes little time.  Save documents in this
+     * format with the dumper writer's `format=binary` option.
+     */
+    public class DocTreeReader : Object, Reader {
+        /** Metadata for this class */
+        [Description(blurb = "Read documents saved by the dumper writer with format=binary")]
+        public bool meta { get; default = false; }
+
+        /**
+         * Read a document.
+         * @param   filename    The file to read
+         * @return A node tree of the document
+         */
+        public Doc read_document(string filename) throws FileError, MarkupError
+        {
+            return new Doc.from_tree(DocTree.deserialize(load_file(filename)));
+        }
+    }
+} // My
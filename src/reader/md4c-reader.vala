@@ -19,9 +19,9 @@ namespace My
     /**
      * Markdown reader using md4c
      */
-    public class MarkdownMd4cReader : Object, Reader {
+    public class MarkdownMd4cReader : Object, Reader, StreamingReader {
         /** Metadata for this class */
-        [Description(blurb = "Read CommonMark Markdown files")]
+        [Description(nick = "default", blurb = "Read CommonMark Markdown files")]
         public bool meta { get; default = false; }
 
         /**
@@ -31,10 +31,7 @@ namespace My
          */
         public Doc read_document(string filename) throws FileError, MarkupError
         {
-            // Read it in
-            string contents;
-            FileUtils.get_contents(filename, out contents);
-            return read_string(contents);
+            return read_bytes(map_file_(filename));
         }
 
         /**
@@ -44,17 +41,75 @@ namespace My
          */
         public Doc read_string(string contents) throws MarkupError
         {
-            make_tree_for(contents);
-            return new Doc((owned)root_);
+            return read_bytes(new Bytes(contents.data));
+        }
+
+        /**
+         * Produce a document for a buffer.
+         *
+         * The document holds a reference to @source.
+         * @param   source      The text to parse.  Need not be nul-terminated.
+         * @return A node tree of the document
+         */
+        public Doc read_bytes(Bytes source) throws MarkupError
+        {
+            make_tree_for(source);
+            var retval = new Doc.from_tree(tree_);
+            tree_ = null;
+            return retval;
+        }
+
+        /**
+         * Read a document, passing each top-level block to @sink.
+         *
+         * Only one top-level block is held in memory at a time.
+         */
+        public void stream_document(string filename, BlockSink sink)
+        throws FileError, MarkupError, My.Error
+        {
+            var contents = map_file_(filename);
+
+            sink_ = sink;
+            sink_error_ = null;
+            try {
+                make_tree_for(contents);
+            } catch(MarkupError e) {
+                if(sink_error_ == null) {
+                    throw e;
+                }
+            } finally {
+                sink_ = null;
+                tree_ = null;
+            }
+
+            // An error from the sink stops the parse.  Report it.
+            if(sink_error_ != null) {
+                My.Error err = sink_error_;
+                sink_error_ = null;
+                throw err;
+            }
         }
 
         // === Internal helpers ============================================
 
-        private delegate string NodeRenderer(GLib.Node<Elem> node);
+        /**
+         * Get the contents of a file, mapped into memory if possible.
+         *
+         * The parser reads straight from the mapping, and the document's
+         * text refers to it, so the file is not copied.  The mapping
+         * lasts as long as the returned Bytes (and thus the document).
+         * See My.load_file().
+         */
+        private static Bytes map_file_(string filename) throws FileError
+        {
+            return load_file(filename);
+        }
+
+        private delegate void NodeRenderer(DocTree tree, int idx, StringBuilder sb);
 
-        private static string render_as_plain_(GLib.Node<Elem> node)
+        private static void render_as_plain_(DocTree tree, int idx, StringBuilder sb)
         {
-            return node.data.text;
+            tree.append_text_to(idx, sb);
         }
 
         /**
@@ -64,87 +119,101 @@ namespace My
          *
          * NOTE: this assumes that special blocks only have spans in them.
          *
-         * @param node      The node to render
-         * @return The resulting markdown source.
+         * @param tree      The tree holding the node
+         * @param idx       The node to render
+         * @param sb        Where to put the resulting markdown source
          */
-        private static string render_as_markdown_(GLib.Node<Elem> node)
+        private static void render_as_markdown_(DocTree tree, int idx, StringBuilder sb)
         {
-            var sb = new StringBuilder();
-            var elem = node.data;
-
-            switch(elem.ty) {
-            case SPAN_PLAIN: sb.append(elem.text); break;
-            case SPAN_EM: sb.append_printf("*%s*", elem.text); break;
-            case SPAN_STRONG: sb.append_printf("**%s**", elem.text); break;
-            case SPAN_CODE: sb.append_printf("`%s`", elem.text); break;
-            case SPAN_STRIKE: sb.append_printf("~%s~", elem.text); break;
-            case SPAN_UNDERLINE: sb.append_printf("_%s_", elem.text); break;
+            var ty = tree.get_ty(idx);
+
+            switch(ty) {
+            case SPAN_PLAIN: tree.append_text_to(idx, sb); break;
+            case SPAN_EM: sb.append_printf("*%s*", tree.get_text(idx)); break;
+            case SPAN_STRONG: sb.append_printf("**%s**", tree.get_text(idx)); break;
+            case SPAN_CODE: sb.append_printf("`%s`", tree.get_text(idx)); break;
+            case SPAN_STRIKE: sb.append_printf("~%s~", tree.get_text(idx)); break;
+            case SPAN_UNDERLINE: sb.append_printf("_%s_", tree.get_text(idx)); break;
             case SPAN_IMAGE:
-                if(elem.info_string != null && elem.info_string != "") {
-                    sb.append_printf("![](%s \"%s\")", elem.text, elem.info_string);
+                var info_string = tree.get_info_string(idx);
+                if(info_string != "") {
+                    sb.append_printf("![](%s \"%s\")", tree.get_text(idx), info_string);
                 } else {
-                    sb.append_printf("![](%s)", elem.text);
+                    sb.append_printf("![](%s)", tree.get_text(idx));
                 }
                 break;
             default:
-                lwarningo(node, "Unknown type %s", elem.ty.to_string());
+                lwarning("Unknown type %s", ty.to_string());
                 break;
             }
-
-            return sb.str;
         }
 
         /**
-         * Render a node's children as text.
+         * Render a node's descendants as text, in preorder.
          */
-        private static string render_kids_as_(GLib.Node<Elem> node, NodeRenderer renderer)
+        private static string render_kids_as_(DocTree tree, int idx, NodeRenderer renderer)
         {
             var sb = new StringBuilder();
-            ltraceo(node, "%s", node.data.ty.to_string());
-            node.children_foreach(ALL, (kid)=> {
-                sb.append(render_node_(kid, renderer));
+            if(lenabled(TRACE)) {
+                ltrace("%s", tree.get_ty(idx).to_string());
+            }
+            tree.foreach_preorder(idx, (t, kid, depth)=>{
+                if(kid != idx) {
+                    renderer(t, kid, sb);
+                }
+                return false;
             });
             return sb.str;
         }
 
-        private static string render_node_(GLib.Node<Elem> node, NodeRenderer renderer)
-        {
-            ltraceo(node, "%s: ---%s---", node.data.ty.to_string(), node.data.text);
-
-            return renderer(node) + render_kids_as_(node, renderer);
-        }
-
         // === Parser callbacks and data ===================================
 
+        /** The current nesting level, for logging */
+        private int depth_ = 0;
+
         /**
-         * Indentation based on depth_.
+         * Indentation based on depth_, for logging.
          *
-         * A string with four spaces per depth_.  Updated by the setter
-         * for depth_.
+         * A string with four spaces per depth_.  Computed on each use, so
+         * only use it when logging is enabled.
          */
-        private string indent_ = "";
+        private string indent_ {
+            owned get { return string.nfill(depth_*4, ' '); }
+        }
 
-        /** Storage of the current indentation level */
-        private int depth_value_ = 0;
+        /** The tree we are building */
+        private DocTree tree_;
 
-        /** Helper for tree_for() since I don't have a closure at present */
-        private int depth_ {
-            get { return depth_value_; }
-            set {
-                depth_value_ = value;
-                indent_ = string.nfill(depth_*4, ' ');
-            }
-        }
+        /** The current node in tree_ */
+        private int node_;
+
+        /** If non-null, where to send each top-level block */
+        private BlockSink sink_ = null;
 
-        /** The root of the tree we are building */
-        private GLib.Node<Elem> root_;
+        /** An error thrown by sink_, if any */
+        private My.Error? sink_error_ = null;
 
-        /** The current node */
-        private unowned GLib.Node<Elem> node_;
+        /** The position in tree_ to rewind to after sending a block to sink_ */
+        private DocTree.Position stream_start_;
 
         /** Tag for special blocks */
         private static string SBTAG = "pfft:";
 
+        /** The parser, for re-entering it on special blocks */
+        private Md4c.Parser parser_ = null;
+
+        /** The text being parsed */
+        private char *source_start_ = null;
+        private size_t source_length_ = 0;  ///< ditto
+
+        /**
+         * The node that the document being parsed goes into.
+         *
+         * 0 (the root) except while parsing the contents of a special block,
+         * when it is the special block.
+         */
+        private int doc_node_ = 0;
+
         /**
          * md4c callback for entering blocks.
          *
@@ -152,42 +221,45 @@ namespace My
          */
         private static int enter_block_(BlockType block_type, void *detail, void *userdata)
         {
-            GLib.Node<Elem> newnode = null;
-
             var self = (MarkdownMd4cReader)userdata;
-            llog("%sGot block %s",
-                self.indent_, block_type.to_string());
+            unowned DocTree tree = self.tree_;
+            int newnode = DocTree.NONE;
+
+            if(lenabled(LOG)) {
+                llog("%sGot block %s",
+                    self.indent_, block_type.to_string());
+            }
             ++self.depth_;
 
             switch(block_type) {
             case DOC:
-                self.node_ = self.root_;
+                self.node_ = self.doc_node_;    // usually the root
                 break;
 
             case QUOTE:
-                newnode = node_of_ty(BLOCK_QUOTE);
+                newnode = tree.append_child(self.node_, BLOCK_QUOTE);
                 break;
 
             case UL:
-                newnode = node_of_ty(BLOCK_BULLET_LIST);
+                newnode = tree.append_child(self.node_, BLOCK_BULLET_LIST);
                 break;
 
             case OL:
-                newnode = node_of_ty(BLOCK_NUMBER_LIST);
+                newnode = tree.append_child(self.node_, BLOCK_NUMBER_LIST);
                 break;
 
             case LI:
-                newnode = node_of_ty(BLOCK_LIST_ITEM);
+                newnode = tree.append_child(self.node_, BLOCK_LIST_ITEM);
                 break;
 
             case HR:
-                newnode = node_of_ty(BLOCK_HR);
+                newnode = tree.append_child(self.node_, BLOCK_HR);
                 break;
 
             case H:
                 var det = (BlockHDetail*)detail;
-                newnode = node_of_ty(BLOCK_HEADER);
-                newnode.data.header_level = det.level;
+                newnode = tree.append_child(self.node_, BLOCK_HEADER);
+                tree.set_header_level(newnode, det.level);
                 break;
 
             case CODE:
@@ -196,7 +268,7 @@ namespace My
 
                 // Check for a special block
                 if(infostr.has_prefix(SBTAG)) {
-                    newnode = node_of_ty(BLOCK_SPECIAL);
+                    newnode = tree.append_child(self.node_, BLOCK_SPECIAL);
 
                     var command = substr(infostr, SBTAG.length);
                     if(command == null) {
@@ -206,37 +278,38 @@ namespace My
                     }
 
                     if(command == "") {
-                        lwarningo(newnode, "Special block with no command after '%s'", SBTAG);
+                        lwarningo(self, "Special block with no command after '%s'", SBTAG);
                     }
 
-                    newnode.data.info_string = command;
+                    tree.set_info_string(newnode, command);
 
                 } else {    // normal code block
-                    newnode = node_of_ty(BLOCK_CODE);
-                    newnode.data.info_string = infostr;
+                    newnode = tree.append_child(self.node_, BLOCK_CODE);
+                    tree.set_info_string(newnode, infostr);
+                }
+                if(lenabled(LOG)) {
+                    llogo(self, "%s, info string -%s-", tree.get_ty(newnode).to_string(),
+                        tree.get_info_string(newnode));
                 }
-                llogo(newnode, "%s, info string -%s-", newnode.data.ty.to_string(),
-                    newnode.data.info_string);
                 break;
 
             case P:
-                newnode = node_of_ty(BLOCK_COPY);
+                newnode = tree.append_child(self.node_, BLOCK_COPY);
                 break;
 
             case HTML:
-                newnode = node_of_ty(BLOCK_SPECIAL);
-                newnode.data.info_string = INFOSTR_HTML;
+                newnode = tree.append_child(self.node_, BLOCK_SPECIAL);
+                tree.set_info_string(newnode, INFOSTR_HTML);
                 break;
 
             default:
                 printerr("I don't yet know how to process block type %s\n".printf(block_type.to_string()));
-                newnode = node_of_ty(BLOCK_COPY);
+                newnode = tree.append_child(self.node_, BLOCK_COPY);
                 break;
             }
 
-            if(newnode != null) {
-                self.node_.append((owned)newnode);  // clears newnode
-                self.node_ = self.node_.last_child();
+            if(newnode != DocTree.NONE) {
+                self.node_ = newnode;
             }
 
             return 0;
@@ -246,22 +319,31 @@ namespace My
         private static int leave_block_(BlockType block_type, void *detail, void *userdata)
         {
             var self = (MarkdownMd4cReader)userdata;
+            unowned DocTree tree = self.tree_;
             --self.depth_;
-            llog("%sLeaving block %s",
-                self.indent_, block_type.to_string());
+            if(lenabled(LOG)) {
+                llog("%sLeaving block %s",
+                    self.indent_, block_type.to_string());
+            }
+
+            // The end of a special block's contents.  parse_special_()
+            // takes it from here.
+            if(block_type == DOC && self.doc_node_ != 0) {
+                return 0;
+            }
 
             // Pop out of the last span, if we're in one
-            if(self.node_.data.is_span) {
-                self.node_ = self.node_.parent;
+            if(tree.is_span(self.node_)) {
+                self.node_ = tree.parent(self.node_);
             }
 
             // Postprocess special blocks
-            if(self.node_.data.ty == BLOCK_SPECIAL &&
-                self.node_.data.info_string == INFOSTR_HTML) {
+            if(tree.get_ty(self.node_) == BLOCK_SPECIAL &&
+                tree.get_info_string(self.node_) == INFOSTR_HTML) {
 
                 // For now, drop HTML.
 
-                string inner_contents = render_kids_as_(self.node_, render_as_plain_);
+                string inner_contents = render_kids_as_(tree, self.node_, render_as_plain_);
                 inner_contents._strip();
 
                 // If the text isn't a single HTML comment, warn that we're
@@ -274,99 +356,220 @@ namespace My
                     inner_contents.index_of("-->") != inner_contents.length - 3
                 ) {
 
-                    lwarningo(self.node_, "Ignoring HTML block:\n%s\n",
-                        self.node_.data.as_string());
-                    lmemdumpo(self.node_, "Block contents", inner_contents,
+                    lwarningo(self, "Ignoring HTML block:\n%s\n",
+                        tree.make_elem(self.node_).as_string());
+                    lmemdumpo(self, "Block contents", inner_contents,
                         inner_contents.length);
                 }
 
-                self.node_.data.info_string = INFOSTR_NOP;
-                self.node_.children_foreach(ALL, (kid)=>{ kid.unlink(); });
-
-            } else if(self.node_.data.ty == BLOCK_SPECIAL) {
-                do { // once
-                    // Render the block's contents back to Markdown.
-                    // This is easy because special blocks are code blocks,
-                    // which contain only text.
-                    string inner_contents = render_kids_as_(self.node_, render_as_markdown_);
-                    ltraceo(self.node_, "inner_contents: ---%s---", inner_contents);
-
-                    // Parse the Markdown
-                    var inner_reader = new MarkdownMd4cReader();
-                    // TODO copy reader options from this to inner_reader
-
-                    Doc inner_doc = null;
-                    try {
-                        inner_doc = inner_reader.read_string(inner_contents);
-                    } catch(MarkupError e) {
-                        lwarningo(self.node_,
-                            "Could not parse special block's contents as Markdown: %s",
-                            e.message);
-                        break;
-                    }
-                    ltraceo(self.node_,"Got inner doc:\n%s\n", inner_doc.as_string());
-
-                    // Replace the special block's children with the results
-                    // of parsing the inner text
-                    self.node_.children_foreach(ALL, (kid)=>{ kid.unlink(); });
-                    inner_doc.root.children_foreach(ALL, (kid)=>{
-                        unowned var kidnode = (GLib.Node<Elem>)kid;
-                        ltraceo(kidnode, "Existing node of type %s ---%s---",
-                        kidnode.data.ty.to_string(), kidnode.data.text);
-
-                        GLib.Node<Elem> newnode = kidnode.copy_deep((e)=>{
-                            return e.clone();
-                        });
-                        ltraceo(newnode, "New node of type %s ---%s---",
-                        newnode.data.ty.to_string(), newnode.data.text);
-
-                        self.node_.append((owned)newnode);
-                    });
-                } while(false);
+                tree.set_info_string(self.node_, INFOSTR_NOP);
+                tree.remove_children(self.node_);
+
+            } else if(tree.get_ty(self.node_) == BLOCK_SPECIAL) {
+                self.parse_special_(self.node_);
             }
 
             // Leave the current block
-            self.node_ = self.node_.parent;
+            var left = self.node_;
+            self.node_ = tree.parent(self.node_);
+
+            // Hand off completed top-level blocks
+            if(self.sink_ != null && self.node_ == 0) {
+                Stats.count("nodes", tree.size - self.stream_start_.nnodes);
+                try {
+                    self.sink_.add_block(tree, left);
+                } catch(My.Error e) {
+                    self.sink_error_ = e;
+                    return 1;   // abort the parse
+                }
+                tree.rewind(self.stream_start_);
+            }
 
             return 0;
         }
 
+        /**
+         * Parse the contents of special block @idx as Markdown.
+         *
+         * The results replace the block's children.  If the contents are
+         * a contiguous range of the source, the parser is re-entered on that
+         * range, so the new nodes go straight into tree_ and their text
+         * refers to the source.  Otherwise, e.g., if the block was indented
+         * and md4c removed the indentation, the contents are copied and
+         * parsed separately.
+         */
+        private void parse_special_(int idx)
+        {
+            unowned DocTree tree = tree_;
+            char *start;
+            size_t length;
+
+            if(!get_source_range_(idx, out start, out length)) {
+                Stats.count("special.copied");
+                parse_special_copy_(idx);
+                return;
+            }
+
+            Stats.count("special.in_place");
+            if(lenabled(TRACE)) {
+                ltraceo(this, "special block contents: ---%s---", strndup(start, length));
+            }
+
+            tree.remove_children(idx);
+            if(length == 0) {
+                return;
+            }
+
+            var saved_doc_node = doc_node_;
+            doc_node_ = idx;
+            var ok = Md4c.parse((Char?)start, (Size)length, parser_, this);
+            doc_node_ = saved_doc_node;
+            node_ = idx;
+
+            if(ok != 0) {   // LCOV_EXCL_START - only if md4c runs out of memory
+                lwarningo(this,
+                    "Could not parse special block's contents as Markdown (%d)", ok);
+                tree.remove_children(idx);
+            }               // LCOV_EXCL_STOP
+        } // parse_special_()
+
+        /**
+         * Find the source text of the contents of code block @idx.
+         *
+         * md4c gives code blocks to text_() a line at a time.  The lines
+         * point into the source, but the line breaks are static strings.
+         * The contents are contiguous if each line starts where the previous
+         * line's line break ended.
+         *
+         * @param start     The first byte of the contents
+         * @param length    The length of the contents, in bytes
+         * @return true if the contents are a contiguous range of the source
+         */
+        private bool get_source_range_(int idx, out char *start, out size_t length)
+        {
+            unowned DocTree tree = tree_;
+            start = null;
+            length = 0;
+            char *pos = null;   // where the next chunk should start
+            char *end = source_start_ + source_length_;
+
+            for(int kid = tree.first_child(idx); kid != DocTree.NONE;
+                kid = tree.next_sibling(kid)) {
+                if(tree.get_ty(kid) != SPAN_PLAIN ||
+                    tree.first_child(kid) != DocTree.NONE) {
+                    return false;   // LCOV_EXCL_LINE - code blocks hold only text
+                }
+
+                size_t len;
+                char *ptr = tree.text_data(kid, out len);
+                bool in_source = (ptr >= source_start_ && ptr + len <= end);
+
+                if(pos == null) {   // first chunk
+                    if(!in_source) {
+                        return false;
+                    }
+                    start = ptr;
+                    pos = ptr;
+                }
+
+                if(in_source && ptr == pos) {
+                    pos += len;
+                } else if(len == 1 && ptr[0] == '\n' && pos < end &&
+                    (pos[0] == '\n' || pos[0] == '\r')) {
+                    // A line break.  md4c treats CRLF as one.
+                    if(pos[0] == '\r' && pos + 1 < end && pos[1] == '\n') {
+                        ++pos;
+                    }
+                    ++pos;
+                } else {
+                    return false;
+                }
+            }
+
+            if(pos != null) {
+                length = (size_t)(pos - start);
+            }
+            return true;
+        } // get_source_range_()
+
+        /**
+         * Parse the contents of special block @idx from a copy.
+         *
+         * This is the fallback for parse_special_().
+         */
+        private void parse_special_copy_(int idx)
+        {
+            unowned DocTree tree = tree_;
+
+            // Render the block's contents back to Markdown.
+            // This is easy because special blocks are code blocks,
+            // which contain only text.
+            string inner_contents = render_kids_as_(tree, idx, render_as_markdown_);
+            ltraceo(this, "inner_contents: ---%s---", inner_contents);
+
+            // Parse the Markdown
+            var inner_reader = new MarkdownMd4cReader();
+            // TODO copy reader options from this to inner_reader
+
+            Doc inner_doc = null;
+            try {
+                inner_doc = inner_reader.read_string(inner_contents);
+            } catch(MarkupError e) {
+                lwarningo(this,
+                    "Could not parse special block's contents as Markdown: %s",
+                    e.message);
+                return;
+            }
+            if(lenabled(TRACE)) {
+                ltraceo(this,"Got inner doc:\n%s\n", inner_doc.as_string());
+            }
+
+            // Replace the special block's children with the results
+            // of parsing the inner text
+            tree.remove_children(idx);
+            tree.copy_children_from(idx, inner_doc.get_tree(), 0);
+        } // parse_special_copy_()
+
         /** md4c callback */
         private static int enter_span_(SpanType span_type, void *detail, void *userdata)
         {
-            GLib.Node<Elem> newnode = null;
-
             var self = (MarkdownMd4cReader)userdata;
-            llog("%sGot span %s ... ",
-                self.indent_, span_type.to_string());
+            unowned DocTree tree = self.tree_;
+            int newnode = DocTree.NONE;
+
+            if(lenabled(LOG)) {
+                llog("%sGot span %s ... ",
+                    self.indent_, span_type.to_string());
+            }
 
             switch(span_type) {
-            case EM: newnode = node_of_ty(SPAN_EM); break;
-            case STRONG: newnode = node_of_ty(SPAN_STRONG); break;
+            case EM: newnode = tree.append_child(self.node_, SPAN_EM); break;
+            case STRONG: newnode = tree.append_child(self.node_, SPAN_STRONG); break;
             case A:
                 printerr("Hyperlinks are not yet supported\n");
-                newnode = node_of_ty(SPAN_PLAIN);
+                newnode = tree.append_child(self.node_, SPAN_PLAIN);
                 break;
             case IMG:
-                newnode = node_of_ty(SPAN_IMAGE);
+                newnode = tree.append_child(self.node_, SPAN_IMAGE);
                 string href, title;
                 get_img_detail(detail, out href, out title);
-                newnode.data.href = href;
-                newnode.data.info_string = title;
-                llog("%sImage href=`%s', title=`%s'", self.indent_, href, title);
+                tree.set_href(newnode, href);
+                tree.set_info_string(newnode, title);
+                if(lenabled(LOG)) {
+                    llog("%sImage href=`%s', title=`%s'", self.indent_, href, title);
+                }
                 break;
-            case CODE: newnode = node_of_ty(SPAN_CODE); break;
-            case DEL: newnode = node_of_ty(SPAN_STRIKE); break;
-            case SpanType.U: newnode = node_of_ty(SPAN_UNDERLINE); break;
+            case CODE: newnode = tree.append_child(self.node_, SPAN_CODE); break;
+            case DEL: newnode = tree.append_child(self.node_, SPAN_STRIKE); break;
+            case SpanType.U: newnode = tree.append_child(self.node_, SPAN_UNDERLINE); break;
             default:
                 printerr("Unsupported span type %s\n".printf(span_type.to_string()));
-                newnode = node_of_ty(SPAN_PLAIN);
+                newnode = tree.append_child(self.node_, SPAN_PLAIN);
                 break;
             }
 
-            if(newnode != null) {
-                self.node_.append((owned)newnode);  // clears newnode
-                self.node_ = (GLib.Node<Elem>)self.node_.last_child();
+            if(newnode != DocTree.NONE) {
+                self.node_ = newnode;
             }
             return 0;
         }
@@ -375,10 +578,12 @@ namespace My
         private static int leave_span_(SpanType span_type, void *detail, void *userdata)
         {
             var self = (MarkdownMd4cReader)userdata;
-            llog("%sleft span %s", self.indent_, span_type.to_string());
+            if(lenabled(LOG)) {
+                llog("%sleft span %s", self.indent_, span_type.to_string());
+            }
 
             // Move back into the parent span
-            self.node_ = self.node_.parent;
+            self.node_ = self.tree_.parent(self.node_);
 
             return 0;
         }
@@ -389,16 +594,18 @@ namespace My
          * Every text chunk gets its own Elem.Type.SPAN_PLAIN.  This is so
          * that text after a child span will not be merged with text
          * before the child span.
+         *
+         * Text within the source is not copied --- the node refers to it.
          */
         private static int text_(TextType text_type, /*const*/ Char? text, Size size, void *userdata)
         {
             var self = (MarkdownMd4cReader)userdata;
-            var data = strndup((char *)text, size);
-            llog("%s<<%s>>", self.indent_, data);
+            if(lenabled(LOG)) {
+                llog("%s<<%s>>", self.indent_, strndup((char *)text, size));
+            }
 
-            var newnode = node_of_ty(SPAN_PLAIN);
-            newnode.data.text = data;
-            self.node_.append((owned)newnode);  // clears newnode
+            var newnode = self.tree_.append_child(self.node_, SPAN_PLAIN);
+            self.tree_.set_text_from(newnode, (char *)text, size);
 
             return 0;
         }
@@ -406,33 +613,47 @@ namespace My
         // === Parser invoker ==============================================
 
         /**
-         * Read a file and build a node tree for it.
+         * Build a node tree for a buffer.
          *
-         * Fills in root_.
+         * Fills in tree_.
          */
-        private void make_tree_for(string contents) throws MarkupError
+        private void make_tree_for(Bytes source) throws MarkupError
         {
             // Set up the parse
 
-            root_ = node_of_ty(Elem.Type.ROOT);
+            tree_ = new DocTree(source);
+            node_ = 0;
             depth_ = 0;
+            stream_start_ = tree_.tell();
 
             // Processing functions.  NOTE: no closure in the current binding.
 
-            Md4c.Parser parser = new Parser();
-            parser.flags = Dialect.GitHub | UNDERLINE;
-            parser.enter_block = enter_block_;
-            parser.leave_block = leave_block_;
-            parser.enter_span = enter_span_;
-            parser.leave_span = leave_span_;
-            parser.text = text_;
-            parser.debug_log = null;
+            parser_ = new Parser();
+            parser_.flags = Dialect.GitHub | UNDERLINE;
+            parser_.enter_block = enter_block_;
+            parser_.leave_block = leave_block_;
+            parser_.enter_span = enter_span_;
+            parser_.leave_span = leave_span_;
+            parser_.text = text_;
+            parser_.debug_log = null;
 
             // Parse it
-            var ok = Md4c.parse((Char?)contents, contents.length, parser, this);
+            // Not necessarily nul-terminated, but md4c only reads get_size() bytes
+            unowned string contents = (string)source.get_data();
+            source_start_ = (char *)contents;
+            source_length_ = source.get_size();
+            doc_node_ = 0;
+            var t = Stats.start();
+            var ok = Md4c.parse((Char?)contents, (Size)source_length_,
+                    parser_, this);
+            Stats.stop("read", t);  // includes the writer's time if streaming
+            parser_ = null;
             if(ok != 0) {
                 throw new MarkupError.PARSE("parse failed (%d)".printf(ok));
             }
+            if(sink_ == null) {
+                Stats.count("nodes", tree_.size);
+            }
         }
     }
 } // My
@@ -10,4 +10,6 @@
 
 REGISTRAR_BEGIN(readers) {
     REGISTER("markdown", MY_TYPE_MARKDOWN_MD4C_READER);
+    REGISTER("doctree", MY_TYPE_DOC_TREE_READER);
+    REGISTER("text", MY_TYPE_PLAIN_TEXT_READER);
 } REGISTRAR_END
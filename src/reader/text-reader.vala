@@ -0,0 +1,199 @@
+// src/reader/text-reader.vala
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+using My.Log;
+
+namespace My
+{
+    [CCode (cname = "memchr", cheader_filename = "string.h")]
+    private extern char *text_memchr(char *s, int c, size_t n);
+
+    /**
+     * Reader for plain text, e.g., logs or text exports.
+     *
+     * Blank lines separate paragraphs.  Each paragraph becomes a block
+     * whose lines are joined, or, if `monospace` is set, a code block that
+     * keeps its line breaks.  A block also ends after `blocklines` lines,
+     * so no block is unreasonably large.
+     *
+     * The file is read a chunk at a time.  When streaming, each block is
+     * passed to the writer as soon as it is complete, so memory use
+     * depends on the block size rather than on the size of the file.
+     */
+    public class PlainTextReader : Object, Reader, StreamingReader {
+        /** Metadata for this class */
+        [Description(blurb = "Read plain text, a chunk at a time")]
+        public bool meta { get; default = false; }
+
+        [Description(nick = "Monospace", blurb = "If true, keep line breaks and use a monospace font.  If false, join the lines of each paragraph.")]
+        public bool monospace { get; set; default = false; }
+
+        [Description(nick = "Lines per block", blurb = "Start a new block after this many lines, even within a paragraph (0 = no limit)")]
+        public uint blocklines { get; set; default = 1000; }
+
+        /** How many bytes to read at once */
+        private const size_t CHUNK_SIZE = 64*1024;
+
+        /**
+         * Read a document.
+         * @param   filename    The file to read
+         * @return A node tree of the document
+         */
+        public Doc read_document(string filename) throws FileError, MarkupError
+        {
+            tree_ = new DocTree();
+            try {
+                read_blocks(filename);
+            } catch(My.Error e) {   // LCOV_EXCL_START - only sinks throw these
+                throw new MarkupError.INVALID_CONTENT(e.message);
+            }                       // LCOV_EXCL_STOP
+            var retval = new Doc.from_tree(tree_);
+            tree_ = null;
+            return retval;
+        }
+
+        /**
+         * Read a document, passing each block to @sink.
+         *
+         * Only one block is held in memory at a time.
+         */
+        public void stream_document(string filename, BlockSink sink)
+        throws FileError, MarkupError, My.Error
+        {
+            tree_ = new DocTree();
+            sink_ = sink;
+            try {
+                read_blocks(filename);
+            } finally {
+                sink_ = null;
+                tree_ = null;
+            }
+        }
+
+        // === Internals ===================================================
+
+        /** The tree we are building */
+        private DocTree tree_ = null;
+
+        /** If non-null, where to send each block */
+        private BlockSink sink_ = null;
+
+        /** The text of the block in progress */
+        private StringBuilder block_ = new StringBuilder();
+
+        /** How many lines are in block_ */
+        private uint nlines_ = 0;
+
+        /** Read @filename into tree_, or to sink_ if set */
+        private void read_blocks(string filename) throws FileError, My.Error
+        {
+            var fh = FileStream.open(filename, "rb");
+            if(fh == null) {
+                throw new FileError.FAILED("Could not open %s: %s".printf(
+                        filename, strerror(errno)));
+            }
+
+            var t = Stats.start();
+            block_.truncate(0);
+            nlines_ = 0;
+
+            // A line split across chunks is collected here
+            var partial = new StringBuilder();
+            var buf = new uint8[CHUNK_SIZE];
+            size_t nread;
+            while((nread = fh.read(buf)) > 0) {
+                char *start = (char *)buf;
+                char *end = start + nread;
+                while(start < end) {
+                    char *nl = text_memchr(start, '\n', (size_t)(end - start));
+                    if(nl == null) {
+                        partial.append_len((string)start, (ssize_t)(end - start));
+                        break;
+                    }
+
+                    if(partial.len > 0) {
+                        partial.append_len((string)start, (ssize_t)(nl - start));
+                        add_line((char *)partial.str, partial.len);
+                        partial.truncate(0);
+                    } else {
+                        add_line(start, (size_t)(nl - start));
+                    }
+                    start = nl + 1;
+                }
+            }
+
+            if(fh.error() != 0) {
+                throw new FileError.IO("Could not read %s".printf(filename));
+            }
+            if(partial.len > 0) {   // last line had no newline
+                add_line((char *)partial.str, partial.len);
+            }
+            end_block();
+
+            Stats.stop("read", t);  // includes the writer's time if streaming
+            if(sink_ == null) {
+                Stats.count("nodes", tree_.size);
+            }
+        } // read_blocks()
+
+        /** Add one line, without its newline, to the current block */
+        private void add_line(char *line, size_t len) throws My.Error
+        {
+            if(len > 0 && line[len-1] == '\r') {
+                --len;
+            }
+
+            bool blank = true;
+            for(size_t i = 0; i < len; ++i) {
+                if(!line[i].isspace()) {
+                    blank = false;
+                    break;
+                }
+            }
+            if(blank) {
+                end_block();
+                return;
+            }
+
+            if(nlines_ > 0) {
+                block_.append_c('\n');
+            }
+            block_.append_len((string)line, (ssize_t)len);
+            ++nlines_;
+            if(blocklines > 0 && nlines_ >= blocklines) {
+                end_block();
+            }
+        } // add_line()
+
+        /** Add the block in progress, if any, to the tree */
+        private void end_block() throws My.Error
+        {
+            if(nlines_ == 0) {
+                return;
+            }
+
+            var pos = tree_.tell();
+            var blk = tree_.append_child(0, monospace ? Elem.Type.BLOCK_CODE :
+                    Elem.Type.BLOCK_COPY);
+            var kid = tree_.append_child(blk, SPAN_PLAIN);
+
+            // Logs are not always valid UTF-8
+            unowned string text = block_.str;
+            if(text.validate((ssize_t)block_.len)) {
+                tree_.set_text_from(kid, (char *)text, block_.len);
+            } else {
+                tree_.set_text(kid, text.make_valid((ssize_t)block_.len));
+            }
+
+            block_.truncate(0);
+            nlines_ = 0;
+
+            if(sink_ != null) {
+                Stats.count("nodes", 2);
+                sink_.add_block(tree_, blk);
+                tree_.rewind(pos);
+            }
+        } // end_block()
+    } // class PlainTextReader
+} // My
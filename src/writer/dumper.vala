@@ -9,11 +9,27 @@ namespace My {
         [Description(blurb = "Dump pfft's internal representation of the document (for debugging)")]
         public bool meta { get; default = false; }
 
+        [Description(nick = "Output format", blurb = "text (human-readable), or binary (for the doctree reader)")]
+        public string format { get; set; default = "text"; }
+
         public void write_document(string filename, Doc doc,
             string? source_fn = null)
         throws FileError, My.Error
         {
-            emit(filename, doc.as_string());
+            switch(format) {
+            case "text":
+                emit(filename, doc.as_string());
+                break;
+            case "binary":
+                var tree = doc.get_tree();
+                if(tree == null) {
+                    throw new Error.WRITER("Cannot save an empty document");
+                }
+                emit_data(filename, tree.serialize());
+                break;
+            default:
+                throw new Error.WRITER("Unknown dumper format '%s'".printf(format));
+            }
         }
     }
 }
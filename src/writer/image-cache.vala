@@ -0,0 +1,328 @@
+// writer/image-cache.vala
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+using My.Log;
+
+namespace My.Shape {
+
+    /**
+     * A reference to an image file, shared by all users of that file.
+     *
+     * The image's size is known without decoding it.  The decoded pixels
+     * are loaded on first use and may be dropped by ImageCache.trim(),
+     * in which case they are reloaded if needed again.
+     */
+    public class ImageRef : Object {
+        /** The absolute path to the image */
+        public string path { get; construct; }
+
+        /** Image width, in pixels */
+        public int width { get; private set; default = 0; }
+
+        /** Image height, in pixels */
+        public int height { get; private set; default = 0; }
+
+        /** The decoded image, or null if not loaded.  Guarded by the cache. */
+        internal Cairo.ImageSurface surface = null;
+
+        /** Bytes used by surface */
+        internal size_t surface_bytes = 0;
+
+        /** Larger is more recently used.  Guarded by the cache. */
+        internal uint64 last_used = 0;
+
+        /**
+         * True if the cache has a newer version of this image.
+         * Guarded by the cache.
+         */
+        internal bool stale = false;
+
+        /** The cache this belongs to, or null if not cached */
+        internal weak ImageCache? cache = null;
+
+        internal ImageRef(string path)
+        {
+            Object(path: path);
+        }
+
+        /** Wrap an existing surface.  Not cached. */
+        public ImageRef.for_surface(Cairo.ImageSurface surface)
+        {
+            Object(path: "");
+            set_surface(surface);
+        }
+
+        /** Take size information from a decoded surface */
+        internal void set_surface(Cairo.ImageSurface surface)
+        {
+            this.surface = surface;
+            surface_bytes = (size_t)surface.get_stride() * surface.get_height();
+            width = surface.get_width();
+            height = surface.get_height();
+        }
+
+        /**
+         * Read the size from the PNG header without decoding the image.
+         * @return true on success
+         */
+        internal bool read_png_size()
+        {
+            var fh = FileStream.open(path, "rb");
+            if(fh == null) {
+                return false;
+            }
+
+            // Signature (8 bytes), then the IHDR chunk: length (4 bytes),
+            // type (4 bytes), width (4 bytes, big-endian), height (ditto).
+            uint8 buf[24];
+            if(fh.read(buf) != buf.length) {
+                return false;
+            }
+            uint8 sig[8] = { 0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a };
+            if(Memory.cmp(buf, sig, 8) != 0 || Memory.cmp(&buf[12], "IHDR", 4) != 0) {
+                return false;
+            }
+
+            width = (int)(((uint32)buf[16] << 24) | ((uint32)buf[17] << 16) |
+                ((uint32)buf[18] << 8) | buf[19]);
+            height = (int)(((uint32)buf[20] << 24) | ((uint32)buf[21] << 16) |
+                ((uint32)buf[22] << 8) | buf[23]);
+            return true;
+        }
+
+        /**
+         * Paint the image with its top-left corner at (@leftC, @topC).
+         *
+         * Decodes the image if necessary.   Replaces the source of @cr.
+         */
+        public void paint(Cairo.Context cr, double leftC, double topC)
+        {
+            // Our reference keeps the surface alive even if the cache
+            // drops it while we are painting.
+            var img = (cache == null) ? surface : cache.get_surface(this);
+            if(img == null) {
+                return;     // LCOV_EXCL_LINE - can't happen
+            }
+            cr.set_source_surface(img, leftC, topC);
+            cr.rectangle(leftC, topC, width, height);
+            cr.fill();
+        }
+    } // class ImageRef
+
+    /**
+     * Process-wide cache of images.
+     *
+     * Each image file is loaded once no matter how many times it is
+     * referenced, including by different documents or different threads.
+     * Entries are keyed by path and modification time, so an edited image
+     * is reloaded.
+     *
+     * If lazy is set, only the PNG header is read when an image is looked
+     * up, so layout can proceed without decoding.  The pixels are decoded
+     * when the image is first painted.  trim() drops decoded images that
+     * are over the memory budget, least-recently-used first.  The writer
+     * calls trim() after each page is emitted.
+     *
+     * All methods are thread-safe.
+     */
+    public class ImageCache : Object {
+
+        /** If true, do not decode an image until it is painted */
+        public bool lazy { get; set; default = true; }
+
+        /** How many bytes of decoded images to keep after trim() */
+        public size_t budget_bytes { get; set; default = 128*1024*1024; }
+
+        /** How many lookups found an existing entry */
+        public uint hits { get { return AtomicUint.get(ref hits_); } }
+        private uint hits_ = 0;
+
+        /** How many images have been decoded */
+        public uint decodes { get { return AtomicUint.get(ref decodes_); } }
+        private uint decodes_ = 0;
+
+        /** Bytes of decoded images currently held */
+        public size_t decoded_bytes {
+            get {
+                mutex_.lock();
+                var retval = decoded_bytes_;
+                mutex_.unlock();
+                return retval;
+            }
+        }
+        private size_t decoded_bytes_ = 0;
+
+        private Mutex mutex_ = Mutex();
+
+        /** Entries, keyed by path and mtime */
+        private HashTable<string, ImageRef> entries_ =
+            new HashTable<string, ImageRef>(str_hash, str_equal);
+
+        /** The key in entries_ of the latest version of each path */
+        private HashTable<string, string> latest_ =
+            new HashTable<string, string>(str_hash, str_equal);
+
+        /** Use counter for LRU */
+        private uint64 clock_ = 0;
+
+        private static ImageCache default_instance_ = null;
+
+        /** Guards default_instance_.  Statically allocated, so needs no init. */
+        private static Mutex default_mutex_;
+
+        /** Get the process-wide cache */
+        public static ImageCache get_default()
+        {
+            default_mutex_.lock();
+            if(default_instance_ == null) {
+                default_instance_ = new ImageCache();
+            }
+            var retval = default_instance_;
+            default_mutex_.unlock();
+            return retval;
+        }
+
+        /**
+         * Get the image at @path.
+         *
+         * @param path  An absolute path to a PNG file
+         */
+        public ImageRef lookup(string path)
+        {
+            int64 mtime = 0;
+            try {
+                var info = File.new_for_path(path).query_info(
+                    FileAttribute.TIME_MODIFIED, FileQueryInfoFlags.NONE);
+                mtime = (int64)info.get_attribute_uint64(FileAttribute.TIME_MODIFIED);
+            } catch(GLib.Error e) {
+                // Leave mtime = 0.  Cairo will report the error when decoding.
+            }
+            var key = "%s\x1f%lld".printf(path, mtime);
+
+            mutex_.lock();
+            var retval = entries_.lookup(key);
+            if(retval != null) {
+                AtomicUint.inc(ref hits_);
+                retval.last_used = ++clock_;
+                mutex_.unlock();
+                return retval;
+            }
+
+            // Forget the previous version, if any
+            var old_key = latest_.lookup(path);
+            if(old_key != null) {
+                forget_locked(old_key);
+            }
+
+            retval = new ImageRef(path);
+            retval.cache = this;
+            retval.last_used = ++clock_;
+            if(!lazy || !retval.read_png_size()) {
+                decode_locked(retval);
+            }
+            entries_.insert(key, retval);
+            latest_.insert(path, key);
+            mutex_.unlock();
+
+            llogo(this, "New image %s: %d x %d", path, retval.width, retval.height);
+            return retval;
+        } // lookup()
+
+        /**
+         * Get the decoded image for @img, decoding it if necessary.
+         *
+         * The lock is only held while getting the surface, not while the
+         * caller paints it, so threads can paint images at the same time.
+         * Cairo holds its own reference to a source surface.
+         */
+        internal Cairo.ImageSurface get_surface(ImageRef img)
+        {
+            mutex_.lock();
+            Cairo.ImageSurface retval;
+            if(img.stale) {
+                // Not in the cache any more, so don't keep the pixels.
+                // Stale images are only painted by documents laid out
+                // before the image changed.
+                retval = img.surface ??
+                    new Cairo.ImageSurface.from_png(img.path);
+            } else {
+                if(img.surface == null) {
+                    decode_locked(img);
+                }
+                img.last_used = ++clock_;
+                retval = img.surface;
+            }
+            mutex_.unlock();
+            return retval;
+        }
+
+        /** Remove entry @key.  Call with the mutex held. */
+        private void forget_locked(string key)
+        {
+            var img = entries_.lookup(key);
+            if(img == null) {
+                return;     // LCOV_EXCL_LINE - can't happen
+            }
+            ldebugo(this, "Forgetting old version of %s", img.path);
+            decoded_bytes_ -= img.surface_bytes;
+            img.surface = null;
+            img.surface_bytes = 0;
+            img.stale = true;
+            entries_.remove(key);
+        }
+
+        /** Decode @img.  Call with the mutex held. */
+        private void decode_locked(ImageRef img)
+        {
+            img.set_surface(new Cairo.ImageSurface.from_png(img.path));
+            decoded_bytes_ += img.surface_bytes;
+            AtomicUint.inc(ref decodes_);
+            Stats.count("images.decoded");
+            ldebugo(this, "Decoded %s: %zu bytes; %zu total", img.path,
+                img.surface_bytes, decoded_bytes_);
+        }
+
+        /**
+         * Drop decoded images until no more than budget_bytes are held.
+         *
+         * Images are not forgotten, just their pixels.
+         */
+        public void trim()
+        {
+            mutex_.lock();
+            while(decoded_bytes_ > budget_bytes) {
+                ImageRef victim = null;
+                entries_.foreach((k, img)=>{
+                    if(img.surface != null &&
+                        (victim == null || img.last_used < victim.last_used)) {
+                        victim = img;
+                    }
+                });
+                if(victim == null) {
+                    break;  // LCOV_EXCL_LINE - can't happen
+                }
+
+                ldebugo(this, "Dropping decoded %s (%zu bytes)", victim.path,
+                    victim.surface_bytes);
+                decoded_bytes_ -= victim.surface_bytes;
+                victim.surface = null;
+                victim.surface_bytes = 0;
+            }
+            mutex_.unlock();
+        }
+
+        /** Forget all images */
+        public void clear()
+        {
+            mutex_.lock();
+            entries_.foreach((k, img)=>{
+                img.stale = true;
+            });
+            entries_.remove_all();
+            latest_.remove_all();
+            decoded_bytes_ = 0;
+            mutex_.unlock();
+        }
+    } // class ImageCache
+} // My.Shape
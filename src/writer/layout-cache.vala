@@ -0,0 +1,189 @@
+// writer/layout-cache.vala
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+using My.Log;
+
+namespace My.Blocks {
+
+    /**
+     * Cache of shaped Pango layouts.
+     *
+     * Setting a layout's text and measuring it makes Pango itemize and
+     * shape the text, and parse it if it is markup.  When the same text is
+     * laid out the same way more than once --- e.g., headers and footers on
+     * every page, bullets, or repeated paragraphs --- this cache lets the
+     * shaped layout be reused.
+     *
+     * Layouts are keyed by font, width, alignment, justification, and
+     * styled text (see StyledText.get_key()).  A layout returned from the
+     * cache is shared, so the caller must not modify it.
+     *
+     * Layouts are tied to the Pango context they were created with, so
+     * a cache must only be used from one thread.  Entries are evicted
+     * first-in, first-out once the cache is full.
+     */
+    public class LayoutCache : Object {
+        /**
+         * Maximum number of layouts to keep.
+         *
+         * If this is reduced, excess layouts are evicted the next time a
+         * layout is added.
+         */
+        public uint capacity { get; set; default = 256; }
+
+        /** Text longer than this (in bytes, with styles) is not cached */
+        public uint max_text_length { get; set; default = 16384; }
+
+        /** How many lookups were satisfied from the cache */
+        public uint hits { get; private set; default = 0; }
+
+        /** How many lookups had to create a layout */
+        public uint misses { get; private set; default = 0; }
+
+        /** The cached layouts */
+        private HashTable<string, Pango.Layout> layouts_ =
+            new HashTable<string, Pango.Layout>(str_hash, str_equal);
+
+        /** Keys of layouts_, oldest first */
+        private Queue<string> order_ = new Queue<string>();
+
+        public LayoutCache(uint capacity = 256)
+        {
+            Object(capacity: capacity);
+        }
+
+        /** How many layouts are in the cache */
+        public uint size { get { return layouts_.size(); } }
+
+        /**
+         * Get a layout for some markup.
+         *
+         * As get_text_layout(), but for Pango markup.
+         */
+        public Pango.Layout get_layout(Pango.Layout proto, int widthP,
+            Pango.Alignment align, string markup)
+        {
+            return get_text_layout(proto, widthP, align,
+                       new StyledText.from_markup(markup));
+        }
+
+        /**
+         * Get a layout for some text.
+         *
+         * @param proto     A layout with the desired font, wrap mode,
+         *                  and justification.  It is not modified.
+         * @param widthP    The desired width, in Pango units
+         * @param align     The desired alignment
+         * @param text      The text to lay out
+         * @return A layout with the given properties and text.  The
+         *          caller must not modify it.
+         */
+        public Pango.Layout get_text_layout(Pango.Layout proto, int widthP,
+            Pango.Alignment align, StyledText text)
+        {
+            if(text.get_key().length > max_text_length) {
+                ++misses;
+                return make_layout(proto, widthP, align, text);
+            }
+
+            var key = make_key(proto, widthP, align, text);
+            var retval = layouts_.lookup(key);
+            if(retval != null) {
+                ++hits;
+                Stats.count("layouts.cache_hits");
+                return retval;
+            }
+
+            ++misses;
+            retval = make_layout(proto, widthP, align, text);
+            insert(key, retval);
+            return retval;
+        } // get_text_layout()
+
+        /**
+         * Check whether get_text_layout() would find a layout in the cache.
+         *
+         * Parameters are as get_text_layout().  Does not change the counters.
+         */
+        public bool contains(Pango.Layout proto, int widthP,
+            Pango.Alignment align, StyledText text)
+        {
+            return text.get_key().length <= max_text_length &&
+                   layouts_.contains(make_key(proto, widthP, align, text));
+        }
+
+        /**
+         * Add a layout that was shaped elsewhere.
+         *
+         * Parameters are as get_text_layout().  @layout must have been made
+         * with those parameters.  The caller must not modify it
+         * after this call.
+         */
+        public void add(Pango.Layout proto, int widthP,
+            Pango.Alignment align, StyledText text, Pango.Layout layout)
+        {
+            if(text.get_key().length > max_text_length) {
+                return;
+            }
+            var key = make_key(proto, widthP, align, text);
+            if(!layouts_.contains(key)) {
+                insert(key, layout);
+            }
+        }
+
+        /** Empty the cache.  Does not reset the counters. */
+        public void clear()
+        {
+            layouts_.remove_all();
+            order_.clear();
+        }
+
+        /** Make the key for a layout */
+        private static string make_key(Pango.Layout proto, int widthP,
+            Pango.Alignment align, StyledText text)
+        {
+            return "%s\x1f%d\x1f%d\x1f%d\x1f%d\x1f%s".printf(
+                proto.get_font_description().to_string(),
+                widthP, (int)align, (int)proto.get_justify(),
+                (int)proto.get_wrap(), text.get_key());
+        }
+
+        /** Add a layout under @key, evicting old ones if necessary */
+        private void insert(string key, Pango.Layout layout)
+        {
+            if(capacity == 0) {
+                return;
+            }
+            while(order_.length >= capacity) {
+                layouts_.remove(order_.pop_head());
+            }
+            order_.push_tail(key);
+            layouts_.insert(key, layout);
+        }
+
+        /** Create and shape a new layout */
+        private Pango.Layout make_layout(Pango.Layout proto, int widthP,
+            Pango.Alignment align, StyledText text)
+        {
+            var retval = proto.copy();
+            retval.set_width(widthP);
+            retval.set_alignment(align);
+            text.apply_to(retval);
+
+            // Shape it now so the work is not repeated on each use
+            Pango.Rectangle inkP, logicalP;
+            retval.get_extents(out inkP, out logicalP);
+            if(Stats.enabled) {
+                Stats.count("layouts");
+                Stats.count("lines.shaped", retval.get_line_count());
+            }
+
+            if(lenabled(TRACE)) {
+                ltraceo(this, "new layout %p for %d bytes of text", retval,
+                    retval.get_text().length);
+            }
+            return retval;
+        }
+    } // class LayoutCache
+} // My.Blocks
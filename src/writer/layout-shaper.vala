@@ -0,0 +1,245 @@
+// writer/layout-shaper.vala
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+using My.Log;
+
+namespace My.Blocks {
+
+    /**
+     * Shapes the layouts for a batch of blocks on several threads at once.
+     *
+     * Shaping and line-breaking are the expensive part of rendering.  The
+     * width of each block is known before pagination starts, so each
+     * block's layout can be prepared ahead of time.  The serial
+     * pagination pass in Blk.render_layout() then only has to measure and
+     * draw the lines.
+     *
+     * Pango objects must not be used by more than one thread at a time.
+     * Therefore, each worker thread has its own font map and context, and
+     * everything a worker needs is copied out of the blocks before the
+     * workers start.  The finished layouts are handed to the blocks once
+     * the whole batch is done, while the workers wait for the next batch.
+     *
+     * The worker threads, and so their font maps and font caches, last as
+     * long as the shaper.  Layouts in a LayoutCache therefore stay tied to
+     * font maps that are still in use.
+     */
+    public class LayoutShaper : Object {
+        /** How many threads to use.  0 means one per processor. */
+        public uint nthreads { get; construct; default = 0; }
+
+        /** One block's worth of work */
+        private class Job {
+            /**
+             * The block, or null to tell a worker to exit.
+             * Only touched by the calling thread.
+             */
+            public Blk? blk = null;
+
+            // Copies of the layout parameters
+            public Pango.FontDescription font;
+            public int widthP;
+            public Pango.Alignment align;
+            public bool justify;
+            public Pango.WrapMode wrap;
+            public string text;
+            public Pango.AttrList attrs;
+
+            /** The shaped layout */
+            public Pango.Layout result = null;
+        }
+
+        /**
+         * What the worker threads share.
+         *
+         * The workers hold this rather than the shaper, so that the shaper
+         * can be freed, and stop its workers, when it is no longer used.
+         */
+        private class Pool {
+            /**
+             * Font options of the surface the layouts will be rendered on.
+             *
+             * These affect the metrics, so they must match.
+             */
+            public Cairo.FontOptions font_options;
+
+            /** Jobs waiting to be shaped */
+            public AsyncQueue<Job> todo = new AsyncQueue<Job>();
+
+            /** Jobs that have been shaped */
+            public AsyncQueue<Job> done = new AsyncQueue<Job>();
+        }
+
+        private Pool pool_ = new Pool();
+
+        /** The worker threads, started by the first shape() that needs them */
+        private Thread<bool>[] workers_ = {};
+
+        /** For shaping on the calling thread, if there is only one thread */
+        private Pango.Context context_ = null;
+
+        /**
+         * Constructor
+         * @param nthreads      How many threads to use; 0 = one per processor
+         * @param font_options  The font options of the target surface
+         */
+        public LayoutShaper(uint nthreads, Cairo.FontOptions font_options)
+        {
+            Object(nthreads: nthreads);
+            pool_.font_options = font_options.copy();
+        }
+
+        ~LayoutShaper()
+        {
+            for(int i=0; i<workers_.length; ++i) {
+                pool_.todo.push(new Job());     // blk == null: exit
+            }
+            foreach(var worker in workers_) {
+                worker.join();
+            }
+        }
+
+        /**
+         * Whether this shaper can be used in place of a new one.
+         *
+         * @param nthreads      As for the constructor
+         * @param font_options  As for the constructor
+         */
+        public bool matches(uint nthreads, Cairo.FontOptions font_options)
+        {
+            return this.nthreads == nthreads &&
+                   pool_.font_options.equal(font_options);
+        }
+
+        /**
+         * Shape the layouts for some blocks.
+         *
+         * Blocks whose layouts cannot be prepared ahead of time are skipped.
+         * See Blk.get_layout_spec().
+         *
+         * @param blks      The blocks
+         * @param leftC     Where each block will start, page-relative
+         * @param rightP    The right limit w.r.t. the page, in Pango units
+         * @return The number of layouts shaped
+         */
+        public uint shape(Gee.Collection<Blk> blks, double leftC, int rightP)
+        {
+            Job[] jobs = {};
+
+            foreach(var blk in blks) {
+                Pango.Layout proto;
+                int widthP;
+                StyledText text;
+                if(!blk.get_layout_spec(leftC, rightP, out proto, out widthP,
+                    out text)) {
+                    continue;
+                }
+
+                var job = new Job();
+                job.blk = blk;
+                job.widthP = widthP;
+                job.text = text.text;
+                job.attrs = text.get_attrs().copy();
+                job.font = proto.get_font_description().copy();
+                job.align = proto.get_alignment();
+                job.justify = proto.get_justify();
+                job.wrap = proto.get_wrap();
+                jobs += job;
+            }
+
+            if(jobs.length == 0) {
+                return 0;
+            }
+
+            uint n = (nthreads > 0) ? nthreads : get_num_processors();
+            ldebugo(this, "Shaping %d layouts on %u threads", jobs.length, n);
+
+            if(n <= 1) {
+                if(context_ == null) {
+                    context_ = new_context(pool_.font_options);
+                }
+                foreach(var job in jobs) {
+                    shape_job(job, context_);
+                }
+            } else {
+                start_workers(n);
+                foreach(var job in jobs) {
+                    pool_.todo.push(job);
+                }
+                for(int i=0; i<jobs.length; ++i) {
+                    pool_.done.pop();
+                }
+            }
+
+            foreach(var job in jobs) {
+                job.blk.set_prepared_layout(job.result);
+            }
+            return jobs.length;
+        } // shape()
+
+        /** Start @n workers if they are not already running */
+        private void start_workers(uint n)
+        {
+            if(workers_.length > 0) {
+                return;
+            }
+            for(uint i=0; i<n; ++i) {
+                workers_ += start_worker(i, pool_);
+            }
+        }
+
+        /**
+         * Start a worker thread.
+         *
+         * This is static so the thread does not hold a reference to the shaper.
+         */
+        private static Thread<bool> start_worker(uint idx, Pool pool)
+        {
+            return new Thread<bool>("pfft-shape-%u".printf(idx), () => {
+                var context = new_context(pool.font_options);
+                while(true) {
+                    var job = pool.todo.pop();
+                    if(job.blk == null) {
+                        break;
+                    }
+                    shape_job(job, context);
+                    pool.done.push(job);
+                }
+                return true;
+            });
+        }
+
+        /** Make a context with its own font map */
+        private static Pango.Context new_context(Cairo.FontOptions font_options)
+        {
+            var fontmap = Pango.CairoFontMap.new();
+            var context = fontmap.create_context();
+            Pango.cairo_context_set_font_options(context, font_options);
+            return context;
+        }
+
+        /** Shape the layout for @job using @context */
+        private static void shape_job(Job job, Pango.Context context)
+        {
+            var layout = new Pango.Layout(context);
+            layout.set_font_description(job.font);
+            layout.set_wrap(job.wrap);
+            layout.set_justify(job.justify);
+            layout.set_alignment(job.align);
+            layout.set_width(job.widthP);
+            layout.set_text(job.text, -1);
+            layout.set_attributes(job.attrs);
+
+            // Shape and break lines now, on this thread
+            Pango.Rectangle inkP, logicalP;
+            layout.get_extents(out inkP, out logicalP);
+            if(Stats.enabled) {
+                Stats.count("layouts");
+                Stats.count("lines.shaped", layout.get_line_count());
+            }
+
+            job.result = layout;
+        } // shape_job()
+    } // class LayoutShaper
+} // My.Blocks
@@ -131,12 +131,13 @@ namespace My {
              */
             private Pango.Rectangle? logicalP = null;
 
-            private Cairo.ImageSurface image;
+            /** The image.  May be shared with other Image instances. */
+            private ImageRef image;
 
             private void populate_rects()
             {
-                int wdP = c2p(image.get_width());
-                int htP = c2p(image.get_height());
+                int wdP = c2p(image.width);
+                int htP = c2p(image.height);
                 logicalP = Pango.Rectangle();
                 logicalP.x = 0;
                 logicalP.y = -(htP + paddingP);
@@ -176,14 +177,12 @@ namespace My {
 
                 // Figure out where to put the image.  Use the ink rectangle
                 // so that changes to the business logic are only in populate_rects().
-                double img_topC, img_leftC, img_wC, img_hC, img_log_widthC;
+                double img_topC, img_leftC, img_log_widthC;
 
                 var inkP = get_inkP();
 
                 img_topC = topC + p2c(inkP.y);
                 img_leftC = leftC + p2c(inkP.x);
-                img_wC = p2c(inkP.width);
-                img_hC = p2c(inkP.height);
 
                 var logP = get_logicalP();
                 img_log_widthC = p2c(logP.x + logP.width);
@@ -192,9 +191,7 @@ namespace My {
                 cr.save();
                 cr.set_antialias(NONE);
 
-                cr.set_source_surface(image, img_leftC, img_topC);
-                cr.rectangle(img_leftC, img_topC, img_wC, img_hC);
-                cr.fill();
+                image.paint(cr, img_leftC, img_topC);
 
                 cr.set_line_width(0.5);
                 if(lenabled(TRACE)) {     // ink
@@ -213,7 +210,7 @@ namespace My {
 
             public override Shape.Base clone()
             {
-                Image retval = new Image(this.image, this.caption, this.paddingP);
+                Image retval = new Image.from_ref(this.image, this.caption, this.paddingP);
                 return retval;
             }
 
@@ -225,6 +222,18 @@ namespace My {
              *                  means to use DEFAULT_PADDING_IN.
              */
             public Image(Cairo.ImageSurface image, string caption = "", int paddingP = -1)
+            {
+                this.from_ref(new ImageRef.for_surface(image), caption, paddingP);
+            }     // ctor
+
+            /**
+             * Constructor for a shared image
+             * @param image     The image
+             * @param caption   The image caption, if any.
+             * @param paddingP  The padding, in Pango units.  -1 (the default)
+             *                  means to use DEFAULT_PADDING_IN.
+             */
+            public Image.from_ref(ImageRef image, string caption = "", int paddingP = -1)
             {
                 this.image = image;
                 this.caption_stg = caption;
@@ -239,6 +248,9 @@ namespace My {
              * NOTE: at present, assumes that @href is a path from the
              * location of the source file to the location of a PNG file.
              *
+             * The image is shared through {@link ImageCache.get_default},
+             * so it is not necessarily decoded yet.
+             *
              * @param href      Where the referenced image is
              * @param doc_path  Where the referencing file is.
              *                  This is a string rather than a File so it
@@ -249,18 +261,16 @@ namespace My {
             public Image.from_href(string href, string doc_path,
                 string caption = "", int paddingP = -1)
             {
-                Cairo.ImageSurface s;
-
                 string docfn = My.canonicalize_filename(doc_path);     // make absolute
                 string docdir = File.new_for_path(docfn).get_parent().get_path();
                 string imgfn = My.canonicalize_filename(href, docdir);
-                s = new Cairo.ImageSurface.from_png(imgfn);
+                var img = ImageCache.get_default().lookup(imgfn);
 
-                this(s, caption, paddingP);
+                this.from_ref(img, caption, paddingP);
 
                 llogo(this, "Loaded %s (%s relative to %s): %p, %f x %f, caption `%s'",
-                    imgfn, href, doc_path, s,
-                    c2i(image.get_width()), c2i(image.get_height()),
+                    imgfn, href, doc_path, img,
+                    c2i(image.width), c2i(image.height),
                     this.caption
                 );
             }     // Image.from_href()
@@ -514,24 +524,23 @@ namespace My {
         public class Blk : Object {
 
             /**
-             * The block's text, in Pango markup.
+             * The block's text and styles.  Appended to as the block is built.
              *
              * This definition is here so child classes don't have to repeat it.
              * However, a child class is not obliged to use this.
-             *
-             * NOTE: Pango obeys `\n`s in the markup, so the caller must remove
-             * them for automatically-wrapped text.
              */
-            public string markup { get; set; default = ""; }
+            public StyledText content { get; private set; default = new StyledText(); }
 
             /**
-             * Additional markup to be added to the end of the block before rendering.
-             * A child class is not obliged to use this.
+             * If false, line breaks in the text are replaced with spaces
+             * as the text is appended.  See StyledText.obeylines.
+             *
+             * Used for code blocks.  Set before adding any text.
              */
-            public string post_markup { get; set; default = ""; }
-
-            /** A cached version of markup + post_markup */
-            private string whole_markup = null;
+            public bool obeylines {
+                get { return content.obeylines; }
+                set { content.obeylines = value; }
+            }
 
             /**
              * The parskip category.
@@ -542,27 +551,98 @@ namespace My {
              */
             public ParskipCategory parskip_category { get; set; default = OTHER; }
 
-            /** Return the cached markup + post_markup */
-            protected string get_whole_markup()
+            /**
+             * A layout instance to use.
+             *
+             * This is so the font and wrap can be consistent between blocks.
+             */
+            protected Pango.Layout layout;
+
+            /**
+             * Where to get shaped layouts, if anywhere.
+             *
+             * If set, render_layout() takes blocks without shapes from the
+             * cache rather than re-shaping them in the shared layout.
+             */
+            public LayoutCache? layout_cache { get; set; default = null; }
+
+            /**
+             * If true, render() lays out and paginates the block, but does
+             * not draw its text or shapes.  Set by the writer when it is
+             * only counting pages.
+             */
+            public bool measuring { get; set; default = false; }
+
+            /** The layout render_layout() is using for this block */
+            private Pango.Layout active_layout = null;
+
+            /**
+             * A layout shaped ahead of time, if any.
+             *
+             * Set by LayoutShaper, and used and cleared by render_layout().
+             */
+            private Pango.Layout prepared_layout = null;
+
+            /** Provide a layout shaped ahead of time.  See get_layout_spec(). */
+            public void set_prepared_layout(Pango.Layout layout)
             {
-                if(whole_markup == null) {
-                    whole_markup = markup + post_markup;
-                }
-                return whole_markup;
+                prepared_layout = layout;
             }
 
-            /** Invalidate the cached whole_markup() */
-            protected void recalc_whole_markup()
+            /**
+             * Describe the layout render_layout() will use for this block.
+             *
+             * This is so the layout can be shaped ahead of time, e.g., by
+             * LayoutShaper.  Child classes that start their text somewhere
+             * other than the left edge of the block must override this.
+             *
+             * @param leftC     Where the block will start, page-relative
+             * @param rightP    As for render()
+             * @param proto     The layout whose font and wrapping to use
+             * @param widthP    The width of the layout
+             * @param text      The text of the layout
+             * @return true if the layout can be shaped ahead of time.  It
+             *          cannot if the block has shapes or no text, or if the
+             *          layout is already in the layout cache.
+             */
+            public virtual bool get_layout_spec(double leftC, int rightP,
+                out Pango.Layout proto, out int widthP, out StyledText text)
             {
-                whole_markup = null;
+                proto = layout;
+                widthP = rightP - c2p(leftC);
+                text = content;
+
+                if(content.is_empty() || (shapes != null && !shapes.is_empty)) {
+                    return false;
+                }
+                if(layout_cache != null &&
+                    layout_cache.contains(layout, widthP, layout.get_alignment(), content)) {
+                    return false;
+                }
+                return true;
             }
 
             /**
-             * A layout instance to use.
+             * Get prepared_layout if it has the given width.
              *
-             * This is so the font and wrap can be consistent between blocks.
+             * Either way, prepared_layout is cleared.  A layout that is
+             * returned is also added to the layout cache, if any.
              */
-            protected Pango.Layout layout;
+            private Pango.Layout? take_prepared_layout(Pango.Layout base_layout,
+                int widthP)
+            {
+                Pango.Layout retval = (owned)prepared_layout;
+                prepared_layout = null;
+                if(retval == null || retval.get_width() != widthP) {
+                    return null;
+                }
+
+                if(layout_cache != null) {
+                    layout_cache.add(base_layout, widthP,
+                        base_layout.get_alignment(), content, retval);
+                }
+                return retval;
+            }
 
             /**
              * How many lines of the content have already been rendered.
@@ -571,6 +651,26 @@ namespace My {
              */
             protected int nlines_rendered = 0;
 
+            /**
+             * Where render_layout() left off in a partly-rendered layout.
+             *
+             * This lets each page start at the next line instead of
+             * walking the lines already rendered, so a block spanning many
+             * pages takes time linear in its number of lines.  Valid while
+             * nlines_rendered > 0, provided the layout has not changed since
+             * (see resume_serial).
+             */
+            private Pango.LayoutIter resume_iter = null;
+
+            /** The serial number of the layout when resume_iter was saved */
+            private uint resume_serial = 0;
+
+            /** The layout Y of the bottom of the last line rendered */
+            private int resume_skip_yP = 0;
+
+            /** The Y of the layout's logical rectangle */
+            private int layout_topP = 0;
+
             /**
              * List of "shapes", i.e., non-text elements to be rendered inline
              * with the text.
@@ -579,18 +679,23 @@ namespace My {
              */
             protected Gee.LinkedList<Shape.Base> shapes = null;
 
-            /** Add an object to the list of elements to be rendered separately */
+            /** Where each shape's OBJ_REPL_CHAR is in the text, in bytes */
+            private uint[] shape_offsets = {};
+
+            /**
+             * Add an object to be rendered separately, at the end of the
+             * text so far.
+             */
             public void add_shape(Shape.Base shape)
             {
                 if(shapes == null) {
                     shapes = new Gee.LinkedList<Shape.Base>();
                 }
                 shapes.add(shape);
+                shape_offsets += (uint)content.length;
+                content.append_verbatim(OBJ_REPL_CHAR());
             }     // add_shape()
 
-            /** Attributes representing the shapes */
-            protected Pango.AttrList shape_attrs = null;
-
             /**
              * Whether the block is "void", i.e., has no effect on the page.
              *
@@ -602,53 +707,16 @@ namespace My {
             }
 
             /**
-             * Initialize shape_attrs.
-             *
-             * Call only when the markup for the block has been finalized and
-             * all add_shape() calls have been made.
+             * Make the attributes for the layout: the text's styles plus
+             * the shapes.
              *
-             * @param text  The actual text in the layout --- NOT the markup
+             * The shapes' positions were recorded by add_shape(), so the
+             * text does not have to be searched for them.
              */
-            protected void fill_shape_attrs(string text)
+            private Pango.AttrList make_attrs_with_shapes()
             {
-                shape_attrs = new Pango.AttrList();
-                if(shapes == null || shapes.is_empty) {
-                    return;
-                }
-
-                // check if the number of OBJ_REPL_CHARs in whole_markup
-                // is the same as the number of shapes
-                int[] start_offset_bytes = {};
-                int[] end_offset_bytes = {};
-                var re = new Regex(OBJ_REPL_CHAR());     // TODO move out of this fn, or handle/forward the RegexError
-                MatchInfo matches;
-                // lmemdumpo(this, "OBJ_REPL_CHAR", OBJ_REPL_CHAR(), OBJ_REPL_CHAR().length);
-                // lmemdumpo(this, "whole_markup", get_whole_markup(), get_whole_markup().length);
-                if(!re.match_full(text, -1, 0, 0, out matches)) {
-                    lerroro(this, "No obj repl chars");
-                    assert(false);     // TODO
-                }
+                var retval = content.get_attrs().copy();
                 int shapeidx = -1;
-                while(matches.matches()) {
-                    ++shapeidx;
-                    int start_pos, end_pos;
-                    if(!matches.fetch_pos(0, out start_pos, out end_pos)) {
-                        lerroro(this, "Could not fetch match position");
-                        assert(false);     // TODO
-                    }
-                    ltraceo(this, "shape %d repl char %d->%d", shapeidx, start_pos, end_pos);
-                    start_offset_bytes += start_pos;
-                    end_offset_bytes += end_pos;
-                    matches.next();
-                }
-
-                if(start_offset_bytes.length != shapes.size) {
-                    lerroro(this, "Wrong number of obj repl chars/shapes");
-                    assert(false);     // TODO
-                }
-                ltraceo(this, "Found %d match(es)", start_offset_bytes.length);
-
-                shapeidx = -1;
                 foreach(var shape in shapes) {
                     ++shapeidx;
                     var attr = new Pango.AttrShape<Shape.Base>.with_data(
@@ -656,81 +724,15 @@ namespace My {
                         (data)=>{ return data.clone();} );
 
                     // byte offsets of the placeholder
-                    attr.start_index = start_offset_bytes[shapeidx];
-                    attr.end_index = end_offset_bytes[shapeidx];
-
-
-                    shape_attrs.insert((owned)attr);
-                }
-
-            }     // fill_shape_attrs()
-
-            /** Add shape_attrs to the list of attributes for a layout */
-            private void append_shape_attrs_to(Pango.Layout layout)
-            {
-                var old_attributes = layout.get_attributes();
-                if(old_attributes == null) {
-                    ltraceo(this, "Setting attributes to %p", shape_attrs);
-                    layout.set_attributes(shape_attrs);     // OK even if shape_attrs==null
-                    return;
-                }
+                    attr.start_index = shape_offsets[shapeidx];
+                    attr.end_index = shape_offsets[shapeidx] + OBJ_REPL_CHAR().length;
+                    ltraceo(this, "shape %d at %u->%u", shapeidx,
+                        attr.start_index, attr.end_index);
 
-                if(shape_attrs == null) {
-                    ltraceo(this, "Don't need to change the existing attrs");
-                    return;
+                    retval.insert((owned)attr);
                 }
-
-                // Normal case: add to the list
-                var dest = old_attributes.copy();
-                var iter = shape_attrs.get_iterator();
-                int entries = 0;
-                while(true) {
-                    var attrs = iter.get_attrs();
-                    if(attrs != null) {
-                        attrs.foreach((attr) => {
-                            var new_attr = attr.copy();
-                            ltraceo(new_attr, "Shape attr for %d", entries);
-                            dest.insert((owned)new_attr);
-                            ++entries;
-                        });
-                    }
-                    if(!iter.next()) {
-                        break;
-                    }
-                }
-                ldebugo(this, "Added %d attrs", entries);
-
-                // Refresh the layout if anything changed
-                if(entries > 0) {
-                    ltraceo(this, "Updating layout");
-                    layout.set_attributes(dest);
-                }
-
-                if(lenabled(TRACE)) {
-                    iter = layout.get_attributes().get_iterator();
-                    entries = 0;
-                    while(true) {
-                        var attrs = iter.get_attrs();
-                        if(attrs != null) {
-                            attrs.foreach((attr) => {
-                                ++entries;
-                                ltraceo(attr, "%s %u->%u", attr.klass.type.to_string(),
-                                attr.start_index, attr.end_index);
-                                if(attr.klass.type == Pango.AttrType.SHAPE) {
-                                    unowned Pango.AttrShape<Shape.Base> shape = (Pango.AttrShape<Shape.Base>)attr;
-                                    ltraceo(attr, "  shape: ink %s log %s",
-                                    prect_to_string(shape.ink_rect),
-                                    prect_to_string(shape.logical_rect));
-                                }
-                            });
-                        }
-                        if(!iter.next()) {
-                            break;
-                        }
-                    }
-                    ltraceo(this, "Total %d attrs", entries);
-                }     // endif TRACE
-            }     // append_shape_attrs_to()
+                return retval;
+            }     // make_attrs_with_shapes()
 
             /**
              * Render a shape
@@ -748,16 +750,17 @@ namespace My {
              *
              * This is the main routine that renders text.
              *
-             * This is a helper for child classes.  If whole_markup is empty,
+             * This is a helper for child classes.  If the content is empty,
              * this is a no-op.  Parameters are as in render().
              *
-             * Requires the layout already be initialized.  If any shapes are
-             * present, requires fill_shape_attrs() already have been called.
+             * Requires the layout already be initialized.
              *
-             * Sets nlines_rendered.
+             * Sets nlines_rendered, and saves the position in the layout for
+             * the next call if the block is not complete.
              *
              * @param cr        The Cairo context for the current page
-             * @param layout    The Pango layout to use
+             * @param base_layout The Pango layout to use, or to use as a
+             *                  prototype if layout_cache is set
              * @param rightP    The right edge of the available area,
              *                  page-relative, Pango units
              * @param bottomP   The bottom edge of the available area,
@@ -765,10 +768,11 @@ namespace My {
              * @return The result of the rendering
              */
             protected RenderResult render_layout(Cairo.Context cr,
-                Pango.Layout layout,
+                Pango.Layout base_layout,
                 int rightP, int bottomP)
             {
                 double leftC, topC;     // Where we started
+                Pango.Layout layout = active_layout ?? base_layout;
 
                 // Layout coords: Origin at the upper-left of the layout;
                 // positive X to the right and positive Y down.
@@ -778,7 +782,7 @@ namespace My {
                 ldebugo(this,"layout %p starting at (%f, %f) limits (%f, %f)",
                     layout, c2i(leftC), c2i(topC), p2i(rightP), p2i(bottomP));
 
-                if(get_whole_markup() == "") {
+                if(content.is_empty()) {
                     return RenderResult.COMPLETE;
                 }
 
@@ -798,67 +802,111 @@ namespace My {
                         return RenderResult.ERROR;     // too wide
                     }
 
-                    layout.set_width(rightP - c2p(leftC));
-                    layout.set_markup(get_whole_markup(), -1);
-
-                    ltraceo(this, "layout width %f, alignment %s",
-                        p2i(layout.get_width()),
-                        layout.get_alignment().to_string()
-                    );
-                    lmemdumpo(this, "whole markup", get_whole_markup(), get_whole_markup().length);
-                    lmemdumpo(this, "layout text", layout.get_text(), layout.get_text().length);
-
-                    // Set up for shape rendering.
-
-                    // Find the object-replacement chars.  We have to fill AFTER
-                    // the set_markup() call because:
-                    // - the markup includes markup tags;
-                    // - the text omits those tags; and
-                    // - the byte offsets are in the text, not the markup.
-                    // Rather than parsing the markup ourselves, just get the text
-                    // the layout is actually using.
+                    // If there is nothing block-specific in the layout,
+                    // it can be shaped elsewhere or shared.
+                    Pango.Layout shared = null;
+                    if(shapes == null || shapes.is_empty) {
+                        int widthP = rightP - c2p(leftC);
+                        // Reuse the layout from a previous pass, if any,
+                        // e.g., when the writer measured the document first.
+                        if(active_layout != null &&
+                            active_layout.get_width() == widthP) {
+                            shared = active_layout;
+                        } else {
+                            shared = take_prepared_layout(base_layout, widthP);
+                        }
+                        if(shared == null && layout_cache != null) {
+                            shared = layout_cache.get_text_layout(base_layout,
+                                    widthP, base_layout.get_alignment(),
+                                    content);
+                        }
+                    }
 
-                    fill_shape_attrs(layout.get_text());
+                    if(shared != null) {
+                        layout = shared;
+                        active_layout = layout;
+                    } else {
+                        layout = base_layout;
+                        active_layout = null;
+                        layout.set_width(rightP - c2p(leftC));
+                        layout.set_text(content.text, (int)content.length);
+
+                        // Shapes are specific to this block, so add them
+                        // to a copy of the text's attributes.
+                        if(shapes == null || shapes.is_empty) {
+                            layout.set_attributes(content.get_attrs());
+                        } else {
+                            layout.set_attributes(make_attrs_with_shapes());
+                            Pango.cairo_context_set_shape_renderer(
+                                layout.get_context(),
+                                (cr, attr, do_path)=>{ render_shape(cr, attr, do_path); }
+                            );
+                        }
+                    }
 
-                    append_shape_attrs_to(layout);
-                    Pango.cairo_context_set_shape_renderer(
-                        layout.get_context(),
-                        (cr, attr, do_path)=>{ render_shape(cr, attr, do_path); }
-                    );
+                    if(lenabled(TRACE)) {
+                        ltraceo(this, "layout width %f, alignment %s",
+                            p2i(layout.get_width()),
+                            layout.get_alignment().to_string()
+                        );
+                    }
+                    if(lenabled(MEMDUMP)) {
+                        lmemdumpo(this, "layout text", layout.get_text(), layout.get_text().length);
+                    }
 
                     layout.get_extents(out layout_inkP, out layout_logicalP);
+                    if(Stats.enabled && active_layout == null) {
+                        Stats.count("layouts");
+                        Stats.count("lines.shaped", layout.get_line_count());
+                    }
 
                     if(lenabled(LOG)) {
                         llogo(this, "layout ink: %s", prect_to_string(layout_inkP));
                         llogo(this, "layout log: %s", prect_to_string(layout_logicalP));
                     }
+                    layout_topP = layout_logicalP.y;
 
-                } else {
-                    layout.get_extents(out layout_inkP, out layout_logicalP);
-                }     // endif need to set up the layout else
+                }     // endif need to set up the layout
 
                 int lineno = 0;
                 int yP = c2p(topC);     // Current Y
 
-                yP += layout_logicalP.y;     // Leave room if the layout extends above its top (y=0)?
+                yP += layout_topP;     // Leave room if the layout extends above its top (y=0)?
                 // TODO only adjust yP on the first page of a layout?
 
-                var iter = layout.get_iter();
-                if(iter == null || iter.get_layout() == null) {
-                    lerroro(this, "Invalid iterator %p!", iter);
-                    return RenderResult.ERROR;
+                // How much of the layout height was in lines we skipped
+                int layout_skip_yP = 0;
+
+                // Pick up where we left off, if we can.  Otherwise, start
+                // from the top and skip the lines already rendered.
+                Pango.LayoutIter iter;
+                if(nlines_rendered > 0 && resume_iter != null &&
+                    resume_iter.get_layout() == layout &&
+                    layout.get_serial() == resume_serial) {
+                    iter = (owned)resume_iter;
+                    lineno = nlines_rendered;
+                    layout_skip_yP = resume_skip_yP;
+                    ldebugo(this, "Resuming at line %d", lineno);
+                } else {
+                    iter = layout.get_iter();
+                    if(iter == null || iter.get_layout() == null) {
+                        lerroro(this, "Invalid iterator %p!", iter);
+                        return RenderResult.ERROR;
+                    }
                 }
+                resume_iter = null;
 
                 // If the iter is valid, there is at least one line (as far as
                 // I can tell from inspecting the source).
                 unowned Pango.LayoutLine curr_line = iter.get_line();
                 bool rendered_last_line = false;
                 bool did_render = false;     // did we render anything during this call?
+                int nlines_drawn = 0;        // how many lines, for Stats
 
                 RenderResult retval = UNKNOWN;
 
-                // How much of the layout height was in lines we skipped
-                int layout_skip_yP = 0;
+                // The layout Y of the bottom of the last line rendered
+                int drawn_bottomP = layout_skip_yP;
 
                 // Line coords: Origin at the UL corner of the layout;
                 // positive X to the right and positive Y down.
@@ -873,6 +921,10 @@ namespace My {
                         llogo(this, "Skipping line %d", lineno);
                         iter.get_line_extents(out line_inkP, out line_logicalP);
                         layout_skip_yP = line_logicalP.y + line_logicalP.height;
+                        drawn_bottomP = layout_skip_yP;
+                        if(Stats.enabled) {
+                            Stats.count("lines.skipped");
+                        }
 
                         ++lineno;
                         if(!iter.next_line()) {
@@ -902,6 +954,11 @@ namespace My {
                         // At least the current line is left, so this block is
                         // not yet complete.
                         nlines_rendered = lineno;
+                        if(lineno > 0) {
+                            resume_serial = layout.get_serial();
+                            resume_skip_yP = drawn_bottomP;
+                            resume_iter = (owned)iter;
+                        }
                         retval = did_render ? RenderResult.PARTIAL : RenderResult.NONE;
                         // TODO if nlines_rendered > 0, should we always return
                         // PARTIAL since some of the block has already been
@@ -930,7 +987,9 @@ namespace My {
                     net_inkP.width = line_inkP.width;
                     net_inkP.height = line_inkP.height;
 
-                    if(lenabled(DEBUG)) {     // draw the rectangles
+                    int line_bottomP = line_logicalP.y + line_logicalP.height;
+
+                    if(lenabled(DEBUG) && !measuring) {     // draw the rectangles
                         cr.save();
                         cr.set_antialias(NONE);
                         cr.set_line_width(0.5);
@@ -972,9 +1031,13 @@ namespace My {
                     ldebugo(this, "  - Rendering line %d, UL corner y %f", lineno, p2i(yP));
                     llogo(this, "    Rendering at (%f, %f)", p2i(this_xP), p2i(this_yP));
 
-                    cr.move_to(p2c(this_xP), p2c(this_yP));
-                    Pango.cairo_show_layout_line(cr, curr_line);     // UNSETS the current point
+                    if(!measuring) {
+                        cr.move_to(p2c(this_xP), p2c(this_yP));
+                        Pango.cairo_show_layout_line(cr, curr_line);     // UNSETS the current point
+                    }
                     did_render = true;
+                    ++nlines_drawn;
+                    drawn_bottomP = line_bottomP;
 
                     // Advance to the next line
                     yP += line_logicalP.height;
@@ -1007,6 +1070,10 @@ namespace My {
 
                 ldebugo(this, "END - rendered %d lines - %s",
                     nlines_rendered, retval.to_string());
+                if(Stats.enabled) {
+                    Stats.count(measuring ? "lines.measured" : "lines.rendered",
+                        nlines_drawn);
+                }
 
                 return retval;
             }     // render_layout()
@@ -1078,7 +1145,7 @@ namespace My {
 
             public override bool is_void()
             {
-                return (get_whole_markup() == "");
+                return content.is_empty();
             }
 
             /**
@@ -1093,10 +1160,10 @@ namespace My {
             {
                 if(shapes == null) return "";
 
-                // Test the existing markup.  This has the convenient side
+                // Test the existing text.  This has the convenient side
                 // effect that it keeps us from adding the caption to the
                 // text multiple times, if layout() is called more than once.
-                if(get_whole_markup() != OBJ_REPL_CHAR()) return "";
+                if(content.text != OBJ_REPL_CHAR()) return "";
 
                 int nshapes = 0;
                 string caption = "";
@@ -1118,16 +1185,17 @@ namespace My {
                 // Special case images
                 var caption = special_case_caption();
                 if(caption != "") {
-                    post_markup += "\n" + Markup.escape_text(caption);
-                    recalc_whole_markup();
+                    content.append_verbatim("\n" + caption);
 
                     // Make a new layout with the attributes we need.
                     // This is in case layout() is called multiple times.
                     layout = layout.copy();
                     layout.set_alignment(CENTER);
                     llogo(this, "Image special case");
-                    lmemdumpo(this, "modified markup", get_whole_markup(),
-                        get_whole_markup().length);
+                    if(lenabled(MEMDUMP)) {
+                        lmemdumpo(this, "modified text", content.text,
+                            content.length);
+                    }
                 }
 
                 // Render
@@ -1149,8 +1217,8 @@ namespace My {
              */
             private Pango.Layout bullet_layout;
 
-            /** The markup for the bullet */
-            private string bullet_markup;
+            /** The bullet, from markup */
+            private StyledText bullet_text;
 
             /** The left edge of the bullet, w.r.t. the left margin */
             private int bullet_leftP;
@@ -1170,18 +1238,25 @@ namespace My {
 
                 this.parskip_category = LIST;
                 this.bullet_layout = bullet_layout;
-                this.bullet_markup = bullet_markup;
+                this.bullet_text = new StyledText.from_markup(bullet_markup);
                 this.bullet_leftP = bullet_leftP;
                 this.text_leftP = text_leftP;
             }
 
+            public override bool get_layout_spec(double leftC, int rightP,
+                out Pango.Layout proto, out int widthP, out StyledText text)
+            {
+                return base.get_layout_spec(leftC + p2c(text_leftP), rightP,
+                           out proto, out widthP, out text);
+            }
+
             /**
              * Render the bullet and the text.
              */
             public override RenderResult render(Cairo.Context cr,
                 int rightP, int bottomP)
             {
-                if(get_whole_markup() == "") {
+                if(content.is_empty()) {
                     return RenderResult.COMPLETE;
                 }
 
@@ -1202,7 +1277,7 @@ namespace My {
                     return RenderResult.ERROR;
                 }
 
-                // Try to render the markup.  This will fail if we don't have room.
+                // Try to render the text.  This will fail if we don't have room.
                 cr.move_to(leftC + p2c(text_leftP), topC);
                 bool is_first_chunk = (nlines_rendered == 0);
                 var result = render_layout(cr, layout, rightP, bottomP);
@@ -1217,6 +1292,9 @@ namespace My {
                 if(result == NONE) {     // None of the block fit on the page
                     return result;      // TODO use result.rendered()?
                 }
+                if(measuring) {         // The bullet takes no vertical space
+                    return result;
+                }
 
                 // Something rendered on the first page, so render the bullet.
                 // TODO shift the bullet down so it is centered on the first
@@ -1224,9 +1302,15 @@ namespace My {
                 ldebugo(this, "Rendering bullet from layout %p - post-render at (%f, %f)",
                     bullet_layout, c2i(xC), c2i(yC));
                 cr.move_to(leftC + p2c(bullet_leftP), topC);
-                bullet_layout.set_width(text_leftP - bullet_leftP);
-                bullet_layout.set_markup(bullet_markup, -1);
-                Pango.cairo_show_layout(cr, bullet_layout);
+                if(layout_cache != null) {
+                    Pango.cairo_show_layout(cr, layout_cache.get_text_layout(
+                            bullet_layout, text_leftP - bullet_leftP,
+                            bullet_layout.get_alignment(), bullet_text));
+                } else {
+                    bullet_layout.set_width(text_leftP - bullet_leftP);
+                    bullet_text.apply_to(bullet_layout);
+                    Pango.cairo_show_layout(cr, bullet_layout);
+                }
 
                 cr.move_to(leftC, yC);
                 ldebugo(this, "Rendered bullet - now at (%f, %f)", c2i(leftC), c2i(yC));
@@ -1253,6 +1337,16 @@ namespace My {
                 this.leftP = leftP;
             }
 
+            /** The rule has no text, so nothing to shape */
+            public override bool get_layout_spec(double leftC, int rightP,
+                out Pango.Layout proto, out int widthP, out StyledText text)
+            {
+                proto = layout;
+                widthP = 0;
+                text = content;
+                return false;
+            }
+
             /**
              * Render the rule
              *
@@ -1283,13 +1377,15 @@ namespace My {
                 }
 
                 // render the rule
-                cr.save();
-                cr.set_source_rgb(0,0,0);
-                cr.set_line_width(0.75);     // pt, I think
-                cr.move_to(leftC + p2c(leftP), yC + heightC*0.5);
-                cr.line_to(p2c(rightP), yC + heightC*0.5);
-                cr.stroke();
-                cr.restore();
+                if(!measuring) {
+                    cr.save();
+                    cr.set_source_rgb(0,0,0);
+                    cr.set_line_width(0.75);     // pt, I think
+                    cr.move_to(leftC + p2c(leftP), yC + heightC*0.5);
+                    cr.line_to(p2c(rightP), yC + heightC*0.5);
+                    cr.stroke();
+                    cr.restore();
+                }
 
                 // move 12 pts. down.  TODO make the vertical size a parameter.
                 cr.move_to(leftC, yC + heightC);
@@ -1321,7 +1417,14 @@ namespace My {
 
             public override bool is_void()
             {
-                return (get_whole_markup() == "");
+                return content.is_empty();
+            }
+
+            public override bool get_layout_spec(double leftC, int rightP,
+                out Pango.Layout proto, out int widthP, out StyledText text)
+            {
+                return base.get_layout_spec(leftC + p2c(text_leftP), rightP,
+                           out proto, out widthP, out text);
             }
 
             /**
@@ -1330,7 +1433,7 @@ namespace My {
             public override RenderResult render(Cairo.Context cr,
                 int rightP, int bottomP)
             {
-                if(get_whole_markup() == "") {
+                if(content.is_empty()) {
                     return RenderResult.COMPLETE;
                 }
 
@@ -1347,7 +1450,7 @@ namespace My {
                     return RenderResult.ERROR;
                 }
 
-                // Try to render the markup
+                // Try to render the text
                 cr.move_to(x1C + p2c(text_leftP), y1C);
                 var result = render_layout(cr, layout, rightP, bottomP);
                 if(result != COMPLETE) {        // TODO use result.rendered()?
@@ -1357,15 +1460,17 @@ namespace My {
                 cr.get_current_point(out x2C, out y2C);
 
                 // render the sidebar
-                double xsC = x1C + p2c(text_leftP)*0.5;
-                llogo(this, "sidebar (%f, %f->%f)", xsC, y1C, y2C);
-                cr.save();
-                cr.set_source_rgb(0.7,0.7,0.7);
-                cr.set_line_width(6.0);
-                cr.move_to(xsC, y1C);
-                cr.line_to(xsC, y2C);
-                cr.stroke();
-                cr.restore();
+                if(!measuring) {
+                    double xsC = x1C + p2c(text_leftP)*0.5;
+                    llogo(this, "sidebar (%f, %f->%f)", xsC, y1C, y2C);
+                    cr.save();
+                    cr.set_source_rgb(0.7,0.7,0.7);
+                    cr.set_line_width(6.0);
+                    cr.move_to(xsC, y1C);
+                    cr.line_to(xsC, y2C);
+                    cr.stroke();
+                    cr.restore();
+                }
 
                 cr.move_to(x1C, y2C);
 
@@ -1402,7 +1507,17 @@ namespace My {
 
             public override bool is_void()
             {
-                return (get_whole_markup() == "");
+                return content.is_empty();
+            }
+
+            public override bool get_layout_spec(double leftC, int rightP,
+                out Pango.Layout proto, out int widthP, out StyledText text)
+            {
+                // Same offsets as render()
+                return base.get_layout_spec(
+                           (leftC + p2c(block_leftP)) + p2c(padding_widthP),
+                           rightP - padding_widthP,
+                           out proto, out widthP, out text);
             }
 
             /**
@@ -1411,7 +1526,7 @@ namespace My {
             public override RenderResult render(Cairo.Context cr,
                 int rightP, int bottomP)
             {
-                if(get_whole_markup() == "") {
+                if(content.is_empty()) {
                     return RenderResult.COMPLETE;
                 }
 
@@ -1430,9 +1545,19 @@ namespace My {
                     return RenderResult.ERROR;
                 }
 
-                // Try to render the markup.
+                // Try to render the text.
                 // Shift to add the top and left margins.
                 cr.move_to(leftC + p2c(padding_widthP), y1C + p2c(padding_widthP));
+                if(measuring) {     // Only find out where the block ends
+                    var measured = render_layout(cr, layout,
+                            rightP - padding_widthP, bottomP);
+                    if(measured.rendered()) {
+                        cr.get_current_point(out x2C, out y2C);
+                        cr.move_to(x1C, y2C + p2c(padding_widthP));
+                    }
+                    return measured;
+                }
+
                 cr.push_group();
                 var result = render_layout(cr, layout,
                         rightP - padding_widthP,                    // right margin
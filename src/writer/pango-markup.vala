@@ -55,14 +55,17 @@ namespace My {
     /**
      * Pango-markup document writer.
      *
-     * Write a document by generating Pango markup for it.
-     * Can write the Pango markup or the PDF.
+     * Write a document by laying it out with Pango and rendering it to
+     * a PDF.
      *
-     * Caution: an instance of this class can only handle one source document.
-     * Functions herein use instance data to store state and so are not
-     * necessarily reentrant.
+     * As a BlockSink, it can also render a document one top-level block
+     * at a time, so the whole document need not be in memory at once.
+     *
+     * Caution: an instance of this class can only handle one source document
+     * at a time.  Functions herein use instance data to store state and so
+     * are not necessarily reentrant.
      */
-    public class PangoMarkupWriter : Object, Writer {
+    public class PangoMarkupWriter : Object, Writer, BlockSink {
         /** Metadata for this class */
         [Description(nick = "default", blurb = "Write PDFs using the Pango rendering library")]
         public bool meta {get; default = false; }
@@ -86,9 +89,72 @@ namespace My {
         /** The Pango layout for the */
         Pango.Layout pageno_layout_ = null;
 
+        /**
+         * Shaped layouts for reuse.
+         *
+         * This lasts across documents written by this instance.  All PDF
+         * surfaces have the same transform and font options, so layouts
+         * made for one can be shown on another.
+         */
+        private LayoutCache layout_cache = new LayoutCache();
+
+        /**
+         * Get the layout cache, e.g., for its statistics.
+         *
+         * Not a property so it won't be listed as an option.
+         */
+        public unowned LayoutCache get_layout_cache()
+        {
+            return layout_cache;
+        }
+
         /** Current page */
         private int pageno_;
 
+        /** How many pages the last document written had */
+        private int npages_ = 0;
+
+        /** How many pages have been output in the current document */
+        private int npages_output_ = 0;
+
+        /**
+         * The PDF's context while pages before `firstpage` are being
+         * paginated, or null.  Meanwhile, `cr_` is a scratch context.
+         */
+        private Cairo.Context pdf_cr_ = null;
+
+        /** True once page `lastpage` has been output */
+        private bool past_last_page_ = false;
+
+        /**
+         * If true, each page is drawn on its own Cairo.RecordingSurface.
+         * When the page is done, it is replayed onto the PDF and passed
+         * to page_recorded().  Set by subclasses before writing.
+         */
+        protected bool record_pages_ = false;
+
+        /**
+         * The PDF's own context when recording pages, or null.
+         * Meanwhile, `cr_` draws on the current page's recording surface.
+         */
+        private Cairo.Context surf_cr_ = null;
+
+        /** Whether the PDF is being written anywhere */
+        private bool has_pdf_output_ = false;
+
+        /**
+         * Get the number of pages in the document most recently written.
+         *
+         * If only some pages were requested (`firstpage` and `lastpage`),
+         * this is the number of pages output.
+         *
+         * Not a property so it won't be listed as an option.
+         */
+        public int get_page_count()
+        {
+            return npages_;
+        }
+
         /** True if this block is the first on the current page */
         private bool first_on_page_;
 
@@ -145,8 +211,15 @@ namespace My {
         [Description(nick = "Paragraph skip (in.)", blurb = "Space between paragraphs, in inches")]
         public double parskipI { get; set; default = 12.0/72.0; }
 
-        /** Used in process_node_into() */
-        private Regex re_newline = null;
+        // Output range
+        [Description(nick = "First page", blurb = "First page to output (1 = the beginning).  Earlier pages are paginated but not drawn.")]
+        public int firstpage { get; set; default = 1; }
+        [Description(nick = "Last page", blurb = "Last page to output (0 = the end).  Rendering stops after this page.")]
+        public int lastpage { get; set; default = 0; }
+
+        // Performance parameters
+        [Description(nick = "Layout threads", blurb = "How many threads to use for laying out text (0 = one per processor; 1 = lay out while paginating)")]
+        public uint layoutthreads { get; set; default = 0; }
 
         /**
          * Regex for recognizing pfft commands.
@@ -161,6 +234,8 @@ namespace My {
          *
          * Currently supported placeholders are:
          * * `%p`: page number
+         * * `%P`: total number of pages.  Using this makes the writer
+         *   paginate the document twice; see measure_pages().
          * * `%%`: a literal percent sign
          */
         private Regex re_hf_placeholder = null;
@@ -169,9 +244,8 @@ namespace My {
         // https://gitlab.gnome.org/GNOME/vala/-/issues/650
         construct {
             try {
-                re_newline = new Regex("\\R+");
                 re_command = new Regex("^pfft:\\s*(\\w+)");
-                re_hf_placeholder = new Regex("%(?<which>[p%])(?!\\w)");
+                re_hf_placeholder = new Regex("%(?<which>[pP%])(?!\\w)");
                 // can't use \b in place of the negative lookahead because
                 // \b doesn't match between two non-word chars
             } catch(RegexError e) { // LCOV_EXCL_START
@@ -182,40 +256,350 @@ namespace My {
 
         /**
          * Write a document to a file.
-         * @param filename  The name of the file to write
+         * @param filename  The name of the file to write, or "-" for stdout
          * @param doc       The document to write
          * @param sourcefn  The filename of the source that @doc came from.
          * TODO make paper size a parameter
          */
         public void write_document(string filename, Doc doc, string? sourcefn = null)
         throws FileError, My.Error
+        {
+            var tree = get_checked_tree(doc);
+            begin_document(filename, sourcefn);
+            write_tree(tree);
+        } // write_document()
+
+        /**
+         * Write a document to a stream.
+         *
+         * The PDF is written to @stream as it is produced, and @stream is
+         * flushed after each page.  @stream is not closed.
+         *
+         * Other parameters are as write_document().
+         */
+        public void write_document_to_stream(OutputStream stream, Doc doc,
+            string? sourcefn = null)
+        throws FileError, My.Error
+        {
+            var tree = get_checked_tree(doc);
+            begin_document_to_stream(stream, sourcefn);
+            write_tree(tree);
+        } // write_document_to_stream()
+
+        /** Write the document in @tree, once the document has been begun */
+        private void write_tree(DocTree tree) throws FileError, My.Error
+        {
+            // Make all the blocks before rendering any, so that they can
+            // be laid out in parallel.
+            for(int kid = tree.first_child(0); kid != DocTree.NONE;
+                kid = tree.next_sibling(kid)) {
+                process_top_level(tree, kid);
+            }
+            finish_blocks();
+
+            if(uses_total_pages()) {
+                total_pages_ = measure_pages(committed_);
+            }
+            end_document();
+        } // write_tree()
+
+        /**
+         * Count the pages a document would have, without writing it.
+         *
+         * This paginates the document but does not draw anything or write
+         * a PDF, so is faster than write_document().  Afterwards,
+         * get_page_count() also returns the count.
+         *
+         * Parameters are as write_document().
+         * @return The number of pages
+         */
+        public int count_pages(Doc doc, string? sourcefn = null)
+        throws My.Error
+        {
+            var tree = get_checked_tree(doc);
+
+            begin_surface(null, null, sourcefn);
+            begin_blocks();
+            for(int kid = tree.first_child(0); kid != DocTree.NONE;
+                kid = tree.next_sibling(kid)) {
+                process_top_level(tree, kid);
+            }
+            finish_blocks();
+
+            npages_ = measure_pages(committed_);
+            surf_.finish();     // nothing was drawn, so there is nothing to write
+            release_document();
+            return npages_;
+        } // count_pages()
+
+        /** Whether any header or footer uses the total page count */
+        private bool uses_total_pages()
+        {
+            foreach(var hf in new string[] { headerl, headerc, headerr,
+                                             footerl, footerc, footerr }) {
+                if(hf != null && hf.contains("%P")) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // === Pagination without drawing =================================
+
+        /**
+         * True while measure_pages() is running.
+         *
+         * Blocks are rendered onto a context where nothing is kept, and
+         * pages are counted but not output.
+         */
+        private bool measuring_ = false;
+
+        /** The total number of pages, for %P, or 0 if not known */
+        private int total_pages_ = 0;
+
+        /**
+         * Paginate some blocks without drawing them.
+         *
+         * The blocks are rendered onto a 1x1 image surface, so Cairo
+         * discards the drawing almost immediately.  Their layouts are still
+         * made with the PDF's Pango context, so the line breaks and page
+         * breaks are the same as when the blocks are drawn for real.  The
+         * layouts are kept (in the blocks and the layout cache) so the
+         * drawing pass does not have to shape them again.
+         *
+         * The blocks are not consumed.  Rendering state is reset
+         * afterwards, ready for the drawing pass.
+         *
+         * @param blks  The blocks, in order
+         * @return The number of pages
+         */
+        private int measure_pages(Gee.Collection<Blk> blks)
+        {
+            var t = Stats.start();
+            var real_cr = cr_;
+
+            measuring_ = true;
+            cr_ = new_scratch_context();
+            start_first_page();
+
+            var it = blks.iterator();
+            bool more = it.next();
+            while(more) {
+                var batch = new LinkedList<Blk>();
+                while(more && batch.size < SHAPE_BATCH_SIZE) {
+                    batch.add(it.get());
+                    more = it.next();
+                }
+                render_batch(batch);
+            }
+            eject_page();
+            var retval = pageno_ - 1;
+
+            measuring_ = false;
+            cr_ = real_cr;
+            start_first_page();
+
+            Stats.stop("paginate", t);
+            linfoo(this, "Measured %d pages", retval);
+            return retval;
+        } // measure_pages()
+
+        // === Incremental writing (BlockSink) ============================
+
+        /** The surface we are writing to, between begin_ and end_document() */
+        private Cairo.PdfSurface surf_ = null;
+
+        /** Right edge of the text block, in Pango units */
+        private int rightP_;
+
+        /** Bottom edge of the text block, in Pango units */
+        private int bottomP_;
+
+        /** The last block rendered */
+        private Blk prev_blk_ = null;
+
+        /**
+         * Lays out blocks ahead of time, or null if layoutthreads == 1.
+         * Kept from one document to the next.
+         */
+        private LayoutShaper shaper_ = null;
+
+        /**
+         * How many blocks to lay out ahead of time at once.
+         *
+         * This limits how many layouts are in memory at once.
+         */
+        private const int SHAPE_BATCH_SIZE = 256;
+
+        /** Don't bother laying out ahead of time for fewer blocks than this */
+        private const int SHAPE_BATCH_MIN = 8;
+
+        /**
+         * Start writing a document.
+         *
+         * Creates the PDF.  Follow with calls to add_block() and
+         * end_document().  write_document() does all of this for you.
+         *
+         * @param filename  The file to write, or "-" for stdout
+         * @param sourcefn  As for write_document()
+         */
+        public virtual void begin_document(string filename, string? sourcefn = null)
+        throws FileError, My.Error
+        {
+            begin_surface(filename, null, sourcefn);
+            begin_rendering();
+        } // begin_document()
+
+        /**
+         * Start writing a document to a stream.
+         *
+         * As begin_document(), but the PDF is written to @stream as it is
+         * produced.  @stream is flushed after each page, but not closed.
+         */
+        public void begin_document_to_stream(OutputStream stream,
+            string? sourcefn = null)
+        throws FileError, My.Error
+        {
+            begin_surface(null, stream, sourcefn);
+            begin_rendering();
+        } // begin_document_to_stream()
+
+        /** Common code for begin_document*() */
+        protected void begin_rendering()
+        {
+            total_pages_ = 0;
+
+            // Must be done after `layout_` is created.
+            begin_blocks();
+
+            linfoo(this, "Beginning rendering");
+        } // begin_rendering()
+
+        // === Output =====================================================
+
+        /** How many bytes of PDF to buffer before writing them to a stream */
+        private const size_t STREAM_BUFFER_SIZE = 64*1024;
+
+        /** Where the PDF is going, if not to a file or stdout */
+        private OutputStream out_stream_ = null;
+
+        /** True if the PDF is going to stdout */
+        private bool to_stdout_ = false;
+
+        /** The PDF file being written, if any */
+        private string? out_filename_ = null;
+
+        /** The first error writing to out_stream_, if any */
+        private GLib.Error out_error_ = null;
+
+        /**
+         * Write a chunk of the PDF to out_stream_ or stdout.
+         *
+         * Called by Cairo.  Once a write fails, Cairo stops writing.
+         */
+        private Cairo.Status write_to_stream(uchar[] data)
+        {
+            if(out_error_ != null) {    // e.g., abort_document()
+                return Cairo.Status.WRITE_ERROR;
+            }
+
+            if(to_stdout_) {
+                if(stdout.write((uint8[])data) != data.length) {
+                    out_error_ = new FileError.IO("Could not write to stdout");
+                    return Cairo.Status.WRITE_ERROR;
+                }
+                return Cairo.Status.SUCCESS;
+            }
+
+            try {
+                size_t written;
+                out_stream_.write_all((uint8[])data, out written);
+                return Cairo.Status.SUCCESS;
+            } catch(GLib.Error e) {
+                out_error_ = e;
+                return Cairo.Status.WRITE_ERROR;
+            }
+        }
+
+        /** Push what has been written so far out of the buffer */
+        private void flush_stream()
+        {
+            if((out_stream_ == null && !to_stdout_) || out_error_ != null) {
+                return;
+            }
+            var t = Stats.start();
+            try {
+                if(to_stdout_) {
+                    stdout.flush();
+                } else {
+                    out_stream_.flush();
+                }
+            } catch(GLib.Error e) {
+                out_error_ = e;
+            }
+            Stats.stop("pdf.flush", t);
+        }
+
+        /**
+         * Create the PDF surface and everything that depends on it.
+         * @param filename  The file to write, "-" for stdout, or null for
+         *                  no file
+         * @param stream    The stream to write, or null for no stream.
+         *                  If both are null, nothing is output.
+         * @param sourcefn  As for write_document()
+         */
+        protected void begin_surface(string? filename, OutputStream? stream,
+            string? sourcefn)
+        throws My.Error
         {
             source_fn_ = (sourcefn == null) ? "" : sourcefn;
 
-            int rightP = i2p(lmarginI+hsizeI);
-            int bottomP = i2p(tmarginI+vsizeI);
+            if(lastpage > 0 && lastpage < firstpage) {
+                throw new Error.WRITER("Invalid page range %d-%d".printf(
+                        firstpage, lastpage));
+            }
+
+            rightP_ = i2p(lmarginI+hsizeI);
+            bottomP_ = i2p(tmarginI+vsizeI);
 
             // Set up the drawing space
-            var surf = new Cairo.PdfSurface(filename, i2c(paperwidthI), i2c(paperheightI));
+            Cairo.PdfSurface surf;
+            out_error_ = null;
+            out_stream_ = null;
+            to_stdout_ = (stream == null && filename == "-");
+            if(stream != null || to_stdout_) {
+                if(stream != null) {
+                    out_stream_ = new BufferedOutputStream.sized(stream, STREAM_BUFFER_SIZE);
+                    ((FilterOutputStream)out_stream_).close_base_stream = false;
+                }
+                surf = new Cairo.PdfSurface.for_stream(write_to_stream,
+                    i2c(paperwidthI), i2c(paperheightI));
+            } else {
+                surf = new Cairo.PdfSurface(filename, i2c(paperwidthI), i2c(paperheightI));
+            }
+            out_filename_ = (stream == null && !to_stdout_) ? filename : null;
             if(surf.status() != Cairo.Status.SUCCESS) {
                 throw new Error.WRITER("Could not create surface: " +
                           surf.status().to_string());
             }
+            surf_ = surf;
 
             // Prepare to render
-            cr_ = new Cairo.Context(surf);
+            cr_ = new Cairo.Context(surf_);
             layout_ = Blocks.new_layout(cr_, fontname, fontsizeT, paragraphalign,
                     justify);                     // Layout for the copy
             bullet_layout_ = Blocks.new_layout(cr_, fontname, fontsizeT);
 
             pageno_layout_ = Blocks.new_layout(cr_, fontname, fontsizeT); // Layout for page numbers
 
-            cr_.move_to(i2c(lmarginI), i2c(tmarginI));
-            // over, down (respectively) from the UL corner
-
-            // Break the text into individually-rendered blocks.
-            // Must be done after `layout_` is created.
-            var blocks = make_blocks(doc);
+            // The layouts always come from the PDF, so the metrics are the
+            // same whether or not pages are recorded.
+            has_pdf_output_ = (filename != null || stream != null);
+            surf_cr_ = null;
+            if(record_pages_) {
+                surf_cr_ = cr_;
+                cr_ = new_page_recording();
+            }
 
 #if 0
             // DEBUG - check the type of font
@@ -226,92 +610,328 @@ namespace My {
             }
 #endif
 
-            // Render
-            pageno_ = 1;
-            first_on_page_ = true;
-            Blk prev_blk = null;
+            npages_output_ = 0;
+            past_last_page_ = false;
+            pdf_cr_ = null;
+            start_first_page();
+            if(firstpage > 1) {
+                pdf_cr_ = cr_;
+                cr_ = new_scratch_context();
+                start_first_page();
+            }
 
-            linfoo(this, "Beginning rendering");
-            foreach(var blk in blocks) {
-                if(blk.is_void()) {
-                    llogo(blk, "skipping void block");
-                    continue;
+            // Keep the shaper, and its threads and font maps, between
+            // documents if possible
+            if(layoutthreads == 1) {
+                shaper_ = null;
+            } else {
+                var font_options = new Cairo.FontOptions();
+                surf_.get_font_options(font_options);
+                if(shaper_ == null || !shaper_.matches(layoutthreads, font_options)) {
+                    shaper_ = new LayoutShaper(layoutthreads, font_options);
                 }
+            }
+        } // begin_surface()
 
-                ldebugo(blk, "start render");
-                while(true) {   // Render this block, which may take more than one pass
-                    // Parameters to render() are page-relative
-                    if(surf.status() != Cairo.Status.SUCCESS) {
-                        lerroro(blk, "Surface status: %s", surf.status().to_string());  // LCOV_EXCL_LINE because I can't force this to happen
-                    }
-
-                    // Parskip
+        /**
+         * Make a context that discards what is drawn on it.
+         *
+         * Layouts made for the PDF surface can be rendered on this context
+         * to paginate them without drawing them.
+         */
+        private static Cairo.Context new_scratch_context()
+        {
+            return new Cairo.Context(new Cairo.ImageSurface(Cairo.Format.ARGB32, 1, 1));
+        }
 
-                    llogo(blk, "parskip check: %s; %s; %s; %s",
-                        first_on_page_ ? "first on page" : "not first on page",
-                        prev_blk != null ? "has prev blk" : "no prev blk",
-                        blk.parskip_category.to_string(),
-                        (prev_blk != null && prev_blk.parskip_category != blk.parskip_category) ?
-                        "differs from prevblk category" : "no prev, or same as prev category"
-                    );
+        /** Make a context that draws on a new page-sized recording surface */
+        private Cairo.Context new_page_recording()
+        {
+            var extents = Cairo.Rectangle() {
+                x = 0, y = 0, width = i2c(paperwidthI), height = i2c(paperheightI)
+            };
+            return new Cairo.Context(new Cairo.RecordingSurface(
+                    Cairo.Content.COLOR_ALPHA, extents));
+        }
 
-                    if(!first_on_page_ && prev_blk != null &&
-                        ( blk.parskip_category == COPY ||
-                        blk.parskip_category == HEADER ||
-                        prev_blk.parskip_category != blk.parskip_category)
-                    ) {
-                        llogo(blk, "Applying parskip %f in.", parskipI);
-                        cr_.rel_move_to(0, i2c(parskipI));
-                    }
+        /**
+         * Called with each page output, if `record_pages_` is set.
+         *
+         * The page has already been replayed onto the PDF, if any, and
+         * will not be drawn on again, so @page can be used from another
+         * thread once this returns.
+         *
+         * @param pageno    The page number in the document
+         * @param page      The page
+         */
+        protected virtual void page_recorded(int pageno, Cairo.RecordingSurface page)
+        {
+        }
 
-                    // Render
+        /** Reset the rendering state to the top of the first page */
+        private void start_first_page()
+        {
+            pageno_ = 1;
+            first_on_page_ = true;
+            prev_blk_ = null;
+            cr_.new_path();
+            cr_.move_to(i2c(lmarginI), i2c(tmarginI));
+            // over, down (respectively) from the UL corner
+        }
 
-                    var ok = blk.render(cr_, rightP, bottomP);
-                    if(ok == COMPLETE || ok == PARTIAL) {
-                        first_on_page_ = false;
-                    }
+        /**
+         * Lay out and render one top-level node.
+         *
+         * Blocks are rendered, and pages are output, as soon as they are
+         * complete.  Once rendered, blocks are freed.
+         */
+        public void add_block(DocTree tree, int idx) throws My.Error
+        {
+            if(surf_ == null) {
+                throw new Error.WRITER("add_block() called before begin_document()");
+            }
 
-                    if(ok == RenderResult.COMPLETE) {
-                        break;  // Move on to the next block
-                    } else if(ok == RenderResult.ERROR) {
-                        lerroro(blk, "render returned %s", ok.to_string());
-                        assert(false);  // TODO improve this
-                    }
+            process_top_level(tree, idx);
+            render_committed();
+        }
 
-                    // We got PARTIAL or NONE, so we need to start a new page.
-                    eject_page();
-                }
-                ldebugo(blk, "end render");
+        /** Finish the document and save the PDF */
+        public virtual void end_document() throws FileError, My.Error
+        {
+            if(surf_ == null) {
+                throw new Error.WRITER("end_document() called before begin_document()");
+            }
 
-                prev_blk = blk;
-            } // foreack blk
+            if(pending_blk_ != null) {  // not already done by write_document()
+                finish_blocks();
+            }
+            render_committed();
 
-            // We only eject in the loop above when a block demands it.
+            // We only eject in render_blk() when a block demands it.
             // Therefore, there should always be a page to eject here,
             // even if there were no blocks.
-            eject_page();
+            if(!past_last_page_) {
+                eject_page();
+            }
+            npages_ = npages_output_;
+            var npaginated = pageno_ - 1;   // eject_page() moved to the next page
 
             // Save the PDF
-            surf.finish();
-            if(surf.status() != Cairo.Status.SUCCESS) {
+            var t = Stats.start();
+            surf_.finish();
+            Stats.stop("pdf.finish", t);
+            flush_stream();
+            var status = surf_.status();
+            var out_error = (owned)out_error_;
+
+            release_document();
+
+            if(out_error != null) {
+                throw new Error.WRITER("Could not write PDF: " + out_error.message);
+            }
+            if(status != Cairo.Status.SUCCESS) {
                 // LCOV_EXCL_START because I can't force this to happen
                 throw new Error.WRITER("Could not save PDF: " +
-                          surf.status().to_string());
+                          status.to_string());
                 // LCOV_EXCL_STOP
             }
-            linfoo(this, "Done rendering");
+            if(npages_ == 0) {
+                throw new Error.WRITER(
+                    "No pages to output: the document has %d page(s), but firstpage is %d".printf(
+                        npaginated, firstpage));
+            }
+            linfoo(this, "Done rendering.  Layout cache: %u hits, %u misses",
+                layout_cache.hits, layout_cache.misses);
+        } // end_document()
 
-        } // write_document()
+        /**
+         * Stop writing the document without saving it.
+         *
+         * See BlockSink.abort_document().  The PDF file, if any, is
+         * removed.  Nothing more is written to a stream or stdout.
+         */
+        public virtual void abort_document()
+        {
+            if(surf_ == null) {
+                return;
+            }
+            linfoo(this, "Aborting document");
+
+            // Cairo writes out what it has when the surface is finished.
+            // Make write_to_stream() refuse it.
+            if(out_error_ == null) {
+                out_error_ = new IOError.CANCELLED("Document aborted");
+            }
+            surf_.finish();
+            if(out_filename_ != null) {
+                FileUtils.unlink(out_filename_);
+            }
+
+            pending_blk_ = null;
+            release_document();
+        } // abort_document()
+
+        /** Release the resources used while writing a document */
+        private void release_document()
+        {
+            prev_blk_ = null;
+            committed_ = null;
+            layout_ = null;
+            bullet_layout_ = null;
+            pageno_layout_ = null;
+            cr_ = null;
+            pdf_cr_ = null;
+            surf_cr_ = null;
+            has_pdf_output_ = false;
+            surf_ = null;
+            out_stream_ = null;     // after surf_, which may write to it
+            to_stdout_ = false;
+            out_filename_ = null;
+            out_error_ = null;
+            total_pages_ = 0;
+        }
+
+        /**
+         * Render, then release, all the blocks that have been committed.
+         *
+         * The blocks are rendered a batch at a time.  See render_batch().
+         */
+        private void render_committed()
+        {
+            while(!committed_.is_empty) {
+                var batch = new LinkedList<Blk>();
+                while(batch.size < SHAPE_BATCH_SIZE && !committed_.is_empty) {
+                    batch.add(committed_.poll_head());
+                }
+                render_batch(batch);
+            }
+        } // render_committed()
+
+        /**
+         * Render some blocks in order.
+         *
+         * If there are enough blocks, they are first laid out in parallel
+         * (see LayoutShaper).
+         */
+        private void render_batch(LinkedList<Blk> batch)
+        {
+            if(past_last_page_ && !measuring_) {
+                return;     // don't bother shaping blocks that won't be drawn
+            }
+
+            if(shaper_ != null && batch.size >= SHAPE_BATCH_MIN) {
+                var t = Stats.start();
+                shaper_.shape(batch, i2c(lmarginI), rightP_);
+                Stats.stop("layout.parallel", t);
+            }
+
+            foreach(var blk in batch) {
+                render_blk(blk);
+            }
+        } // render_batch()
+
+        /** Render one block, starting new pages as necessary */
+        private void render_blk(Blk blk)
+        {
+            if(past_last_page_ && !measuring_) {
+                return;     // The rest of the document was not requested
+            }
+
+            if(blk.is_void()) {
+                llogo(blk, "skipping void block");
+                return;
+            }
+
+            ldebugo(blk, "start render");
+            while(true) {   // Render this block, which may take more than one pass
+                // Parameters to render() are page-relative
+                if(surf_.status() != Cairo.Status.SUCCESS) {
+                    lerroro(blk, "Surface status: %s", surf_.status().to_string());  // LCOV_EXCL_LINE because I can't force this to happen
+                }
+
+                // Parskip
+
+                if(lenabled(LOG)) {
+                    llogo(blk, "parskip check: %s; %s; %s; %s",
+                        first_on_page_ ? "first on page" : "not first on page",
+                        prev_blk_ != null ? "has prev blk" : "no prev blk",
+                        blk.parskip_category.to_string(),
+                        (prev_blk_ != null && prev_blk_.parskip_category != blk.parskip_category) ?
+                        "differs from prevblk category" : "no prev, or same as prev category"
+                    );
+                }
+
+                if(!first_on_page_ && prev_blk_ != null &&
+                    ( blk.parskip_category == COPY ||
+                    blk.parskip_category == HEADER ||
+                    prev_blk_.parskip_category != blk.parskip_category)
+                ) {
+                    llogo(blk, "Applying parskip %f in.", parskipI);
+                    cr_.rel_move_to(0, i2c(parskipI));
+                }
+
+                // Render
+
+                var t = Stats.start();
+                blk.measuring = measuring_ || (pdf_cr_ != null);
+                var ok = blk.render(cr_, rightP_, bottomP_);
+                if(Stats.enabled) {
+                    Stats.stop((blk.measuring ? "measure." : "render.") +
+                        blk.get_type().name(), t);
+                }
+                if(ok == COMPLETE || ok == PARTIAL) {
+                    first_on_page_ = false;
+                }
+
+                if(ok == RenderResult.COMPLETE) {
+                    break;  // Move on to the next block
+                } else if(ok == RenderResult.ERROR) {
+                    lerroro(blk, "render returned %s", ok.to_string());
+                    assert(false);  // TODO improve this
+                }
+
+                // We got PARTIAL or NONE, so we need to start a new page.
+                eject_page();
+                if(past_last_page_ && !measuring_) {
+                    return;
+                }
+            }
+            ldebugo(blk, "end render");
+
+            prev_blk_ = blk;
+        } // render_blk()
 
         /** Finish the current page and write it out */
         void eject_page()
         {
             linfoo(this, "Finalizing page %d", pageno_);
-            render_headers_footers();
-            cr_.show_page();
+            if(!measuring_ && pdf_cr_ == null) {
+                var t = Stats.start();
+                render_headers_footers();
+                Stats.stop("page.headers_footers", t);
+
+                t = Stats.start();
+                show_page();
+                Stats.stop("page.show", t);
+                flush_stream();     // so readers can start on this page
+                Stats.count("pages");
+
+                // Images on the page we just emitted can now be dropped
+                Shape.ImageCache.get_default().trim();
+
+                ++npages_output_;
+                if(lastpage > 0 && pageno_ >= lastpage) {
+                    past_last_page_ = true;
+                }
+            }
 
             // Start the next page
             ++pageno_;
+            if(!measuring_ && pdf_cr_ != null && pageno_ >= firstpage) {
+                // Done skipping --- draw on the PDF from now on
+                cr_ = pdf_cr_;
+                pdf_cr_ = null;
+            }
             first_on_page_ = true;
             cr_.new_path();
             cr_.move_to(i2c(lmarginI), i2c(tmarginI));
@@ -323,6 +943,29 @@ namespace My {
 
         } // eject_page()
 
+        /**
+         * Output the page drawn on `cr_`.
+         *
+         * If pages are being recorded, replays the recording onto the PDF
+         * and starts recording a new page.
+         */
+        private void show_page()
+        {
+            if(surf_cr_ == null) {
+                cr_.show_page();
+                return;
+            }
+
+            var page = (Cairo.RecordingSurface)cr_.get_target();
+            if(has_pdf_output_) {
+                surf_cr_.set_source_surface(page, 0, 0);
+                surf_cr_.paint();
+                surf_cr_.show_page();
+            }
+            page_recorded(pageno_, page);
+            cr_ = new_page_recording();
+        } // show_page()
+
         /** render the page header(s)/footer(s) on the page we just finished */
         private void render_headers_footers()
         {
@@ -361,6 +1004,10 @@ namespace My {
                     result.append(pageno_.to_string());
                     ok = true;
                     break;
+                case "P":   // only known if the document was measured first
+                    result.append(total_pages_ > 0 ? total_pages_.to_string() : "?");
+                    ok = true;
+                    break;
                 case "%":
                     result.append("%");
                     ok = true;
@@ -415,28 +1062,30 @@ namespace My {
             m2 = @"<span size=\"small\">$m2</span>";
 
             ltraceo(this, "HF %s: Rendering", ident);
-            pageno_layout_.set_width(widthP);
-            pageno_layout_.set_alignment(align);
-            pageno_layout_.set_markup(m2, -1);
+            // Headers and footers usually repeat, so use the cache
+            var layout = layout_cache.get_layout(pageno_layout_, widthP, align, m2);
             cr_.move_to(i2c(leftI), i2c(topI));
-            Pango.cairo_show_layout(cr_, pageno_layout_);
+            Pango.cairo_show_layout(cr_, layout);
             ltraceo(this, "HF %s: Done", ident);
         }
 
         ///////////////////////////////////////////////////////////////////
-        // Generate blocks of markup from a Doc.
+        // Generate blocks of styled text from a Doc.
         // The methods in this section assume cr_ and layout_ members are valid
 
-        /** Markup for header levels */
-        private string[] header_attributes = {
-            "", // level 0
-            "size=\"xx-large\" font_weight=\"bold\"",
-            "size=\"x-large\" font_weight=\"bold\"",
-            "size=\"large\" font_weight=\"bold\"",
-            "size=\"large\" font_weight=\"bold\" font_style=\"italic\"",
-            "font_weight=\"bold\"",
-            "font_weight=\"bold\" font_style=\"italic\"",
-        };
+        /** Styles for each header level */
+        private static TextStyle[] header_styles(uint level)
+        {
+            switch(level) {
+            case 1: return { TextStyle.XX_LARGE, TextStyle.BOLD };
+            case 2: return { TextStyle.X_LARGE, TextStyle.BOLD };
+            case 3: return { TextStyle.LARGE, TextStyle.BOLD };
+            case 4: return { TextStyle.LARGE, TextStyle.BOLD, TextStyle.ITALIC };
+            case 5: return { TextStyle.BOLD };
+            case 6: return { TextStyle.BOLD, TextStyle.ITALIC };
+            default: return {};
+            }
+        }
 
         // === Bulleted/numbered list support =============================
 
@@ -469,133 +1118,304 @@ namespace My {
             return defns[level];
         }
 
+        /**
+         * The deepest list level that is indented further than its parent.
+         *
+         * At this level, numbered lists are indented 4.5", which leaves
+         * room for text on a letter- or A4-size page.
+         */
+        private const int MAX_INDENT_LEVEL = 8;
+
+        /** One level of list indentation */
+        private struct Level {
+            IndentType indent_type;
+
+            /** The last number used in this level, or 0 if none */
+            uint last_number;
+
+            /** Left margin of content, in Pango units */
+            int content_lmarginP;
+
+            /** Left margin of bullets/numbers, in Pango units */
+            int bullet_lmarginP;
+        }
+
         /**
          * The rendering state.
          *
-         * TODO move the per-level items into a helper class, and add a
-         * current_level accessor.
+         * Each list pushes a level when it starts and pops it when it ends,
+         * so the state is shared by all the nodes instead of being copied
+         * for each list.
          */
         private class State {
-            /** Do not change \n to ' ' if true */
-            public bool obeylines = false;
-
             /**
              * Indentation levels.
              *
-             * An array used as a stack.  Levels are numbered from 0,
-             * so the last used level is levels.length-1.
+             * An array used as a stack.  Only the first nlevels are in use,
+             * so the last used level is nlevels-1.  The array is not shrunk
+             * when levels are popped, so it can be reused.
              */
-            public IndentType[] levels = {};
+            public Level[] levels = {};
 
-            /**
-             * The last number used in each level, or 0 if none.
-             */
-            public uint[] last_numbers = {};
+            /** The number of levels in use */
+            public int nlevels = 0;
 
-            /**
-             * Left margins of content, in Pango units.
-             *
-             * The left margin of content in each level, or 0 if none.
-             */
-            public int[] content_lmarginsP = {};
-
-            /**
-             * Left margins of bullets/numbers, in Pango units.
-             *
-             * The left margin of the bullet/number in each level, or 0 if none.
-             */
-            public int[] bullet_lmarginsP = {};
+            public void push(Level level)
+            {
+                if(nlevels == levels.length) {
+                    levels += level;
+                } else {
+                    levels[nlevels] = level;
+                }
+                ++nlevels;
+            }
 
-            public State clone() {
-                var retval = new State();
-                retval.obeylines = obeylines;
-                retval.levels = levels;     // duplicates the array
-                retval.last_numbers = last_numbers;
-                retval.content_lmarginsP = content_lmarginsP;
-                retval.bullet_lmarginsP = bullet_lmarginsP;
-                return retval;
+            public void pop()
+            {
+                --nlevels;
             }
         } // class State
 
+        /**
+         * What to do when leaving a node whose children are being processed.
+         *
+         * process_node_into() keeps a stack of these instead of recursing.
+         */
+        private class Frame {
+            /** The node */
+            public int idx;
+
+            /** If true, nothing more to do before committing the block */
+            public bool complete;
+
+            /** The block with a run to end after the children, or null */
+            public Blk span_blk;
+
+            /** The run in span_blk */
+            public int span;
+
+            /** A processing command (```pfft:foo ...```), or "" */
+            public string cmd;
+
+            /** Whether to trim trailing whitespace after the children */
+            public bool trim_trailing_whitespace;
+
+            /** Whether the node pushed a level onto the State */
+            public bool pushed_level;
+        }
+
+        /**
+         * The stack used by process_node_into().
+         *
+         * Frames are reused, so this only grows to the depth of the
+         * deepest document.
+         */
+        private Frame[] frames_ = {};
+
         // === Algorithm ==================================================
 
         /**
-         * Make Pango markup blocks for a document
+         * Make blocks for a document, without writing anything.
+         *
+         * Sets up a scratch surface and layouts, then runs make_blocks().
+         * This is public only so it can be tested.
          */
-        private LinkedList<Blk> make_blocks(Doc doc) throws Error
+        public LinkedList<Blk> make_blocks_standalone(Doc doc) throws Error
         {
-            if(doc.root == null) {
+            var surf = new Cairo.ImageSurface(Cairo.Format.ARGB32, 1, 1);
+            cr_ = new Cairo.Context(surf);
+            layout_ = Blocks.new_layout(cr_, fontname, fontsizeT, paragraphalign,
+                    justify);
+            bullet_layout_ = Blocks.new_layout(cr_, fontname, fontsizeT);
+            pageno_layout_ = Blocks.new_layout(cr_, fontname, fontsizeT);
+            return make_blocks(doc);
+        }
+
+        /**
+         * Get the tree for @doc, checking that it is valid.
+         */
+        private DocTree get_checked_tree(Doc doc) throws Error
+        {
+            var tree = doc.get_tree();
+            if(tree == null) {
                 throw new Error.WRITER("No document to write!");
             }
 
-            var el = doc.root.data;
-            if(el == null || el.ty != ROOT) {
+            if(tree.get_ty(0) != ROOT) {
                 throw new Error.WRITER(
-                          "Document doesn't start with a ROOT node (%s)".printf(doc.root.data.ty.to_string()));
+                          "Document doesn't start with a ROOT node (%s)".printf(tree.get_ty(0).to_string()));
             }
+            return tree;
+        }
 
-            var retval = new LinkedList<Blk>();
-            var state = new State();
-
-            // Open a Blk that will be filled if the first thing in the Doc is copy
-            var first_blk = new ParaBlk(layout_);
+        /**
+         * Make blocks for a document
+         */
+        private LinkedList<Blk> make_blocks(Doc doc) throws Error
+        {
+            var tree = get_checked_tree(doc);
 
-            // Fill the list
-            var last_blk = process_node_into(doc.root, el, (owned)first_blk, retval, state);
-            commit(last_blk, retval);
+            begin_blocks();
+            for(int kid = tree.first_child(0); kid != DocTree.NONE;
+                kid = tree.next_sibling(kid)) {
+                process_top_level(tree, kid);
+            }
+            finish_blocks();
 
+            var retval = (owned)committed_;
+            committed_ = null;
             return retval;
         } // make_blocks()
 
+        /** The rendering state for top-level nodes */
+        private State top_state_ = null;
+
+        /** The block being built, which may span several top-level nodes */
+        private Blk pending_blk_ = null;
+
+        /** Blocks that are complete but have not been rendered */
+        private LinkedList<Blk> committed_ = null;
+
+        /** The block most recently added to committed_ */
+        private Blk last_committed_ = null;
+
+        /** Prepare to make blocks.  Called once per document. */
+        private void begin_blocks()
+        {
+            top_state_ = new State();
+            committed_ = new LinkedList<Blk>();
+            last_committed_ = null;
+
+            // Open a Blk that will be filled if the first thing in the Doc is copy
+            pending_blk_ = new ParaBlk(layout_);
+        }
+
+        /**
+         * Make blocks for a child of the root.
+         *
+         * This is the same as processing the root, one child at a time.
+         */
+        private void process_top_level(DocTree tree, int idx) throws Error
+        {
+            var t = Stats.start();
+            pending_blk_ = process_node_into(tree, idx, (owned)pending_blk_,
+                    committed_, top_state_);
+            Stats.stop("blocks", t);
+        }
+
+        /** Commit the block in progress, if any.  Called once per document. */
+        private void finish_blocks()
+        {
+            commit((owned)pending_blk_, committed_);
+            pending_blk_ = null;
+            top_state_ = null;
+            last_committed_ = null;
+        }
+
         /**
          * Add a block to the list of blocks to be rendered.
          * @param   blk     The block to add
          * @param   retval  The list to add blk to
          *
-         * If blk is not a duplicate of  the last-added block, this function
-         * adds blk to retval.
-         *
-         * This is in a separate function in case I later need to add more
-         * per-blk commit processing.
+         * If blk is not a duplicate of the last-added block, this function
+         * adds blk to retval.  The last-added block is tracked separately
+         * since retval may have been emptied by rendering.
          */
         private void commit(owned Blk blk, LinkedList<Blk> retval)
         {
-            if(!retval.is_empty && retval.last() == blk) return;
-            llogo(blk, "commit: adding blk with markup <%s> and post-markup <%s>",
-                blk.markup, blk.post_markup);
+            if(last_committed_ == blk) return;
+            if(Stats.enabled) {
+                Stats.count("blocks." + blk.get_type().name());
+            }
+            blk.layout_cache = layout_cache;
+            if(lenabled(LOG)) {
+                llogo(blk, "commit: adding blk with text <%s>", blk.content.text);
+            }
             retval.add(blk);
+            last_committed_ = blk;
         }
 
         /**
-         * Make Pango markup block(s) for a node
-         * @param node      The current node
-         * @param el        The element (convenience accessor for node.data)
+         * Make block(s) for a node and its descendants.
+         *
+         * Text is added to the blocks as it is, with styles applied as
+         * runs, so nothing needs to be escaped or parsed.
+         *
+         * The walk uses frames_ as an explicit stack rather than
+         * recursing, so deeply-nested documents cost heap, not C stack.
+         *
+         * @param tree      The document
+         * @param start     The node to process
          * @param blk       The current block being built
          * @param retval    The list to which a block should be appended
          *                  when complete.
+         * @param state     The indentation state.  Restored before return.
          * @return The block in progress
          */
-        private /* owned */ Blk process_node_into(GLib.Node<Elem> node, Elem el,
-            owned Blk blk, LinkedList<Blk> retval,
-            State state_in)
+        private /* owned */ Blk process_node_into(DocTree tree, int start,
+            owned Blk blk, LinkedList<Blk> retval, State state)
         throws Error
         {
-            bool complete = false;  // if true, nothing more to do before committing blk
-            string text_markup = Markup.escape_text(el.text);
-            string post_children_markup = "";   // markup to be added after the children are processed
-            string cmd = "";  // a processing command (```pfft:foo ...```), or ""
-            bool trim_trailing_whitespace = false;
-            StringBuilder sb = new StringBuilder();
+            int depth = 0;  // number of frames in use
+            int idx = start;
 
-            var state = state_in;
+            while(true) {
+                // Enter idx
+                if(depth == frames_.length) {
+                    frames_ += new Frame();
+                }
+                blk = enter_node(tree, idx, (owned)blk, retval, state,
+                        frames_[depth], depth);
+                ++depth;
+
+                // Find the next node to enter, leaving nodes that are done
+                idx = tree.first_child(idx);
+                while(idx == DocTree.NONE) {
+                    --depth;
+                    unowned Frame frame = frames_[depth];
+                    blk = leave_node((owned)blk, retval, state, frame);
+                    if(depth == 0) {
+                        return (owned)blk;
+                    }
+                    idx = tree.next_sibling(frame.idx);
+                }
+            }
+        } // process_node_into()
 
-            ldebugo(node, "process_node_into: %s%s = '%s'",
-                string.nfill(node.depth()*4, ' '), el.ty.to_string(),
-                text_markup);
+        /**
+         * Start processing a node, before its children.
+         *
+         * @param frame     Filled in with what leave_node() should do
+         * @param depth     The depth of @idx, for logging
+         * @return The block in progress
+         */
+        private /* owned */ Blk enter_node(DocTree tree, int idx,
+            owned Blk blk, LinkedList<Blk> retval, State state,
+            Frame frame, int depth)
+        throws Error
+        {
+            var ty = tree.get_ty(idx);
+            size_t text_len;
+            unowned string text = (string)tree.text_data(idx, out text_len);
+            var len = (ssize_t)text_len;
+
+            frame.idx = idx;
+            frame.complete = false;
+            frame.span_blk = null;
+            frame.span = -1;
+            frame.cmd = "";
+            frame.trim_trailing_whitespace = false;
+            frame.pushed_level = false;
+
+            if(lenabled(DEBUG)) {
+                ldebugo(this, "process_node_into: %s%s = '%s'",
+                    string.nfill(depth*4, ' '), ty.to_string(),
+                    tree.get_text(idx));
+            }
 
             // Reminder: parameters to Blk instances are relative to the
             // left margin.
-            switch(el.ty) {
+            switch(ty) {
             case ROOT:
                 // Nothing to do
                 break;
@@ -604,79 +1424,83 @@ namespace My {
             case BLOCK_HEADER:
                 commit(blk, retval);
                 blk = new ParaBlk(layout_, true);
-                sb.append_printf("<span %s>%s",
-                    header_attributes[el.header_level],
-                    text_markup);
-                blk.post_markup = "</span>";
-                complete = true;
+                foreach(var style in header_styles(tree.get_header_level(idx))) {
+                    blk.content.add_style(style);
+                }
+                blk.content.append(text, len);
+                frame.complete = true;
                 break;
 
             case BLOCK_COPY:
             case BLOCK_SPECIAL: // TODO treat BLOCK_SPECIAL differently
-                blk.markup += text_markup;
+                blk.content.append(text, len);
                 // Do not create a new blk here since there may be other
                 // nodes that have yet to contribute to blk.
-                complete = true;
+                frame.complete = true;
                 break;
 
             case BLOCK_QUOTE:
                 commit(blk, retval);
                 int marginP = i2p(0.5); // text is indented 0.5" past marker
-                if(state.levels.length > 0) {
-                    var lidx = state.levels.length - 1;
-                    marginP += state.content_lmarginsP[lidx];
+                if(state.nlevels > 0) {
+                    marginP += state.levels[state.nlevels - 1].content_lmarginP;
                 }
                 blk = new QuoteBlk(layout_, marginP);
-                sb.append(text_markup);
-                complete = true;
+                blk.content.append(text, len);
+                frame.complete = true;
                 break;
 
             case BLOCK_BULLET_LIST:     // Get the next indentation level
             case BLOCK_NUMBER_LIST:     // Likewise
-                complete = true;
-
-                // Copy the state so any changes are localized to this block and
-                // any children.
-                state = state.clone();
+                frame.complete = true;
 
-                // Add the indentation level
-                var is_bullet = el.ty == BLOCK_BULLET_LIST;
-                var indent_type = get_indent_type_for_level(state.levels.length,
-                        is_bullet);
-                state.levels += indent_type;
-                var lidx = state.levels.length - 1;
-                state.last_numbers += 0;
+                // Add the indentation level.  leave_node() removes it, so
+                // the change is localized to this block and any children.
+                var is_bullet = ty == BLOCK_BULLET_LIST;
+                var lidx = state.nlevels;
 
                 // TODO? change this?
+                // Lists nested more deeply than MAX_INDENT_LEVEL are not
+                // indented any further, so the text stays on the page.
                 int marginC = is_bullet ? 18 : 36;
-                state.content_lmarginsP += c2p((lidx+1)*marginC);
-                state.bullet_lmarginsP += c2p(lidx*marginC);
-                llogo(blk, "Now in lidx %d with indent type %s, bullet lmarg %f, content lmarg %f",
-                    lidx, indent_type.to_string(), p2i(state.bullet_lmarginsP[lidx]),
-                    p2i(state.content_lmarginsP[lidx]));
+                int indent_level = int.min(lidx, MAX_INDENT_LEVEL);
+                state.push(Level() {
+                    indent_type = get_indent_type_for_level(lidx, is_bullet),
+                    last_number = 0,
+                    content_lmarginP = c2p((indent_level+1)*marginC),
+                    bullet_lmarginP = c2p(indent_level*marginC)
+                });
+                frame.pushed_level = true;
+
+                if(lenabled(LOG)) {
+                    llogo(blk, "Now in lidx %d with indent type %s, bullet lmarg %f, content lmarg %f",
+                        lidx, state.levels[lidx].indent_type.to_string(),
+                        p2i(state.levels[lidx].bullet_lmarginP),
+                        p2i(state.levels[lidx].content_lmarginP));
+                }
                 break;
 
             case BLOCK_LIST_ITEM:
                 commit(blk, retval);
-                var lidx = state.levels.length - 1;
-                state.last_numbers[lidx]++;
+                var lidx = state.nlevels - 1;
+                state.levels[lidx].last_number++;
 
                 blk = new BulletBlk(layout_, bullet_layout_, "%s%s".printf(
-                            state.levels[lidx].render(state.last_numbers[lidx]),
-                            state.levels[lidx].is_bullet() ? "" : "."
+                            state.levels[lidx].indent_type.render(state.levels[lidx].last_number),
+                            state.levels[lidx].indent_type.is_bullet() ? "" : "."
                         ),
-                        state.bullet_lmarginsP[lidx],
-                        state.content_lmarginsP[lidx]
+                        state.levels[lidx].bullet_lmarginP,
+                        state.levels[lidx].content_lmarginP
                 );
-                sb.append(text_markup);
+                blk.content.append(text, len);
 
-                complete = true;
+                frame.complete = true;
                 break;
 
             case BLOCK_HR:
                 commit(blk, retval);
                 blk = new HRBlk(layout_, 0);
-                complete = true;
+                frame.complete = true;
                 // TODO figure out how to handle rules inside indented lists
                 break;
 
@@ -684,123 +1508,118 @@ namespace My {
                 commit(blk, retval);
 
                 int marginP = 0;
-                if(state.levels.length > 0) {
-                    var lidx = state.levels.length - 1;
-                    marginP = state.content_lmarginsP[lidx];
+                if(state.nlevels > 0) {
+                    marginP = state.levels[state.nlevels - 1].content_lmarginP;
                 }
                 blk = new CodeBlk(layout_, marginP, i2p(0.25));
 
-                state = state.clone();
-
                 MatchInfo matches;
-                if(re_command.match(el.info_string, 0, out matches)) {
+                if(re_command.match(tree.get_info_string(idx), 0, out matches)) {
                     // Not actually a code block --- a directive to pfft.
-                    cmd = matches.fetch(1);
-                    state.obeylines = false;
-                    sb.append_printf("%s ", text_markup);
-                    // Let the rest of the function run to collect the text
+                    frame.cmd = matches.fetch(1);
+                    blk.content.append(text, len);
+                    blk.content.append(" ");
+                    // Let the children contribute the text
                 } else {    // a normal code block
-                    state.obeylines = true;
-                    sb.append_printf("<tt>%s%s", text_markup,
-                        text_markup.length > 0 ? " " : "");
+                    blk.obeylines = true;
+                    blk.content.add_style(MONOSPACE);
                     // NOTE: does a code block ever have text of its own?
-                    blk.post_markup = "</tt>" + blk.post_markup;
+                    if(len > 0) {
+                        blk.content.append(text, len);
+                        blk.content.append(" ");
+                    }
                 }
-                trim_trailing_whitespace = true;    // trim trailing \n, if any
-                complete = true;
+                frame.trim_trailing_whitespace = true;  // trim trailing \n, if any
+                frame.complete = true;
                 break;
 
             // --- spans ----------------------------------------
             case SPAN_PLAIN:
-                sb.append(text_markup);
+                blk.content.append(text, len);
                 break;
             case SPAN_EM:
-                sb.append_printf("<span font_style=\"italic\">%s",
-                    text_markup);
-                post_children_markup = "</span>";
-                break;
             case SPAN_STRONG:
-                sb.append_printf("<span font_weight=\"bold\">%s",
-                    text_markup);
-                post_children_markup = "</span>";
-                break;
             case SPAN_CODE:
-                sb.append_printf("<tt>%s", text_markup);
-                post_children_markup = "</tt>";
-                break;
             case SPAN_STRIKE:
-                sb.append_printf("<s>%s", text_markup);
-                post_children_markup = "</s>";
-                break;
             case SPAN_UNDERLINE:
-                sb.append_printf("<u>%s", text_markup);
-                post_children_markup = "</u>";
+                frame.span_blk = blk;
+                frame.span = blk.content.begin_span(span_style(ty));
+                blk.content.append(text, len);
                 break;
             case SPAN_IMAGE:
-                sb.append(OBJ_REPL_CHAR());
-                var shape = new Shape.Image.from_href(el.href, source_fn_,
-                        el.info_string);
+                var shape = new Shape.Image.from_href(tree.get_href(idx), source_fn_,
+                        tree.get_info_string(idx));
                 blk.add_shape(shape);
                 break;
 
             // --------------------------------------------------
             default:
-                lwarningo(el, "Unknown elem type %s", el.ty.to_string());
+                lwarningo(this, "Unknown elem type %s", ty.to_string());
                 break;
             }
 
-            blk.markup += sb.str;
-            lmemdumpo(blk, "Markup after appending sb", blk.markup, blk.markup.length);
+            return (owned)blk;
+        } // enter_node()
 
-            // process children
-            for(uint i = 0; i < node.n_children(); ++i) {
-                unowned GLib.Node<Elem> child = node.nth_child(i);
-                var newblk = process_node_into(child, child.data, (owned)blk,
-                        retval, state);
-                blk = newblk;
+        /**
+         * Finish processing a node, after its children.
+         *
+         * @param frame     What enter_node() said to do
+         * @return The block in progress
+         */
+        private /* owned */ Blk leave_node(owned Blk blk,
+            LinkedList<Blk> retval, State state, Frame frame)
+        {
+            if(frame.span_blk != null) {
+                frame.span_blk.content.end_span(frame.span);
+                frame.span_blk = null;
             }
 
-            blk.markup += post_children_markup;
-            lmemdumpo(blk, "Markup after appending post_children_markup",
-                blk.markup, blk.markup.length);
-
-            // Join lines
-            if(!state.obeylines) {
-                try {
-                    blk.markup = re_newline.replace(blk.markup, -1, 0, " ");
-                } catch(RegexError e) {
-                    // ignore regex errors
-                }
+            if(frame.trim_trailing_whitespace) {
+                blk.content.chomp();
             }
 
-            if(trim_trailing_whitespace) {
-                blk.markup._chomp();
+            if(frame.pushed_level) {
+                state.pop();
             }
 
             // Respond to commands from special blocks
-            switch(cmd) {
+            switch(frame.cmd) {
             case "":
                 // not a command
                 break;
 
             case INFOSTR_NOP:   // Drop the block
                 blk = new ParaBlk(layout_);
-                complete = true;
+                frame.complete = true;
                 break;
 
             default:
-                lwarningo(this, "Ignoring unknown command '%s'", cmd);
+                lwarningo(this, "Ignoring unknown command '%s'", frame.cmd);
                 break;
             }
 
-            if(complete) {
-                // lmemdumpo(blk, "Block markup", blk.markup, blk.markup.length);
+            if(frame.complete) {
                 commit(blk, retval);
                 blk = new ParaBlk(layout_);
             }
 
             return (owned)blk;
-        }         // process_div_into
+        } // leave_node()
+
+        /** The style for a span element of type @ty */
+        private static TextStyle span_style(Elem.Type ty)
+        {
+            switch(ty) {
+            case SPAN_EM: return ITALIC;
+            case SPAN_STRONG: return BOLD;
+            case SPAN_CODE: return MONOSPACE;
+            case SPAN_STRIKE: return STRIKETHROUGH;
+            case SPAN_UNDERLINE:
+            default:
+                return UNDERLINE;
+            }
+        }
 
     }         // class PangoMarkupWriter
 }         // My
@@ -0,0 +1,274 @@
+// writer/png-writer.vala
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+using My.Log;
+
+namespace My {
+
+    /**
+     * Writes a PNG image of each page, and optionally the PDF.
+     *
+     * Pages are laid out and paginated exactly as PangoMarkupWriter does.
+     * Each page is drawn once, on a Cairo.RecordingSurface.  If the PDF
+     * is wanted, the recording is replayed onto it.  The recording is
+     * then rasterized on a worker thread while the next page is being
+     * laid out, so producing images costs only the rasterization.
+     *
+     * For output file `foo.pdf` (or `foo.png`), page N is written to
+     * `foo-NNN.png`, its thumbnail (if `thumbdpi` is set) to
+     * `foo-NNN-thumb.png`, and the PDF (if `pdf` is set) to `foo.pdf`.
+     * write_document_to_stream() writes only the PDF.
+     */
+    public class PngWriter : PangoMarkupWriter {
+        /** Metadata for this class */
+        [Description(blurb = "Write a PNG image of each page, and optionally a PDF")]
+        public new bool meta { get; default = false; }
+
+        [Description(nick = "Resolution (dpi)", blurb = "Resolution of the page images, in dots per inch")]
+        public double dpi { get; set; default = 150; }
+
+        [Description(nick = "Thumbnail resolution (dpi)", blurb = "Resolution of the thumbnails, in dots per inch; 0 for no thumbnails")]
+        public double thumbdpi { get; set; default = 0; }
+
+        [Description(nick = "Also write PDF", blurb = "If true, also write the PDF")]
+        public bool pdf { get; set; default = false; }
+
+        [Description(nick = "Raster threads", blurb = "How many threads to rasterize pages on (0 = one per processor; 1 with --jobs)")]
+        public uint rasterthreads { get; set; default = 0; }
+
+        /** One page's worth of work */
+        private class Job {
+            /** The page, or null to tell a worker to exit */
+            public Cairo.RecordingSurface? page;
+
+            public string filename;
+
+            /** Where the thumbnail goes, or null for none */
+            public string? thumb_filename;
+        }
+
+        /** Pages waiting to be rasterized */
+        private AsyncQueue<Job> queue_ = null;
+
+        /**
+         * How many pages are queued or being rasterized.
+         *
+         * Layout is faster than rasterizing, so page_recorded() waits when
+         * this reaches max_pending_.  That way, only a few recorded pages
+         * are held in memory at once.  Guarded by pending_lock_.
+         */
+        private uint npending_ = 0;
+
+        /** The limit on npending_ */
+        private uint max_pending_ = 0;
+
+        /** Guards npending_.  Zero-initialized, so needs no init. */
+        private Mutex pending_lock_;
+
+        /** Signaled when npending_ goes down */
+        private Cond pending_changed_;
+
+        /** The threads rasterizing pages */
+        private Thread<bool>[] workers_ = {};
+
+        /** Output filenames, without the extension */
+        private string png_base_ = null;
+
+        /** Guards raster_error_.  Zero-initialized, so needs no init. */
+        private Mutex error_lock_;
+
+        /** The first error writing a PNG, if any */
+        private string raster_error_ = null;
+
+        construct {
+            record_pages_ = true;
+        }
+
+        /**
+         * Start writing a document.
+         *
+         * @param filename  The output file.  Its extension is replaced
+         *                  to make the names of the files written.
+         * @param sourcefn  As for write_document()
+         */
+        public override void begin_document(string filename, string? sourcefn = null)
+        throws FileError, My.Error
+        {
+            if(filename == "-") {
+                throw new Error.WRITER("Cannot write PNGs to stdout");
+            }
+            if(dpi <= 0 || thumbdpi < 0) {
+                throw new Error.WRITER("Invalid resolution %f dpi (thumbnails %f dpi)".printf(
+                        dpi, thumbdpi));
+            }
+
+            png_base_ = filename;
+            foreach(var ext in new string[] { ".pdf", ".png" }) {
+                if(png_base_.down().has_suffix(ext)) {
+                    png_base_ = png_base_.substring(0, png_base_.length - ext.length);
+                    break;
+                }
+            }
+
+            begin_surface(pdf ? png_base_ + ".pdf" : null, null, sourcefn);
+            begin_rendering();
+            start_workers();
+        } // begin_document()
+
+        /**
+         * Finish the document.
+         *
+         * Waits until all the pages have been rasterized.
+         */
+        public override void end_document() throws FileError, My.Error
+        {
+            try {
+                base.end_document();
+            } finally {
+                stop_workers();
+                png_base_ = null;
+            }
+
+            var err = (owned)raster_error_;
+            if(err != null) {
+                throw new Error.WRITER(err);
+            }
+        } // end_document()
+
+        /**
+         * Stop writing the document.
+         *
+         * Pages already queued are still rasterized, so any PNGs that
+         * were written are complete.
+         */
+        public override void abort_document()
+        {
+            base.abort_document();
+            stop_workers();
+            png_base_ = null;
+            raster_error_ = null;
+        } // abort_document()
+
+        /**
+         * Queue a page to be rasterized.
+         *
+         * Waits if too many pages are already waiting.
+         */
+        protected override void page_recorded(int pageno, Cairo.RecordingSurface page)
+        {
+            if(png_base_ == null) {     // e.g., write_document_to_stream()
+                return;
+            }
+
+            var job = new Job();
+            job.page = page;
+            job.filename = "%s-%03d.png".printf(png_base_, pageno);
+            job.thumb_filename = (thumbdpi > 0) ?
+                "%s-%03d-thumb.png".printf(png_base_, pageno) : null;
+
+            pending_lock_.lock();
+            if(npending_ >= max_pending_) {
+                var t = Stats.start();
+                while(npending_ >= max_pending_) {
+                    pending_changed_.wait(pending_lock_);
+                }
+                Stats.stop("raster.throttle", t);
+            }
+            ++npending_;
+            pending_lock_.unlock();
+
+            queue_.push(job);
+        }
+
+        // === Workers ====================================================
+
+        private void start_workers()
+        {
+            stop_workers();     // in case a previous document was not ended
+
+            raster_error_ = null;
+            queue_ = new AsyncQueue<Job>();
+            uint n = (rasterthreads > 0) ? rasterthreads : get_num_processors();
+            npending_ = 0;
+            max_pending_ = 2 * n;
+            ldebugo(this, "Rasterizing on %u threads", n);
+            for(uint i=0; i<n; ++i) {
+                workers_ += new Thread<bool>("pfft-raster-%u".printf(i), () => {
+                    rasterize_jobs();
+                    return true;
+                });
+            }
+        }
+
+        /** Rasterize any queued pages, then stop the workers */
+        private void stop_workers()
+        {
+            if(workers_.length == 0) {
+                return;
+            }
+
+            var t = Stats.start();
+            for(int i=0; i<workers_.length; ++i) {
+                queue_.push(new Job());     // page == null: exit
+            }
+            foreach(var worker in workers_) {
+                worker.join();
+            }
+            Stats.stop("raster.wait", t);
+
+            workers_ = {};
+            queue_ = null;
+        }
+
+        /** Rasterize pages from queue_ until told to stop.  Runs in a worker. */
+        private void rasterize_jobs()
+        {
+            while(true) {
+                var job = queue_.pop();
+                if(job.page == null) {
+                    break;
+                }
+
+                var t = Stats.start();
+                rasterize(job.page, dpi, job.filename);
+                if(job.thumb_filename != null) {
+                    rasterize(job.page, thumbdpi, job.thumb_filename);
+                }
+                Stats.stop("raster", t);
+                Stats.count("pages.rasterized");
+
+                pending_lock_.lock();
+                --npending_;
+                pending_changed_.signal();
+                pending_lock_.unlock();
+            }
+        }
+
+        /** Write @page to PNG file @filename at @res dpi */
+        private void rasterize(Cairo.RecordingSurface page, double res, string filename)
+        {
+            double scale = res / i2c(1.0);  // Cairo units are points
+            int width = (int)Math.ceil(i2c(paperwidthI) * scale);
+            int height = (int)Math.ceil(i2c(paperheightI) * scale);
+
+            var surf = new Cairo.ImageSurface(Cairo.Format.RGB24, width, height);
+            var cr = new Cairo.Context(surf);
+            cr.set_source_rgb(1, 1, 1);     // the paper
+            cr.paint();
+            cr.scale(scale, scale);
+            cr.set_source_surface(page, 0, 0);
+            cr.paint();
+
+            var status = surf.write_to_png(filename);
+            if(status != Cairo.Status.SUCCESS) {
+                error_lock_.lock();
+                if(raster_error_ == null) {
+                    raster_error_ = "Could not write %s: %s".printf(filename,
+                            status.to_string());
+                }
+                error_lock_.unlock();
+            }
+        } // rasterize()
+    } // class PngWriter
+} // My
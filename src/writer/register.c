@@ -10,5 +10,6 @@
 
 REGISTRAR_BEGIN(writers) {
     REGISTER("pdf", MY_TYPE_PANGO_MARKUP_WRITER);
+    REGISTER("png", MY_TYPE_PNG_WRITER);
     REGISTER("dumper", MY_TYPE_TREE_DUMPER_WRITER);
 } REGISTRAR_END
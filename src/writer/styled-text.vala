@@ -0,0 +1,349 @@
+// writer/styled-text.vala
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+using My.Log;
+
+namespace My.Blocks {
+
+    /** The offset of the first byte in @buf that may start a line break */
+    [CCode (cname = "pfft_find_line_break", cheader_filename = "text-scan.h")]
+    private extern size_t find_line_break(char *buf, size_t len);
+
+    [CCode (cname = "pfft_line_break_scanner", cheader_filename = "text-scan.h")]
+    private extern unowned string line_break_scanner();
+
+    /** Styles that can be applied to a run of StyledText */
+    public enum TextStyle {
+        ITALIC,
+        BOLD,
+        MONOSPACE,
+        STRIKETHROUGH,
+        UNDERLINE,
+        /** Pango's "large" size */
+        LARGE,
+        /** Pango's "x-large" size */
+        X_LARGE,
+        /** Pango's "xx-large" size */
+        XX_LARGE;
+
+        /** Make the Pango attribute for this style */
+        public Pango.Attribute to_attribute()
+        {
+            switch(this) {
+            case ITALIC:
+                return Pango.attr_style_new(Pango.Style.ITALIC);
+            case BOLD:
+                return Pango.attr_weight_new(Pango.Weight.BOLD);
+            case MONOSPACE:
+                return Pango.attr_family_new("Monospace");  // as <tt>
+            case STRIKETHROUGH:
+                return Pango.attr_strikethrough_new(true);
+            case UNDERLINE:
+                return Pango.attr_underline_new(Pango.Underline.SINGLE);
+            case LARGE:
+                return Pango.attr_scale_new(Pango.Scale.LARGE);
+            case X_LARGE:
+                return Pango.attr_scale_new(Pango.Scale.X_LARGE);
+            case XX_LARGE:
+            default:
+                return Pango.attr_scale_new(Pango.Scale.XX_LARGE);
+            }
+        }
+    } // enum TextStyle
+
+    /**
+     * Text plus the styles that apply to it, ready to give to a Pango layout.
+     *
+     * Blocks build their content as plain UTF-8 text with styled runs,
+     * rather than as Pango markup.  This saves escaping the text, then
+     * having Pango parse the markup back into text and attributes.
+     *
+     * A StyledText can also hold Pango markup, e.g., from a template.
+     * The markup is parsed when a layout is made from it.
+     *
+     * Offsets are in bytes.
+     */
+    public class StyledText : Object {
+        /** The text, if not holding markup */
+        private StringBuilder text_sb = new StringBuilder();
+
+        /** The markup, if holding markup */
+        private string markup_ = null;
+
+        /** A run of text with a style */
+        private struct Span {
+            TextStyle style;
+            uint start;
+            /**
+             * Exclusive.  uint.MAX means the end of the text, as
+             * PANGO_ATTR_INDEX_TO_TEXT_END.
+             */
+            uint end;
+        }
+
+        /** The styled runs, in the order they were started */
+        private Span[] spans_ = {};
+
+        /** Cached attribute list, or null */
+        private Pango.AttrList attrs_ = null;
+
+        /** Cached key, or null */
+        private string key_ = null;
+
+        /**
+         * If false, each run of line breaks appended is replaced with one
+         * space.  Line breaks are the same as PCRE's `\R`: CR, LF, VT,
+         * FF, NEL, LS, and PS.
+         */
+        public bool obeylines { get; set; default = false; }
+
+        /** Whether the text ends with a space that replaced line breaks */
+        private bool joining_ = false;
+
+        public StyledText()
+        {
+        }
+
+        /** Hold Pango markup rather than text */
+        public StyledText.from_markup(string markup)
+        {
+            markup_ = markup;
+        }
+
+        /** The text.  Empty for a StyledText holding markup. */
+        public string text { get { return text_sb.str; } }
+
+        /** Length of the text, in bytes.  0 for markup. */
+        public size_t length { get { return text_sb.len; } }
+
+        /** Whether there is no text */
+        public bool is_empty()
+        {
+            return (markup_ == null) ? (text_sb.len == 0) : (markup_ == "");
+        }
+
+        /** Forget cached values after a change */
+        private void changed()
+        {
+            attrs_ = null;
+            key_ = null;
+        }
+
+        // Building {{{1
+
+        /**
+         * Append text.  Amortized O(length of @more).
+         * @param more  The text to append
+         * @param len   Its length in bytes, or -1 if it is nul-terminated
+         */
+        public void append(string more, ssize_t len = -1)
+        {
+            size_t n = (len < 0) ? more.length : (size_t)len;
+            if(n == 0) {
+                return;
+            }
+            changed();
+
+            if(obeylines) {
+                text_sb.append_len(more, (ssize_t)n);
+                joining_ = false;
+                return;
+            }
+
+            // Copy runs of non-breaks, and replace each run of breaks with
+            // a single space.  find_line_break() skips quickly to the next
+            // byte that might start a break.
+            char *buf = (char *)more;
+            size_t rd = 0, copy_from = 0;
+            while(true) {
+                rd += find_line_break(buf + rd, n - rd);
+                if(rd >= n) {
+                    break;
+                }
+
+                size_t brk = line_break_length(buf, rd, n);
+                if(brk == 0) {
+                    ++rd;
+                    continue;
+                }
+
+                if(rd > copy_from) {
+                    text_sb.append_len((string)(buf + copy_from),
+                        (ssize_t)(rd - copy_from));
+                    joining_ = false;
+                }
+                if(!joining_) {
+                    text_sb.append_c(' ');
+                    joining_ = true;
+                }
+                rd += brk;
+                copy_from = rd;
+            }
+
+            if(n > copy_from) {
+                text_sb.append_len((string)(buf + copy_from),
+                    (ssize_t)(n - copy_from));
+                joining_ = false;
+            }
+        } // append()
+
+        /**
+         * Which line-break scanner append() uses: "avx2", "sse2", or
+         * "scalar".  For benchmarks.
+         */
+        public static unowned string get_scanner()
+        {
+            return line_break_scanner();
+        }
+
+        /** Append text, keeping any line breaks regardless of obeylines */
+        public void append_verbatim(string more)
+        {
+            changed();
+            text_sb.append(more);
+            joining_ = false;
+        }
+
+        /**
+         * How many bytes of line break start at @buf[@idx].
+         *
+         * @return The number of bytes, or 0 if there is no line break there
+         */
+        private static size_t line_break_length(char *buf, size_t idx, size_t len)
+        {
+            uint8 c = (uint8)buf[idx];
+            if(c == '\n' || c == '\v' || c == '\f' || c == '\r') {
+                return 1;   // CRLF is two line breaks, which join the same way
+            }
+            if(c == 0xc2 && idx+1 < len && (uint8)buf[idx+1] == 0x85) {
+                return 2;   // U+0085 NEL
+            }
+            if(c == 0xe2 && idx+2 < len && (uint8)buf[idx+1] == 0x80 &&
+                ((uint8)buf[idx+2] == 0xa8 || (uint8)buf[idx+2] == 0xa9)) {
+                return 3;   // U+2028 LS, U+2029 PS
+            }
+            return 0;
+        }
+
+        /** Remove trailing whitespace from the text */
+        public void chomp()
+        {
+            unowned string str = text_sb.str;
+            size_t len = text_sb.len;
+            while(len > 0 && str[(long)len-1].isspace()) {
+                --len;
+            }
+            if(len == text_sb.len) {
+                return;
+            }
+
+            changed();
+            text_sb.truncate(len);
+            joining_ = false;
+            for(int i=0; i<spans_.length; ++i) {
+                if(spans_[i].end != uint.MAX && spans_[i].end > len) {
+                    spans_[i].end = (uint)len;
+                }
+                if(spans_[i].start > len) {
+                    spans_[i].start = (uint)len;
+                }
+            }
+        } // chomp()
+
+        /**
+         * Start a styled run at the end of the current text.
+         * @return A handle to pass to end_span()
+         */
+        public int begin_span(TextStyle style)
+        {
+            changed();
+            spans_ += Span() { style = style, start = (uint)text_sb.len, end = uint.MAX };
+            return spans_.length - 1;
+        }
+
+        /** End the run @span started by begin_span() at the end of the text */
+        public void end_span(int span)
+        {
+            changed();
+            spans_[span].end = (uint)text_sb.len;
+        }
+
+        /** Apply @style to the whole text, including text appended later */
+        public void add_style(TextStyle style)
+        {
+            changed();
+            spans_ += Span() { style = style, start = 0, end = uint.MAX };
+        }
+
+        // }}}1
+        // Using {{{1
+
+        /**
+         * Get the attributes for the text.
+         *
+         * The caller must not modify the returned list.  Returns null for
+         * a StyledText holding markup.
+         */
+        public unowned Pango.AttrList? get_attrs()
+        {
+            if(markup_ != null) {
+                return null;
+            }
+            if(attrs_ == null) {
+                attrs_ = new Pango.AttrList();
+                foreach(var span in spans_) {
+                    if(span.start >= span.end) {
+                        continue;
+                    }
+                    var attr = span.style.to_attribute();
+                    attr.start_index = span.start;
+                    attr.end_index = span.end;
+                    attrs_.insert((owned)attr);
+                }
+            }
+            return attrs_;
+        }
+
+        /**
+         * A string identifying the text and its styles.
+         *
+         * Two StyledTexts with the same key lay out the same way.
+         */
+        public unowned string get_key()
+        {
+            if(key_ == null) {
+                if(markup_ != null) {
+                    key_ = "m" + markup_;
+                } else {
+                    var sb = new StringBuilder.sized(text_sb.len + 16*spans_.length + 2);
+                    sb.append_c('t');
+                    foreach(var span in spans_) {
+                        sb.append_printf("%d:%u-%u,", (int)span.style, span.start,
+                            span.end);
+                    }
+                    sb.append_c('\x1e');
+                    sb.append_len(text_sb.str, (ssize_t)text_sb.len);
+                    key_ = sb.str;
+                }
+            }
+            return key_;
+        }
+
+        /** Set the text and attributes of @layout */
+        public void apply_to(Pango.Layout layout)
+        {
+            if(markup_ != null) {
+                layout.set_attributes(null);
+                layout.set_markup(markup_, -1);
+            } else {
+                layout.set_text(text_sb.str, (int)text_sb.len);
+                layout.set_attributes(get_attrs());
+            }
+        }
+
+        // }}}1
+    } // class StyledText
+} // My.Blocks
+
+// vi: set fdm=marker: //
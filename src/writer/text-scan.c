@@ -0,0 +1,127 @@
+// src/writer/text-scan.c: fast scanning of text runs
+//
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+//
+// Most text has no line breaks, or long runs between them, so
+// StyledText.append() spends most of its time looking for the next one.
+// This looks at 16 or 32 bytes at a time where the CPU supports it.
+// SSE2 is used whenever the compiler targets it (all x86-64 CPUs).  AVX2
+// is chosen at run time, so it is used without compiling for AVX2.
+
+#include "text-scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    defined(__SSE2__)
+#define PFFT_HAVE_SSE2 1
+#include <emmintrin.h>
+#if __GNUC__ >= 5 || defined(__clang__)
+#define PFFT_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+/** Whether @c may start a line break */
+static inline gboolean is_candidate(guint8 c)
+{
+    return (guint8)(c - 0x0a) < 4 || c == 0xc2 || c == 0xe2;
+}
+
+static gsize find_scalar(const gchar *buf, gsize len)
+{
+    for(gsize i = 0; i < len; ++i) {
+        if(is_candidate((guint8)buf[i])) {
+            return i;
+        }
+    }
+    return len;
+}
+
+#ifdef PFFT_HAVE_SSE2
+static gsize find_sse2(const gchar *buf, gsize len)
+{
+    const __m128i lf = _mm_set1_epi8(0x0a);
+    const __m128i three = _mm_set1_epi8(3);
+    const __m128i c2 = _mm_set1_epi8((char)0xc2);
+    const __m128i e2 = _mm_set1_epi8((char)0xe2);
+
+    gsize i = 0;
+    for(; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        // LF, VT, FF, CR are 0x0a-0x0d: (v - 0x0a) <= 3, unsigned
+        __m128i d = _mm_sub_epi8(v, lf);
+        __m128i m = _mm_cmpeq_epi8(_mm_min_epu8(d, three), d);
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, c2));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, e2));
+        unsigned mask = (unsigned)_mm_movemask_epi8(m);
+        if(mask != 0) {
+            return i + (gsize)__builtin_ctz(mask);
+        }
+    }
+    return i + find_scalar(buf + i, len - i);
+}
+#endif /* PFFT_HAVE_SSE2 */
+
+#ifdef PFFT_HAVE_AVX2
+__attribute__((target("avx2")))
+static gsize find_avx2(const gchar *buf, gsize len)
+{
+    const __m256i lf = _mm256_set1_epi8(0x0a);
+    const __m256i three = _mm256_set1_epi8(3);
+    const __m256i c2 = _mm256_set1_epi8((char)0xc2);
+    const __m256i e2 = _mm256_set1_epi8((char)0xe2);
+
+    gsize i = 0;
+    for(; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i d = _mm256_sub_epi8(v, lf);
+        __m256i m = _mm256_cmpeq_epi8(_mm256_min_epu8(d, three), d);
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, c2));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, e2));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        if(mask != 0) {
+            return i + (gsize)__builtin_ctz(mask);
+        }
+    }
+    return i + find_sse2(buf + i, len - i);
+}
+#endif /* PFFT_HAVE_AVX2 */
+
+typedef gsize (*FindFunc)(const gchar *buf, gsize len);
+
+/** The implementation to use, chosen on first use */
+static FindFunc find_impl = NULL;
+static const gchar *find_impl_name = NULL;
+
+static void choose_impl(void)
+{
+    static gsize chosen = 0;
+    if(g_once_init_enter(&chosen)) {
+        find_impl = find_scalar;
+        find_impl_name = "scalar";
+#ifdef PFFT_HAVE_SSE2
+        find_impl = find_sse2;
+        find_impl_name = "sse2";
+#endif
+#ifdef PFFT_HAVE_AVX2
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2")) {
+            find_impl = find_avx2;
+            find_impl_name = "avx2";
+        }
+#endif
+        g_once_init_leave(&chosen, 1);
+    }
+}
+
+gsize pfft_find_line_break(const gchar *buf, gsize len)
+{
+    choose_impl();
+    return find_impl(buf, len);
+}
+
+const gchar *pfft_line_break_scanner(void)
+{
+    choose_impl();
+    return find_impl_name;
+}
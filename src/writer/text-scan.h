@@ -0,0 +1,31 @@
+// src/writer/text-scan.h: fast scanning of text runs
+//
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef TEXT_SCAN_H_
+#define TEXT_SCAN_H_
+
+#include <glib.h>
+
+/**
+ * Find the first byte that may start a line break.
+ * @buf: the text
+ * @len: its length in bytes
+ *
+ * Finds the first CR, LF, VT, or FF, or the first lead byte of
+ * U+0085 NEL (0xC2) or U+2028/U+2029 (0xE2).  The caller checks whether
+ * a lead byte actually starts a line break.
+ *
+ * Returns: the offset of the byte, or @len if there is none
+ */
+gsize pfft_find_line_break(const gchar *buf, gsize len);
+
+/**
+ * Which implementation pfft_find_line_break() uses.
+ *
+ * Returns: (transfer none): "avx2", "sse2", or "scalar"
+ */
+const gchar *pfft_line_break_scanner(void);
+
+#endif /* TEXT_SCAN_H_ */
@@ -16,11 +16,55 @@ void test_diag()
     assert_true(s == "# 1\n# 2\n");
 }
 
+void test_deserialize_value()
+{
+    var v = Value(typeof(string));
+    assert_true(deserialize_value(ref v, "Hello, world"));
+    assert_true(v.get_string() == "Hello, world");
+    assert_true(deserialize_value(ref v, "\"tab\\there\""));
+    assert_true(v.get_string() == "tab\there");
+
+    v = Value(typeof(bool));
+    assert_true(deserialize_value(ref v, "yes") && v.get_boolean());
+    assert_true(deserialize_value(ref v, "FALSE") && !v.get_boolean());
+    assert_true(deserialize_value(ref v, " 1 ") && v.get_boolean());
+    assert_true(!deserialize_value(ref v, "maybe"));
+
+    v = Value(typeof(int));
+    assert_true(deserialize_value(ref v, "42") && v.get_int() == 42);
+    assert_true(deserialize_value(ref v, "-0x10") && v.get_int() == -16);
+    assert_true(deserialize_value(ref v, "-2147483648") && v.get_int() == int.MIN);
+    assert_true(!deserialize_value(ref v, "2147483648"));
+    assert_true(!deserialize_value(ref v, "4.2"));
+    assert_true(!deserialize_value(ref v, ""));
+
+    v = Value(typeof(uint));
+    assert_true(deserialize_value(ref v, "4294967295") && v.get_uint() == uint.MAX);
+    assert_true(!deserialize_value(ref v, "-1"));
+
+    v = Value(typeof(double));
+    assert_true(deserialize_value(ref v, "2.5") && v.get_double() == 2.5);
+    assert_true(deserialize_value(ref v, "-1e3") && v.get_double() == -1000);
+    assert_true(!deserialize_value(ref v, "not a number"));
+    assert_true(!deserialize_value(ref v, ""));
+
+    v = Value(typeof(My.Alignment));
+    assert_true(deserialize_value(ref v, "right") &&
+        v.get_enum() == My.Alignment.RIGHT);
+    assert_true(deserialize_value(ref v, "MY_ALIGNMENT_CENTER") &&
+        v.get_enum() == My.Alignment.CENTER);
+    assert_true(!deserialize_value(ref v, "sideways"));
+
+    v = Value(typeof(Object));
+    assert_true(!deserialize_value(ref v, "anything"));
+}
+
 public static int main (string[] args)
 {
     Test.init (ref args);
     Test.set_nonfatal_assertions();
     Test.add_func("/010-core-util/diag", test_diag);
+    Test.add_func("/010-core-util/deserialize_value", test_deserialize_value);
 
     return Test.run();
 }
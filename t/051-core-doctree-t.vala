@@ -0,0 +1,260 @@
+// 051-core-doctree.vala - tests of src/core/doctree.vala
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+using My;
+using My.Cmp;
+
+/** Source text for the trees below */
+const string SOURCE = "Hello, world!";
+
+/**
+ * Make ROOT > COPY > (PLAIN "Hello", PLAIN "world"), HR
+ */
+private DocTree new_tree()
+{
+    var tree = new DocTree(new Bytes(SOURCE.data));
+    var para = tree.append_child(0, BLOCK_COPY);
+    unowned uint8[] src = tree.source.get_data();
+
+    var idx = tree.append_child(para, SPAN_PLAIN);
+    tree.set_text_from(idx, (char *)src, 5);
+    idx = tree.append_child(para, SPAN_PLAIN);
+    tree.set_text_from(idx, ((char *)src) + 7, 5);
+
+    idx = tree.append_child(0, BLOCK_HR);
+    tree.set_info_string(idx, "info");  // not in the source, so copied
+    return tree;
+}
+
+void test_build()
+{
+    var tree = new_tree();
+    assert_cmpint(tree.size, EQ, 5);
+    assert_true(tree.get_ty(0) == ROOT);
+    assert_cmpint(tree.parent(0), EQ, DocTree.NONE);
+
+    var para = tree.first_child(0);
+    assert_true(tree.get_ty(para) == BLOCK_COPY);
+    assert_cmpint(tree.parent(para), EQ, 0);
+    assert_cmpuint(tree.depth(para), EQ, 1);
+
+    var kid = tree.first_child(para);
+    assert_cmpstr(tree.get_text(kid), EQ, "Hello");
+    kid = tree.next_sibling(kid);
+    assert_cmpstr(tree.get_text(kid), EQ, "world");
+    assert_cmpint(tree.next_sibling(kid), EQ, DocTree.NONE);
+    assert_cmpint(tree.last_child(para), EQ, kid);
+    assert_cmpuint(tree.depth(kid), EQ, 2);
+
+    // Text sliced from the source is not copied
+    size_t len;
+    char *data = tree.text_data(kid, out len);
+    unowned uint8[] src = tree.source.get_data();
+    assert_true(data == ((char *)src) + 7);
+    assert_cmpuint(len, EQ, 5);
+
+    var hr = tree.next_sibling(para);
+    assert_true(tree.get_ty(hr) == BLOCK_HR);
+    assert_cmpstr(tree.get_info_string(hr), EQ, "info");
+    assert_cmpstr(tree.get_text(hr), EQ, "");
+    assert_cmpstr(tree.get_href(hr), EQ, "");
+
+    tree.remove_children(para);
+    assert_cmpint(tree.first_child(para), EQ, DocTree.NONE);
+}
+
+void test_preorder()
+{
+    var tree = new_tree();
+    var sb = new StringBuilder();
+    tree.foreach_preorder(0, (t, idx, depth)=>{
+        sb.append_printf("%u%s ", depth, t.get_ty(idx).to_string());
+        return false;
+    });
+    assert_cmpstr(sb.str, EQ,
+        "0MY_ELEM_TYPE_ROOT 1MY_ELEM_TYPE_BLOCK_COPY 2MY_ELEM_TYPE_SPAN_PLAIN " +
+        "2MY_ELEM_TYPE_SPAN_PLAIN 1MY_ELEM_TYPE_BLOCK_HR ");
+
+    // Stopping early
+    int count = 0;
+    var stopped = tree.foreach_preorder(0, (t, idx, depth)=>{
+        return (++count == 2);
+    });
+    assert_true(stopped);
+    assert_cmpint(count, EQ, 2);
+}
+
+void test_nodes_round_trip()
+{
+    var tree = new_tree();
+    var root = tree.to_nodes();
+    assert_cmpuint(root.n_children(), EQ, 2);
+    assert_cmpuint(root.first_child().n_children(), EQ, 2);
+    assert_cmpstr(root.first_child().last_child().data.text, EQ, "world");
+    assert_cmpstr(root.last_child().data.info_string, EQ, "info");
+
+    var tree2 = DocTree.from_nodes(root);
+    assert_cmpint(tree2.size, EQ, tree.size);
+    assert_cmpstr(tree2.as_string(), EQ, tree.as_string());
+
+    // Doc.as_string() is the same whichever representation backs the Doc
+    var doc = new Doc.from_tree(tree);
+    var str1 = doc.as_string();
+    assert_nonnull(doc.root);       // converts to a node tree
+    assert_cmpstr(doc.as_string(), EQ, str1);
+    assert_true(str1.has_prefix("Document:\nNode: type MY_ELEM_TYPE_ROOT"));
+}
+
+void test_copy_children()
+{
+    var tree = new_tree();
+    var dest = new DocTree();
+    var blk = dest.append_child(0, BLOCK_SPECIAL);
+    dest.copy_children_from(blk, tree, tree.first_child(0));
+    assert_cmpint(dest.size, EQ, 4);
+    var kid = dest.first_child(blk);
+    assert_cmpstr(dest.get_text(kid), EQ, "Hello");
+    assert_cmpstr(dest.get_text(dest.next_sibling(kid)), EQ, "world");
+}
+
+// Layout of serialized trees, for making corrupt ones.  See DocTree.serialize().
+const int HEADER_SIZE = 104;
+const int NODE_SIZE = 52;
+const int NODE_TY = 0;
+const int NODE_HEADER_LEVEL = 4;
+const int NODE_PARENT = 8;
+const int NODE_FIRST_CHILD = 12;
+const int NODE_LAST_CHILD = 16;
+const int NODE_NEXT_SIBLING = 20;
+
+/** A copy of @data with field @field of node @idx set to @val */
+Bytes with_node_field(Bytes data, int idx, int field, int32 val)
+{
+    uint8[] bytes = data.get_data();    // a copy
+    Memory.copy(&bytes[HEADER_SIZE + idx * NODE_SIZE + field], &val, sizeof(int32));
+    return new Bytes(bytes);
+}
+
+void test_serialize()
+{
+    var tree = new_tree();
+    var data = tree.serialize();
+
+    try {
+        var tree2 = DocTree.deserialize(data);
+        assert_cmpint(tree2.size, EQ, tree.size);
+        assert_cmpstr(tree2.as_string(), EQ, tree.as_string());
+        assert_cmpstr(tree2.get_source_hash(), EQ, DocTree.hash_source(tree.source));
+
+        // Text from the source is used in place
+        size_t len;
+        var kid = tree2.first_child(tree2.first_child(0));
+        char *text = tree2.text_data(kid, out len);
+        unowned uint8[] buf = data.get_data();
+        assert_true(text > (char *)buf && text < (char *)buf + buf.length);
+        assert_cmpuint(len, EQ, 5);
+
+        // Copied strings survive
+        assert_cmpstr(tree2.get_info_string(tree2.last_child(0)), EQ, "info");
+
+        // The hash can be given
+        tree2 = DocTree.deserialize(tree.serialize("0123abcd"));
+        assert_cmpstr(tree2.get_source_hash(), EQ, "0123abcd");
+
+        // Trees with no source have no hash
+        tree2 = DocTree.deserialize(new DocTree().serialize());
+        assert_cmpint(tree2.size, EQ, 1);
+        assert_null(tree2.get_source_hash());
+    } catch(MarkupError e) {    // LCOV_EXCL_START - unreached if tests pass
+        warning("%s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+
+    // Bad data is rejected
+    uint8[] bytes = data.get_data();    // a copy
+    Bytes[] bad = {
+        new Bytes(bytes[0:10]),                 // too short
+        new Bytes(bytes[0:bytes.length-1]),     // truncated
+    };
+    bytes[0] = 'X';                             // bad magic
+    bad += new Bytes(bytes);
+
+    // Nodes are 0 root, 1 para, 2 and 3 text in para, 4 hr.  Each of
+    // these links is in range and points forward, but is inconsistent.
+    bad += with_node_field(data, 3, NODE_PARENT, 0);    // not in root's list
+    bad += with_node_field(data, 1, NODE_NEXT_SIBLING, 3);  // para's kid in root's list
+    bad += with_node_field(data, 1, NODE_LAST_CHILD, 2);    // list doesn't end there
+    bad += with_node_field(data, 0, NODE_FIRST_CHILD, 4);   // para unreachable
+    bad += with_node_field(with_node_field(data, 2, NODE_FIRST_CHILD, 3),
+        2, NODE_LAST_CHILD, 3);                             // 3 is in two lists
+    bad += with_node_field(data, 4, NODE_TY, 9999);         // not an Elem.Type
+    bad += with_node_field(data, 4, NODE_TY, Elem.Type.INVALID);
+    bad += with_node_field(data, 1, NODE_HEADER_LEVEL, 99);
+
+    // The offsets above are right: setting a field to its own value is fine
+    try {
+        DocTree.deserialize(with_node_field(data, 3, NODE_PARENT, 1));
+        DocTree.deserialize(with_node_field(data, 1, NODE_HEADER_LEVEL, 6));
+    } catch(MarkupError e) {    // LCOV_EXCL_START - unreached if tests pass
+        warning("%s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+
+    foreach(var b in bad) {
+        try {
+            DocTree.deserialize(b);
+            assert_not_reached();   // LCOV_EXCL_LINE - never happens if tests pass
+        } catch(MarkupError e) {
+            assert_true(e is MarkupError.INVALID_CONTENT);
+        }
+    }
+}
+
+/**
+ * Trees from the md4c reader round-trip.  The reader unlinks nodes, e.g.,
+ * for HTML blocks and special blocks; those are not saved.
+ */
+void test_serialize_reader_output()
+{
+    var reader = new MarkdownMd4cReader();
+    foreach(var fn in new string[] { "200-html-comment.md", "200-special.md" }) {
+        try {
+            var doc = reader.read_document(Test.build_filename(Test.FileType.DIST, fn));
+            var tree = doc.get_tree();
+            var tree2 = DocTree.deserialize(tree.serialize());
+            assert_cmpstr(tree2.as_string(), EQ, tree.as_string());
+            assert_cmpint(tree2.size, LE, tree.size);
+        } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+            warning("%s: %s", fn, e.message);
+            assert_not_reached();
+        }   // LCOV_EXCL_STOP
+    }
+
+    // Unlinked nodes are left out
+    var tree = new_tree();
+    tree.remove_children(tree.first_child(0));
+    try {
+        var tree2 = DocTree.deserialize(tree.serialize());
+        assert_cmpint(tree2.size, EQ, tree.size - 2);
+        assert_cmpstr(tree2.as_string(), EQ, tree.as_string());
+        assert_cmpstr(tree2.get_info_string(tree2.last_child(0)), EQ, "info");
+    } catch(MarkupError e) {    // LCOV_EXCL_START - unreached if tests pass
+        warning("%s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+}
+
+public static int main (string[] args)
+{
+    Test.init (ref args);
+    Test.set_nonfatal_assertions();
+    Test.add_func("/051-core-doctree/build", test_build);
+    Test.add_func("/051-core-doctree/preorder", test_preorder);
+    Test.add_func("/051-core-doctree/nodes_round_trip", test_nodes_round_trip);
+    Test.add_func("/051-core-doctree/copy_children", test_copy_children);
+    Test.add_func("/051-core-doctree/serialize", test_serialize);
+    Test.add_func("/051-core-doctree/serialize_reader_output", test_serialize_reader_output);
+
+    return Test.run();
+}
@@ -0,0 +1,87 @@
+// t/056-core-stats-t.vala - tests of My.Stats
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+using My;
+using My.Cmp;
+
+void test_disabled()
+{
+    Stats.reset();
+    Stats.enabled = false;
+
+    assert_true(Stats.start() == 0);
+    Stats.stop("timer", 0);
+    Stats.count("counter", 5);
+    assert_cmpuint((uint)Stats.get_count("timer"), EQ, 0);
+    assert_cmpuint((uint)Stats.get_count("counter"), EQ, 0);
+}
+
+void test_counters()
+{
+    Stats.reset();
+    Stats.enabled = true;
+
+    Stats.count("counter");
+    Stats.count("counter", 41);
+    Stats.count("other", 2);
+    assert_cmpuint((uint)Stats.get_count("counter"), EQ, 42);
+    assert_cmpuint((uint)Stats.get_count("other"), EQ, 2);
+    assert_cmpuint((uint)Stats.get_count("nonexistent"), EQ, 0);
+
+    Stats.reset();
+    assert_cmpuint((uint)Stats.get_count("counter"), EQ, 0);
+    Stats.enabled = false;
+}
+
+void test_timers()
+{
+    Stats.reset();
+    Stats.enabled = true;
+
+    for(int i=0; i<3; ++i) {
+        var t = Stats.start();
+        assert_true(t != 0);
+        Thread.usleep(1000);
+        Stats.stop("timer", t);
+    }
+    assert_cmpuint((uint)Stats.get_count("timer"), EQ, 3);
+    assert_cmpfloat(Stats.get_seconds("timer"), GE, 0.003);
+    assert_cmpfloat(Stats.get_seconds("nonexistent"), EQ, 0);
+
+    Stats.reset();
+    Stats.enabled = false;
+}
+
+void test_reports()
+{
+    Stats.reset();
+    Stats.enabled = true;
+
+    Stats.stop("a.timer", Stats.start());
+    Stats.count("a.counter", 7);
+
+    var table = Stats.to_table();
+    assert_true(table.contains("a.timer"));
+    assert_true(table.contains("a.counter"));
+
+    var json = Stats.to_json();
+    assert_true(json.contains("\"a.timer\": { \"calls\": 1,"));
+    assert_true(json.contains("\"a.counter\": 7"));
+
+    Stats.reset();
+    Stats.enabled = false;
+}
+
+public static int main (string[] args)
+{
+    App.init_before_run();
+    Test.init (ref args);
+    Test.set_nonfatal_assertions();
+    Test.add_func("/056-core-stats/disabled", test_disabled);
+    Test.add_func("/056-core-stats/counters", test_counters);
+    Test.add_func("/056-core-stats/timers", test_timers);
+    Test.add_func("/056-core-stats/reports", test_reports);
+
+    return Test.run();
+}
@@ -8,6 +8,56 @@ void test_linit()   // for coverage
     assert_true(true);
 }
 
+void test_set_level()
+{
+    var oldlevel = My.Log.get_level();
+
+    My.Log.set_level(Gst.DebugLevel.INFO);
+    assert_true(My.Log.get_level() == Gst.DebugLevel.INFO);
+    assert_true(My.Log.lenabled(Gst.DebugLevel.WARNING));
+    assert_true(My.Log.lenabled(Gst.DebugLevel.INFO));
+    assert_true(!My.Log.lenabled(Gst.DebugLevel.DEBUG));
+    assert_true(!My.Log.lenabled(Gst.DebugLevel.TRACE));
+
+    My.Log.set_level(Gst.DebugLevel.NONE);
+    assert_true(!My.Log.lenabled(Gst.DebugLevel.ERROR));
+    My.Log.lerror("not shown");     // for coverage
+
+    My.Log.set_level(oldlevel);
+    assert_true(My.Log.get_level() == oldlevel);
+}
+
+void test_env()
+{
+    var oldlevel = My.Log.get_level();
+    var oldenv = Environment.get_variable("GST_DEBUG");
+
+    var cases = new HashTable<string, int>(str_hash, str_equal);
+    cases.insert("", Gst.DebugLevel.NONE);
+    cases.insert("5", Gst.DebugLevel.DEBUG);
+    cases.insert("pfft:4", Gst.DebugLevel.INFO);
+    cases.insert("pfft:trace", Gst.DebugLevel.TRACE);
+    cases.insert("GST_*:9,pfft:2", Gst.DebugLevel.WARNING);
+    cases.insert("*:6", Gst.DebugLevel.LOG);
+    cases.insert("pf*:9", Gst.DebugLevel.MEMDUMP);
+    cases.insert("pfft:3,pfft:1", Gst.DebugLevel.ERROR);
+    cases.insert("other:9", Gst.DebugLevel.NONE);
+    cases.insert("pfft:bogus", Gst.DebugLevel.NONE);
+
+    cases.foreach((spec, level) => {
+        Environment.set_variable("GST_DEBUG", spec, true);
+        My.Log.linit();
+        assert_cmpint(My.Log.get_level(), My.Cmp.EQ, level);
+    });
+
+    if(oldenv == null) {
+        Environment.unset_variable("GST_DEBUG");
+    } else {
+        Environment.set_variable("GST_DEBUG", oldenv, true);
+    }
+    My.Log.set_level(oldlevel);
+}
+
 void test_canonicalize()    // for coverage
 {
     string t;
@@ -30,6 +80,8 @@ public static int main (string[] args)
     Test.init (ref args);
     Test.set_nonfatal_assertions();
     Test.add_func("/100-logging/linit", test_linit);
+    Test.add_func("/100-logging/set_level", test_set_level);
+    Test.add_func("/100-logging/env", test_env);
     Test.add_func("/100-logging/canonicalize", test_canonicalize);
 
     return Test.run();
@@ -0,0 +1,64 @@
+// t/110-startup-t.vala - tests of startup cost
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+//
+// pfft is often run many times on small documents, so startup time
+// matters.  The startup time is always reported, but is only checked if
+// PFFT_STARTUP_BUDGET_MS is set, e.g., to 100.  Timings are unreliable
+// under valgrind, coverage, or a loaded machine.  See CONTRIBUTING.md.
+
+using My;
+using My.Cmp;
+
+/** How many times to run pfft */
+const int NRUNS = 5;
+
+void test_no_gstreamer()
+{
+    // main() already called App.init_before_run()
+    assert_true(!Gst.is_initialized());
+}
+
+void test_cold_start()
+{
+    var pfft = Test.build_filename(Test.FileType.BUILT, "..", "src", "pfft");
+    if(!FileUtils.test(pfft, FileTest.IS_EXECUTABLE)) {
+        Test.skip("pfft has not been built");  // LCOV_EXCL_LINE
+        return;     // LCOV_EXCL_LINE
+    }
+
+    double fastest_ms = double.MAX;
+    try {
+        for(int i=0; i<NRUNS; ++i) {
+            var timer = new Timer();
+            var proc = new Subprocess.newv({pfft, "--version"},
+                    SubprocessFlags.STDOUT_SILENCE);
+            proc.wait_check();
+            fastest_ms = double.min(fastest_ms, timer.elapsed() * 1000);
+        }
+    } catch(GLib.Error e) {   // LCOV_EXCL_START - unreached if tests pass
+        diag("Error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+
+    var budget_env = Environment.get_variable("PFFT_STARTUP_BUDGET_MS");
+    if(budget_env == null) {
+        diag("pfft --version: %f ms (not checked)", fastest_ms);
+        return;
+    }
+
+    var budget_ms = double.parse(budget_env);
+    diag("pfft --version: %f ms (budget %f ms)", fastest_ms, budget_ms);
+    assert_cmpfloat(fastest_ms, LE, budget_ms);
+}
+
+public static int main (string[] args)
+{
+    App.init_before_run();
+    Test.init (ref args);
+    Test.set_nonfatal_assertions();
+    Test.add_func("/110-startup/no_gstreamer", test_no_gstreamer);
+    Test.add_func("/110-startup/cold_start", test_cold_start);
+
+    return Test.run();
+}
@@ -0,0 +1,103 @@
+// t/120-serve-t.vala - tests of pfft --serve
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+using My;
+using My.Cmp;
+
+/**
+ * Run `pfft --serve` with @requests on stdin.
+ * @return The responses, by id, or null if pfft has not been built
+ */
+HashTable<string, Json.Object>? serve(string requests)
+{
+    var pfft = Test.build_filename(Test.FileType.BUILT, "..", "src", "pfft");
+    if(!FileUtils.test(pfft, FileTest.IS_EXECUTABLE)) {
+        return null;    // LCOV_EXCL_LINE
+    }
+
+    var retval = new HashTable<string, Json.Object>(str_hash, str_equal);
+    try {
+        var proc = new Subprocess.newv({pfft, "--serve", "-j", "2"},
+                SubprocessFlags.STDIN_PIPE | SubprocessFlags.STDOUT_PIPE);
+        string responses;
+        proc.communicate_utf8(requests, null, out responses, null);
+        assert_true(proc.get_successful());
+
+        foreach(var line in responses.strip().split("\n")) {
+            var parser = new Json.Parser();
+            parser.load_from_data(line, -1);
+            var obj = parser.get_root().get_object();
+            retval.insert(obj.get_string_member("id"), obj);
+        }
+    } catch(GLib.Error e) {   // LCOV_EXCL_START - unreached if tests pass
+        diag("Error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+
+    return retval;
+}
+
+void test_requests()
+{
+    var infn = Test.build_filename(Test.FileType.DIST, "basic.md");
+    string outfn = "";
+    try {
+        FileUtils.close(FileUtils.open_tmp("120-serve-XXXXXX.pdf", out outfn));
+    } catch(FileError e) {   // LCOV_EXCL_START - unreached if tests pass
+        diag("Error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+
+    var requests = new StringBuilder();
+    requests.append_printf("{\"id\": \"file\", \"input\": \"%s\", \"output\": \"%s\"}\n",
+        infn.escape(), outfn.escape());
+    requests.append("{\"id\": \"inline\", \"markdown\": \"# Hello\\n\\nworld\\n\"}\n");
+    requests.append("\n");  // blank lines are ignored
+    requests.append("{\"id\": \"noinput\"}\n");
+    requests.append("{\"id\": \"badwriter\", \"markdown\": \"x\", \"writer\": \"nonexistent\"}\n");
+
+    var responses = serve(requests.str);
+    if(responses == null) {
+        Test.skip("pfft has not been built");  // LCOV_EXCL_LINE
+        return;     // LCOV_EXCL_LINE
+    }
+    assert_cmpuint(responses.size(), EQ, 4);
+
+    var resp = responses.lookup("file");
+    assert_true(resp.get_boolean_member("ok"));
+    assert_cmpstr(resp.get_string_member("output"), EQ, outfn);
+    assert_cmpint(resp.get_int_member("pages"), GE, 1);
+    string contents;
+    try {
+        FileUtils.get_contents(outfn, out contents);
+    } catch(FileError e) {   // LCOV_EXCL_START - unreached if tests pass
+        diag("Error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+    assert_true(contents.has_prefix("%PDF"));
+    FileUtils.unlink(outfn);
+
+    resp = responses.lookup("inline");
+    assert_true(resp.get_boolean_member("ok"));
+    var pdf = Base64.decode(resp.get_string_member("pdf"));
+    assert_cmpint(pdf.length, GT, 4);
+    assert_true(pdf[0] == '%' && pdf[1] == 'P' && pdf[2] == 'D' && pdf[3] == 'F');
+
+    resp = responses.lookup("noinput");
+    assert_true(!resp.get_boolean_member("ok"));
+    assert_true(resp.has_member("error"));
+
+    resp = responses.lookup("badwriter");
+    assert_true(!resp.get_boolean_member("ok"));
+}
+
+public static int main (string[] args)
+{
+    App.init_before_run();
+    Test.init (ref args);
+    Test.set_nonfatal_assertions();
+    Test.add_func("/120-serve/requests", test_requests);
+
+    return Test.run();
+}
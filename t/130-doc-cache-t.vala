@@ -0,0 +1,82 @@
+// t/130-doc-cache-t.vala - tests of the --doc-cache support
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+using My;
+using My.Cmp;
+
+/** Read @fn through @cache and return the counts of hits and misses */
+void read_through(DocCache cache, Reader reader, string fn,
+    out uint64 hits, out uint64 misses, out string doc_text)
+{
+    Stats.reset();
+    Stats.enabled = true;
+    doc_text = "";
+    try {
+        doc_text = cache.read_document(fn, reader).as_string();
+    } catch(GLib.Error e) {   // LCOV_EXCL_START - unreached if tests pass
+        diag("Error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+    Stats.enabled = false;
+    hits = Stats.get_count("doccache.hits");
+    misses = Stats.get_count("doccache.misses");
+}
+
+/** The second read of a file comes from the cache */
+void test_hit()
+{
+    string dir = null;
+    try {
+        dir = DirUtils.make_tmp("130-doc-cache-XXXXXX");
+    } catch(FileError e) {  // LCOV_EXCL_START - unreached if tests pass
+        diag("Error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+
+    // The HTML comment makes the reader unlink nodes
+    var fn = Test.build_filename(Test.FileType.DIST, "200-html-comment-and-text.md");
+    var cache = new DocCache(dir);
+    var reader = new MarkdownMd4cReader();
+    uint64 hits, misses;
+    string first, second;
+
+    read_through(cache, reader, fn, out hits, out misses, out first);
+    assert_cmpuint((uint)hits, EQ, 0);
+    assert_cmpuint((uint)misses, EQ, 1);
+
+    read_through(cache, reader, fn, out hits, out misses, out second);
+    assert_cmpuint((uint)hits, EQ, 1);
+    assert_cmpuint((uint)misses, EQ, 0);
+    assert_cmpstr(second, EQ, first);
+
+    // Different reader options, different entry
+    var text_reader = new PlainTextReader();
+    read_through(cache, text_reader, fn, out hits, out misses, out first);
+    assert_cmpuint((uint)misses, EQ, 1);
+    text_reader.monospace = true;
+    read_through(cache, text_reader, fn, out hits, out misses, out second);
+    assert_cmpuint((uint)misses, EQ, 1);
+    assert_cmpstr(second, NE, first);
+
+    // Clean up
+    try {
+        var d = Dir.open(dir);
+        string? name;
+        while((name = d.read_name()) != null) {
+            FileUtils.unlink(Path.build_filename(dir, name));
+        }
+    } catch(FileError e) {
+        // ignore errors
+    }
+    DirUtils.remove(dir);
+}
+
+public static int main (string[] args)
+{
+    Test.init (ref args);
+    Test.set_nonfatal_assertions();
+    Test.add_func("/130-doc-cache/hit", test_hit);
+
+    return Test.run();
+}
@@ -0,0 +1,86 @@
+// t/140-jobs-t.vala - tests of pfft --jobs
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+using My;
+using My.Cmp;
+
+/** Check that @fn exists and is a PDF */
+void assert_pdf(string fn)
+{
+    string contents = "";
+    try {
+        FileUtils.get_contents(fn, out contents);
+    } catch(FileError e) {   // LCOV_EXCL_START - unreached if tests pass
+        diag("Error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+    assert_true(contents.has_prefix("%PDF"));
+}
+
+/** One bad file does not stop the others */
+void test_one_bad_file()
+{
+    var pfft = Test.build_filename(Test.FileType.BUILT, "..", "src", "pfft");
+    if(!FileUtils.test(pfft, FileTest.IS_EXECUTABLE)) {
+        Test.skip("pfft has not been built");  // LCOV_EXCL_LINE
+        return;     // LCOV_EXCL_LINE
+    }
+
+    string dir = null;
+    var good1 = "";
+    var good2 = "";
+    var missing = "";
+    try {
+        dir = DirUtils.make_tmp("140-jobs-XXXXXX");
+        string source;
+        FileUtils.get_contents(Test.build_filename(Test.FileType.DIST, "basic.md"),
+            out source);
+        good1 = Path.build_filename(dir, "good1.md");
+        good2 = Path.build_filename(dir, "good2.md");
+        missing = Path.build_filename(dir, "missing.md");
+        FileUtils.set_contents(good1, source);
+        FileUtils.set_contents(good2, source);
+    } catch(FileError e) {   // LCOV_EXCL_START - unreached if tests pass
+        diag("Error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+
+    string errors = "";
+    int status = 0;
+    try {
+        var proc = new Subprocess.newv({pfft, "-j", "2", good1, missing, good2},
+                SubprocessFlags.STDOUT_SILENCE | SubprocessFlags.STDERR_PIPE);
+        proc.communicate_utf8(null, null, null, out errors);
+        status = proc.get_exit_status();
+    } catch(GLib.Error e) {   // LCOV_EXCL_START - unreached if tests pass
+        diag("Error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+
+    assert_cmpint(status, EQ, 1);
+    assert_true(missing in errors);
+    assert_true("1 of 3 file(s) could not be processed" in errors);
+
+    var good1_pdf = Path.build_filename(dir, "good1.pdf");
+    var good2_pdf = Path.build_filename(dir, "good2.pdf");
+    assert_pdf(good1_pdf);
+    assert_pdf(good2_pdf);
+    assert_true(!FileUtils.test(Path.build_filename(dir, "missing.pdf"),
+        FileTest.EXISTS));
+
+    // Clean up
+    foreach(var fn in new string[] {good1, good2, good1_pdf, good2_pdf}) {
+        FileUtils.unlink(fn);
+    }
+    DirUtils.remove(dir);
+}
+
+public static int main (string[] args)
+{
+    Test.init (ref args);
+    Test.set_nonfatal_assertions();
+    Test.add_func("/140-jobs/one_bad_file", test_one_bad_file);
+
+    return Test.run();
+}
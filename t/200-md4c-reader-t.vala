@@ -145,6 +145,27 @@ void test_loadfile()
     });
 }
 
+/** Files that can't be mapped, or when mapping is off, are read */
+void test_loadfile_unmapped()
+{
+    diag(GLib.Log.METHOD);
+    try {
+        var md = new MarkdownMd4cReader();
+        var doc = md.read_document("/dev/null");    // a device, not a file
+        assert_true(doc.root.n_children() == 0);
+    } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+        warning("%s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+
+    map_input_files = false;
+    read_and_test("basic.md", (doc)=> {
+        assert_true(doc.root.n_children() == 2);
+        assert_true(doc.root.nth_child(1).nth_child(0).data.text == "Body");
+    });
+    map_input_files = true;
+}
+
 #if 0
 // TODO figure out how to trigger an md4c parse error
 void test_image_bad()
@@ -245,6 +266,74 @@ void test_special_with_formatting()
     );
 }
 
+/** Types of the children of @idx, space-separated */
+string kid_types(DocTree tree, int idx)
+{
+    var retval = "";
+    for(int kid = tree.first_child(idx); kid != DocTree.NONE;
+        kid = tree.next_sibling(kid)) {
+        retval += tree.get_ty(kid).to_string() + " ";
+    }
+    return retval;
+}
+
+/**
+ * Special blocks are parsed in place when their contents are contiguous
+ * in the source, and from a copy otherwise.  Either way, the results are
+ * the same.
+ */
+void test_special_in_place()
+{
+    diag(GLib.Log.METHOD);
+    string[] inputs = {
+        // in place
+        "```pfft:x\n# Head\n\n- a\n- b\n```\n",
+        "```pfft:x\r\n# Head\r\n\r\n- a\r\n- b\r\n```\r\n",
+        "````pfft:outer\n```pfft:inner\n# Head\n```\n\n- a\n- b\n````\n",
+        // copied, because md4c removes the indentation
+        "- item\n\n  ```pfft:x\n  # Head\n\n  - a\n  - b\n  ```\n",
+    };
+    uint64[] expected_in_place = { 1, 1, 2, 0 };
+
+    Stats.enabled = true;
+    for(int i=0; i<inputs.length; ++i) {
+        Stats.reset();
+        try {
+            var tree = new MarkdownMd4cReader().read_string(inputs[i]).get_tree();
+            assert_cmpuint((uint)Stats.get_count("special.in_place"), EQ,
+                (uint)expected_in_place[i]);
+            assert_cmpuint((uint)Stats.get_count("special.copied"), EQ,
+                (uint)(1 - int.min((int)expected_in_place[i], 1)));
+
+            // Find the special block
+            int special = tree.first_child(0);
+            if(tree.get_ty(special) == BLOCK_BULLET_LIST) {
+                special = tree.last_child(tree.first_child(special));
+            }
+            assert_true(tree.get_ty(special) == BLOCK_SPECIAL);
+
+            if(i == 2) {    // nested
+                var inner = tree.first_child(special);
+                assert_true(tree.get_ty(inner) == BLOCK_SPECIAL);
+                assert_cmpstr(tree.get_info_string(inner), EQ, "inner");
+                assert_cmpstr(kid_types(tree, inner), EQ, "BLOCK_HEADER ");
+                assert_cmpstr(kid_types(tree, special), EQ,
+                    "BLOCK_SPECIAL BLOCK_BULLET_LIST ");
+                continue;
+            }
+
+            assert_cmpstr(kid_types(tree, special), EQ,
+                "BLOCK_HEADER BLOCK_BULLET_LIST ");
+            var header = tree.first_child(special);
+            assert_cmpstr(tree.get_text(tree.first_child(header)), EQ, "Head");
+        } catch(GLib.MarkupError e) {   // LCOV_EXCL_START - unreached if tests pass
+            warning("%s", e.message);
+            assert_not_reached();
+        }   // LCOV_EXCL_STOP
+    }
+    Stats.enabled = false;
+}
+
 // span_plain is tested plenty of places herein
 
 void test_italics()
@@ -328,6 +417,52 @@ void test_html_comment_and_text()
         assert_true(node0.n_children() == 0);
     }, false);
 }
+/** BlockSink that records what it is given */
+class RecordingSink : Object, BlockSink {
+    public string types = "";
+    public int max_tree_size = 0;
+
+    public void begin_document(string filename, string? sourcefn = null)
+    {
+    }
+
+    public void add_block(DocTree tree, int idx)
+    {
+        assert_cmpint(tree.parent(idx), EQ, 0);
+        types += tree.get_ty(idx).to_string() + " ";
+        max_tree_size = int.max(max_tree_size, tree.size);
+    }
+
+    public void end_document()
+    {
+    }
+}
+
+/** Streaming gives the same blocks as reading, but not all at once */
+void test_stream()
+{
+    diag(GLib.Log.METHOD);
+    var filepath = Test.build_filename(Test.FileType.DIST, "complex.md");
+
+    try {
+        var md = new MarkdownMd4cReader();
+        var tree = md.read_document(filepath).get_tree();
+        var expected = "";
+        for(int kid = tree.first_child(0); kid != DocTree.NONE;
+            kid = tree.next_sibling(kid)) {
+            expected += tree.get_ty(kid).to_string() + " ";
+        }
+
+        var sink = new RecordingSink();
+        md.stream_document(filepath, sink);
+        assert_cmpstr(sink.types, EQ, expected);
+        assert_cmpint(sink.max_tree_size, LT, tree.size);
+    } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+        warning("%s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+}
+
 public static int main (string[] args)
 {
     // run the tests
@@ -336,6 +471,7 @@ public static int main (string[] args)
     Test.set_nonfatal_assertions();
     Test.add_func("/200-md4c-reader/misc", test_misc);
     Test.add_func("/200-md4c-reader/loadfile", test_loadfile);
+    Test.add_func("/200-md4c-reader/loadfile_unmapped", test_loadfile_unmapped);
 #if 0
     Test.add_func("/200-md4c-reader/image_bad", test_image_bad);
 #endif
@@ -345,6 +481,7 @@ public static int main (string[] args)
     Test.add_func("/200-md4c-reader/special", test_special);
     Test.add_func("/200-md4c-reader/special_nocmd", test_special_nocmd);
     Test.add_func("/200-md4c-reader/special_with_formatting", test_special_with_formatting);
+    Test.add_func("/200-md4c-reader/special_in_place", test_special_in_place);
     Test.add_func("/200-md4c-reader/italics", test_italics);
     Test.add_func("/200-md4c-reader/bold", test_bold);
     Test.add_func("/200-md4c-reader/inline_code", test_inline_code);
@@ -353,6 +490,7 @@ public static int main (string[] args)
     Test.add_func("/200-md4c-reader/image", test_image);
     Test.add_func("/200-md4c-reader/html_comment", test_html_comment);
     Test.add_func("/200-md4c-reader/html_comment_and_text", test_html_comment_and_text);
+    Test.add_func("/200-md4c-reader/stream", test_stream);
 
     return Test.run();
 }
@@ -0,0 +1,188 @@
+// t/210-text-reader-t.vala - tests of the plain-text reader
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+
+using My;
+using My.Cmp;
+
+// === Helpers =============================================================
+
+/** Write @contents to a new temporary file and return its name */
+string make_text_file(string contents, ssize_t len = -1)
+{
+    string fn = "";
+    try {
+        FileUtils.close(FileUtils.open_tmp("210-text-XXXXXX.txt", out fn));
+        FileUtils.set_contents(fn, contents, len);
+    } catch(FileError e) {  // LCOV_EXCL_START - unreached if tests pass
+        diag("Error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+    return fn;
+}
+
+/** The types and texts of the blocks in @tree, one per line */
+string describe_blocks(DocTree tree)
+{
+    var sb = new StringBuilder();
+    for(int kid = tree.first_child(0); kid != DocTree.NONE;
+        kid = tree.next_sibling(kid)) {
+        sb.append_printf("%s:%s\n", tree.get_ty(kid).to_string(),
+            tree.get_text(tree.first_child(kid)));
+    }
+    return sb.str;
+}
+
+/** Read @contents with @reader */
+string read_blocks(PlainTextReader reader, string contents)
+{
+    var fn = make_text_file(contents);
+    string retval = "";
+    try {
+        retval = describe_blocks(reader.read_document(fn).get_tree());
+    } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+        diag("Error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+    FileUtils.unlink(fn);
+    return retval;
+}
+
+/** A BlockSink that records the blocks it receives */
+class RecordingSink : Object, BlockSink {
+    public StringBuilder blocks = new StringBuilder();
+    public int max_tree_size = 0;
+
+    public void begin_document(string filename, string? sourcefn = null)
+    throws FileError, My.Error
+    {
+    }
+
+    public void add_block(DocTree tree, int idx) throws My.Error
+    {
+        max_tree_size = int.max(max_tree_size, tree.size);
+        blocks.append_printf("%s:%s\n", tree.get_ty(idx).to_string(),
+            tree.get_text(tree.first_child(idx)));
+    }
+
+    public void end_document() throws FileError, My.Error
+    {
+    }
+}
+
+// === Tests ===============================================================
+
+void test_paragraphs()
+{
+    var reader = new PlainTextReader();
+    assert_cmpstr(read_blocks(reader, "one\r\ntwo\n\n  \t\n\nthree\n"), EQ,
+        "MY_ELEM_TYPE_BLOCK_COPY:one\ntwo\nMY_ELEM_TYPE_BLOCK_COPY:three\n");
+
+    // No newline at the end
+    assert_cmpstr(read_blocks(reader, "\n\nlast"), EQ,
+        "MY_ELEM_TYPE_BLOCK_COPY:last\n");
+
+    // Empty file
+    assert_cmpstr(read_blocks(reader, ""), EQ, "");
+}
+
+void test_monospace()
+{
+    var reader = new PlainTextReader();
+    reader.monospace = true;
+    reader.blocklines = 2;
+    assert_cmpstr(read_blocks(reader, "a\n  b\nc\n\nd\n"), EQ,
+        "MY_ELEM_TYPE_BLOCK_CODE:a\n  b\n" +
+        "MY_ELEM_TYPE_BLOCK_CODE:c\n" +
+        "MY_ELEM_TYPE_BLOCK_CODE:d\n");
+}
+
+/** Lines that span chunks are put back together */
+void test_long_lines()
+{
+    var reader = new PlainTextReader();
+    reader.monospace = true;
+    reader.blocklines = 0;
+
+    var sb = new StringBuilder();
+    var expected = new StringBuilder();
+    for(int i = 0; i < 2000; ++i) {
+        var line = string.nfill(i * 97 % 1000, (char)('a' + i % 26));
+        sb.append_printf("%d %s\n", i, line);
+        expected.append_printf("%s%d %s", (i > 0) ? "\n" : "", i, line);
+    }
+    var huge = string.nfill(200000, 'z');
+    sb.append(huge);
+    expected.append("\n" + huge);
+
+    assert_cmpstr(read_blocks(reader, sb.str), EQ,
+        "MY_ELEM_TYPE_BLOCK_CODE:" + expected.str + "\n");
+}
+
+/** Invalid UTF-8 is replaced */
+void test_invalid_utf8()
+{
+    var reader = new PlainTextReader();
+    var sb = new StringBuilder("ok ");
+    sb.append_c((char)0xff);
+    sb.append_c((char)0xfe);
+    sb.append(" bytes\n");
+    var blocks = read_blocks(reader, sb.str);
+    assert_true(blocks.validate());
+    assert_true(blocks.has_prefix("MY_ELEM_TYPE_BLOCK_COPY:ok "));
+    assert_true(blocks.has_suffix(" bytes\n"));
+}
+
+/** Streaming keeps only one block in the tree at a time */
+void test_stream()
+{
+    var sb = new StringBuilder();
+    for(int i = 0; i < 500; ++i) {
+        sb.append_printf("paragraph %d\nsecond line\n\n", i);
+    }
+    var fn = make_text_file(sb.str);
+
+    var reader = new PlainTextReader();
+    var sink = new RecordingSink();
+    try {
+        reader.stream_document(fn, sink);
+        var doc = reader.read_document(fn);
+        assert_cmpstr(sink.blocks.str, EQ, describe_blocks(doc.get_tree()));
+    } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+        diag("Error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+    FileUtils.unlink(fn);
+
+    assert_true(sink.blocks.str.has_prefix(
+        "MY_ELEM_TYPE_BLOCK_COPY:paragraph 0\nsecond line\n"));
+    assert_cmpint(sink.max_tree_size, EQ, 3);   // root, block, text
+}
+
+void test_missing_file()
+{
+    var reader = new PlainTextReader();
+    try {
+        reader.read_document("/nonexistent/210-text-reader.txt");
+        assert_not_reached();   // LCOV_EXCL_LINE - unreached if tests pass
+    } catch(FileError e) {
+        assert_true(e.message.contains("nonexistent"));
+    } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+        diag("Error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+}
+
+public static int main (string[] args)
+{
+    Test.init (ref args);
+    Test.set_nonfatal_assertions();
+    Test.add_func("/210-text-reader/paragraphs", test_paragraphs);
+    Test.add_func("/210-text-reader/monospace", test_monospace);
+    Test.add_func("/210-text-reader/long_lines", test_long_lines);
+    Test.add_func("/210-text-reader/invalid_utf8", test_invalid_utf8);
+    Test.add_func("/210-text-reader/stream", test_stream);
+    Test.add_func("/210-text-reader/missing_file", test_missing_file);
+
+    return Test.run();
+}
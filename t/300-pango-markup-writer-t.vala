@@ -3,6 +3,7 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
 using My;
+using My.Cmp;
 
 Doc create_dummy_doc()
 {
@@ -37,6 +38,7 @@ void test_writefile()
         // Write it
         var writer = new PangoMarkupWriter();
         writer.write_document(destfn, doc);
+        assert_cmpint(writer.get_page_count(), EQ, 1);
 
         // Check it
         destf = File.new_for_path(destfn);
@@ -70,6 +72,601 @@ void test_writefile()
 
 } // test_writefile()
 
+/** Write a document one block at a time */
+void test_stream()
+{
+    string destfn = null;
+
+    try {
+        FileUtils.close(FileUtils.open_tmp("pfft-t-XXXXXX", out destfn));
+        var tree = create_dummy_doc().get_tree();
+        var writer = new PangoMarkupWriter();
+
+        // Blocks without a document are an error
+        try {
+            writer.add_block(tree, tree.first_child(0));
+            assert_not_reached();   // LCOV_EXCL_LINE - never happens if tests pass
+        } catch(My.Error e) {
+            assert_true(e is My.Error.WRITER);
+        }
+
+        writer.begin_document(destfn);
+        for(int kid = tree.first_child(0); kid != DocTree.NONE;
+            kid = tree.next_sibling(kid)) {
+            writer.add_block(tree, kid);
+        }
+        writer.end_document();
+
+        uint8[] contents;
+        FileUtils.get_data(destfn, out contents);
+        assert_true(contents.length > 0);
+
+        // An aborted document leaves no file behind, and the writer can
+        // be reused.  Aborting when there is no document does nothing.
+        writer.begin_document(destfn);
+        writer.add_block(tree, tree.first_child(0));
+        writer.abort_document();
+        assert_true(!FileUtils.test(destfn, FileTest.EXISTS));
+        writer.abort_document();
+
+        writer.begin_document(destfn);
+        writer.add_block(tree, tree.first_child(0));
+        writer.end_document();
+        assert_true(FileUtils.test(destfn, FileTest.IS_REGULAR));
+    } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+        warning("error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+
+    if(destfn != null) {
+        FileUtils.unlink(destfn);
+    }
+} // test_stream()
+
+/**
+ * Make a document with one paragraph of @nspans spans.
+ *
+ * Each span ends with a newline, so the spans have to be joined.
+ */
+Doc create_long_para_doc(uint nspans)
+{
+    GLib.Node<Elem> root = node_of_ty(Elem.Type.ROOT);
+    GLib.Node<Elem> node;
+    unowned GLib.Node<Elem> para;
+
+    node = node_of_ty(BLOCK_COPY);
+    para = node;
+    root.append((owned)node);
+
+    for(uint i=0; i<nspans; ++i) {
+        node = node_of_ty(SPAN_PLAIN);
+        node.data.text = "The quick brown fox jumps over the lazy dog & " +
+            "keeps running, %u lines and counting.\n".printf(i);
+        para.append((owned)node);
+    }
+
+    return new Doc((owned)root);
+}
+
+/** Line breaks are joined as the text is added */
+void test_join_lines()
+{
+    try {
+        var writer = new PangoMarkupWriter();
+        var blocks = writer.make_blocks_standalone(create_long_para_doc(3));
+        assert_true(blocks.size == 1);
+        var blk = blocks.first();
+        assert_true(blk.content.text.index_of_char('\n') == -1);
+        assert_true(blk.content.text.has_prefix("The quick brown fox jumps over the lazy dog & "));
+        assert_true(blk.content.text.has_suffix(" 2 lines and counting. "));
+        assert_true(blk.content.length == blk.content.text.length);
+    } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+        warning("error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+
+    // All the kinds of line break, with runs collapsed
+    var layout = Pango.cairo_create_layout(new Cairo.Context(
+                new Cairo.ImageSurface(Cairo.Format.ARGB32, 1, 1)));
+    var blk = new Blocks.Blk(layout);
+    blk.content.append("a\n\nb\r\nc\vd\fe");
+    blk.content.append("\u0085f\u2028g\u2029\nh\n");
+    assert_cmpstr(blk.content.text, EQ, "a b c d e f g h ");
+    blk.content.chomp();
+    assert_cmpstr(blk.content.text, EQ, "a b c d e f g h");
+
+    // Runs of line breaks are joined across appends
+    blk = new Blocks.Blk(layout);
+    blk.content.append("a\n");
+    blk.content.append("\nb", 2);
+    assert_cmpstr(blk.content.text, EQ, "a ");
+    blk.content.append("b");
+    assert_cmpstr(blk.content.text, EQ, "a b");
+
+    // Code blocks keep their lines
+    blk = new Blocks.Blk(layout);
+    blk.obeylines = true;
+    blk.content.append("a\nb\n");
+    assert_cmpstr(blk.content.text, EQ, "a\nb\n");
+} // test_join_lines()
+
+/**
+ * Line breaks are found wherever they fall relative to the scanner's
+ * 16- or 32-byte chunks, and lookalike bytes are kept.
+ */
+void test_join_lines_scanner()
+{
+    diag("Line-break scanner: %s", Blocks.StyledText.get_scanner());
+
+    // NBSP (C2 A0) and em dash (E2 80 94) start with the same bytes as
+    // NEL (C2 85) and LS/PS (E2 80 A8/A9), but are not line breaks.
+    string[] breaks = { "\n", "\r\n", "\v", "\f", "\u0085", "\u2028", "\u2029" };
+    for(int pos = 0; pos < 70; ++pos) {
+        foreach(var brk in breaks) {
+            var prefix = string.nfill(pos, 'a') + "\u00a0\u2014";
+            var suffix = "\u2014\u00a0" + string.nfill(70 - pos, 'b');
+
+            var st = new Blocks.StyledText();
+            st.append(prefix + brk + suffix);
+            assert_cmpstr(st.text, EQ, prefix + " " + suffix);
+        }
+    }
+} // test_join_lines_scanner()
+
+/**
+ * Time make_blocks_standalone() on a document of @nspans spans.
+ *
+ * @return The fastest of @nruns runs, in microseconds.  Taking the fastest
+ *          filters out delays caused by other processes.
+ */
+double time_make_blocks(uint nspans, uint nruns = 1) throws GLib.Error
+{
+    var doc = create_long_para_doc(nspans);
+    var writer = new PangoMarkupWriter();
+    double best = double.MAX;
+    for(uint i=0; i<nruns; ++i) {
+        var start = get_monotonic_time();
+        var blocks = writer.make_blocks_standalone(doc);
+        var elapsed = get_monotonic_time() - start;
+        assert_true(blocks.size == 1);
+        best = double.min(best, (double)elapsed);
+    }
+    return best;
+}
+
+/**
+ * Block generation should take time linear in the input size.
+ *
+ * The large document is about 10 MB of text.  Linear growth would give a
+ * ratio of about 4; quadratic growth would give about 16.
+ */
+void test_linear_time()
+{
+    try {
+        uint nspans = 30000;    // about 2.5 MB
+        uint nruns = 5;
+        time_make_blocks(nspans / 10);      // warm up
+        var small = time_make_blocks(nspans, nruns);
+        var large = time_make_blocks(nspans * 4, nruns);
+        var ratio = large / double.max(small, 1.0);
+        diag("make_blocks: %.0f us for %u spans, %.0f us for %u spans (ratio %.2f), best of %u",
+            small, nspans, large, nspans*4, ratio, nruns);
+        assert_true(ratio < 8.0);
+    } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+        warning("error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+} // test_linear_time()
+
+/** Make a document with one code block of @nlines lines */
+Doc create_long_code_doc(uint nlines)
+{
+    GLib.Node<Elem> root = node_of_ty(Elem.Type.ROOT);
+    GLib.Node<Elem> node;
+    unowned GLib.Node<Elem> code;
+
+    node = node_of_ty(BLOCK_CODE);
+    code = node;
+    root.append((owned)node);
+
+    for(uint i=0; i<nlines; ++i) {
+        node = node_of_ty(SPAN_PLAIN);
+        node.data.text = "line %u\n".printf(i);
+        code.append((owned)node);
+    }
+
+    return new Doc((owned)root);
+}
+
+/**
+ * A code block spanning many pages is rendered without revisiting the
+ * lines rendered on earlier pages.
+ */
+void test_long_code_block()
+{
+    string destfn = null;
+    uint nlines = 3000;
+
+    Stats.reset();
+    Stats.enabled = true;
+    try {
+        FileUtils.close(FileUtils.open_tmp("pfft-t-XXXXXX", out destfn));
+        var writer = new PangoMarkupWriter();
+        writer.write_document(destfn, create_long_code_doc(nlines));
+        assert_cmpint(writer.get_page_count(), GT, 10);
+    } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+        warning("error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+    Stats.enabled = false;
+
+    assert_cmpuint((uint)Stats.get_count("lines.rendered"), GE, nlines);
+    assert_cmpuint((uint)Stats.get_count("lines.skipped"), EQ, 0);
+
+    if(destfn != null) {
+        FileUtils.unlink(destfn);
+    }
+} // test_long_code_block()
+
+/** count_pages() and %P agree with the pages actually written */
+void test_count_pages()
+{
+    string destfn = null;
+    uint nlines = 500;
+
+    try {
+        var counter = new PangoMarkupWriter();
+        var npages = counter.count_pages(create_long_code_doc(nlines));
+        assert_cmpint(npages, GT, 1);
+        assert_cmpint(counter.get_page_count(), EQ, npages);
+
+        FileUtils.close(FileUtils.open_tmp("pfft-t-XXXXXX", out destfn));
+        var writer = new PangoMarkupWriter();
+        writer.footerc = "%p of %P";
+        Stats.reset();
+        Stats.enabled = true;
+        writer.write_document(destfn, create_long_code_doc(nlines));
+        Stats.enabled = false;
+        assert_cmpint(writer.get_page_count(), EQ, npages);
+
+        // The measuring pass does not output any pages
+        assert_cmpuint((uint)Stats.get_count("pages"), EQ, npages);
+    } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+        warning("error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+
+    if(destfn != null) {
+        FileUtils.unlink(destfn);
+    }
+} // test_count_pages()
+
+/** Only the requested pages are drawn */
+void test_page_range()
+{
+    string destfn = null;
+    uint nlines = 500;
+
+    try {
+        FileUtils.close(FileUtils.open_tmp("pfft-t-XXXXXX", out destfn));
+        var writer = new PangoMarkupWriter();
+        writer.firstpage = 3;
+        writer.lastpage = 4;
+        Stats.reset();
+        Stats.enabled = true;
+        writer.write_document(destfn, create_long_code_doc(nlines));
+        Stats.enabled = false;
+        assert_cmpint(writer.get_page_count(), EQ, 2);
+        assert_cmpuint((uint)Stats.get_count("pages"), EQ, 2);
+
+        // Only pages 3 and 4 are drawn, so fewer lines than the document has
+        var nrendered = (uint)Stats.get_count("lines.rendered");
+        assert_cmpuint(nrendered, LT, nlines);
+        assert_cmpuint((uint)Stats.get_count("lines.measured"), GT, 0);
+
+        // A range past the end of the document is an error
+        writer.firstpage = 1000;
+        writer.lastpage = 0;
+        writer.write_document(destfn, create_long_code_doc(nlines));
+        assert_not_reached();   // LCOV_EXCL_LINE - never happens if tests pass
+    } catch(My.Error e) {
+        assert_true(e is My.Error.WRITER);
+    } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+        warning("error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+
+    if(destfn != null) {
+        FileUtils.unlink(destfn);
+    }
+} // test_page_range()
+
+/**
+ * Render @blk at the top left of a blank page.
+ *
+ * @param measuring Whether to only measure
+ * @param drew      Set to whether anything was drawn
+ * @return Where the block left the current point, vertically
+ */
+double render_on_blank(Blocks.Blk blk, bool measuring, out bool drew)
+{
+    var surf = new Cairo.ImageSurface(Cairo.Format.ARGB32, 612, 792);
+    var cr = new Cairo.Context(surf);
+    cr.move_to(72, 72);
+    blk.measuring = measuring;
+    assert_true(blk.render(cr, c2p(540), c2p(720)) == RenderResult.COMPLETE);
+
+    double xC, yC;
+    cr.get_current_point(out xC, out yC);
+
+    surf.flush();
+    uint8 *data = (uint8 *)surf.get_data();
+    drew = false;
+    for(int i=0; i < surf.get_stride() * surf.get_height(); ++i) {
+        if(data[i] != 0) {
+            drew = true;
+            break;
+        }
+    }
+    return yC;
+}
+
+/** Measuring a block moves the current point, but draws nothing */
+void test_measuring()
+{
+    var layout = Pango.cairo_create_layout(new Cairo.Context(
+                new Cairo.ImageSurface(Cairo.Format.ARGB32, 1, 1)));
+    var bullet_layout = Pango.cairo_create_layout(new Cairo.Context(
+                new Cairo.ImageSurface(Cairo.Format.ARGB32, 1, 1)));
+
+    Blocks.Blk[] blks = {
+        new Blocks.ParaBlk(layout.copy()),
+        new Blocks.BulletBlk(layout.copy(), bullet_layout, "•", 0, i2p(0.25)),
+        new Blocks.HRBlk(layout.copy(), 0),
+        new Blocks.QuoteBlk(layout.copy(), i2p(0.5)),
+        new Blocks.CodeBlk(layout.copy(), 0, i2p(0.1)),
+    };
+
+    foreach(var blk in blks) {
+        if(!(blk is Blocks.HRBlk)) {
+            blk.content.append("Some text");
+        }
+
+        bool drew;
+        var measuredC = render_on_blank(blk, true, out drew);
+        assert_false(drew);
+        var renderedC = render_on_blank(blk, false, out drew);
+        assert_true(drew);
+        assert_cmpfloat(measuredC, EQ, renderedC);
+        assert_cmpfloat(measuredC, GT, 72);
+    }
+} // test_measuring()
+
+/** Write a PDF to a GLib.OutputStream */
+void test_output_stream()
+{
+    try {
+        var writer = new PangoMarkupWriter();
+        var mem = new MemoryOutputStream.resizable();
+        writer.write_document_to_stream(mem, create_long_code_doc(200));
+        assert_cmpint(writer.get_page_count(), GT, 1);
+        assert_true(!mem.is_closed());  // the writer doesn't close it
+
+        mem.close();
+        var pdf = mem.steal_as_bytes().get_data();
+        assert_cmpint(pdf.length, GT, 4);
+        assert_true(pdf[0] == '%' && pdf[1] == 'P' && pdf[2] == 'D' && pdf[3] == 'F');
+    } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+        warning("error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+
+    // Write errors are reported
+    try {
+        var writer = new PangoMarkupWriter();
+        var mem = new MemoryOutputStream.resizable();
+        mem.close();
+        writer.write_document_to_stream(mem, create_long_code_doc(10));
+        assert_not_reached();   // LCOV_EXCL_LINE - never happens if tests pass
+    } catch(My.Error e) {
+        assert_true(e is My.Error.WRITER);
+    } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+        warning("error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+} // test_output_stream()
+
+/**
+ * Make a document of lists nested @nlevels deep, with one item per level
+ * and a quote in the innermost item.  The tree is 2*@nlevels+2 nodes deep.
+ *
+ * @param list_ty   BLOCK_BULLET_LIST or BLOCK_NUMBER_LIST
+ */
+Doc create_deep_doc(int nlevels, Elem.Type list_ty = BLOCK_BULLET_LIST)
+{
+    var tree = new DocTree();
+    int parent = 0;
+    for(int i=0; i<nlevels; ++i) {
+        var list = tree.append_child(parent, list_ty);
+        parent = tree.append_child(list, BLOCK_LIST_ITEM);
+        tree.set_text(parent, "item %d".printf(i));
+    }
+    var quote = tree.append_child(parent, BLOCK_QUOTE);
+    var em = tree.append_child(quote, SPAN_EM);
+    tree.set_text(em, "deep");
+    return new Doc.from_tree(tree);
+}
+
+/** Deeply-nested documents do not exhaust the stack */
+void test_deep_nesting()
+{
+    int nlevels = 50000;    // 100k nodes deep
+    var doc = create_deep_doc(nlevels);
+    assert_true(doc.as_string().has_prefix("Document:\n"));
+
+    try {
+        var writer = new PangoMarkupWriter();
+        var blocks = writer.make_blocks_standalone(doc);
+
+        int nbullets = 0;
+        Blocks.Blk first_bullet = null, last_bullet = null, quote = null;
+        foreach(var blk in blocks) {
+            if(blk is Blocks.BulletBlk) {
+                ++nbullets;
+                if(first_bullet == null) {
+                    first_bullet = blk;
+                }
+                last_bullet = blk;
+            } else if(blk is Blocks.QuoteBlk) {
+                quote = blk;
+            }
+        }
+        assert_cmpint(nbullets, EQ, nlevels);
+        assert_cmpstr(first_bullet.content.text, EQ, "item 0");
+        assert_cmpstr(last_bullet.content.text, EQ, "item %d".printf(nlevels-1));
+        assert_nonnull(quote);
+        assert_cmpstr(quote.content.text, EQ, "deep");
+
+        // The writer can be reused after a deep document
+        blocks = writer.make_blocks_standalone(create_dummy_doc());
+        assert_cmpint(blocks.size, GE, 1);
+
+        // Deep numbered lists can be rendered.  Numbered lists are
+        // indented more than bulleted lists, so this would overflow the
+        // margins if the indentation were not limited.
+        nlevels = 60000;
+        var npages = writer.count_pages(create_deep_doc(nlevels, BLOCK_NUMBER_LIST));
+        assert_cmpint(npages, GE, nlevels / 100);   // at most 100 items per page
+        assert_cmpint(npages, LE, nlevels);         // at least 1 item per page
+    } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+        warning("error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+} // test_deep_nesting()
+
+/**
+ * Read @markdown, check that it is at least @min_depth nodes deep, and
+ * check that the writer finds "deep" in it.
+ */
+void check_deep_markdown(string markdown, uint min_depth)
+{
+    try {
+        var doc = new MarkdownMd4cReader().read_string(markdown);
+
+        uint depth = 0;
+        doc.get_tree().foreach_preorder(0, (t, idx, d)=>{
+            depth = uint.max(depth, d);
+            return false;
+        });
+        assert_cmpuint(depth, GE, min_depth);
+
+        var str = doc.as_string();
+        assert_true(str.has_prefix("Document:\n"));
+        assert_true("-deep-" in str);
+
+        var blocks = new PangoMarkupWriter().make_blocks_standalone(doc);
+        bool found = false;
+        foreach(var blk in blocks) {
+            found |= ("deep" in blk.content.text);
+        }
+        assert_true(found);
+    } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+        warning("error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+}
+
+/** Deeply-nested Markdown can be read and laid out */
+void test_deep_markdown()
+{
+    int nlevels = 100000;
+
+    // Quotes
+    var sb = new StringBuilder();
+    for(int i=0; i<nlevels; ++i) {
+        sb.append("> ");
+    }
+    sb.append("deep\n");
+    check_deep_markdown(sb.str, nlevels);
+
+    // Lists in a special block.  The block is indented, so the reader
+    // parses a copy of its contents (parse_special_copy_()).
+    sb.assign("- item\n\n  ```pfft:x\n  ");
+    for(int i=0; i<nlevels; ++i) {
+        sb.append("- ");
+    }
+    sb.append("deep\n  ```\n");
+
+    Stats.reset();
+    Stats.enabled = true;
+    check_deep_markdown(sb.str, 2*nlevels);
+    Stats.enabled = false;
+    assert_cmpuint((uint)Stats.get_count("special.copied"), EQ, 1);
+} // test_deep_markdown()
+
+/** The png writer writes an image of each page, and the PDF on request */
+void test_png()
+{
+    string tmpfn = null;
+    try {
+        FileUtils.close(FileUtils.open_tmp("pfft-t-XXXXXX.pdf", out tmpfn));
+        FileUtils.unlink(tmpfn);    // the writer should make it
+        var basefn = tmpfn.substring(0, tmpfn.length - 4);
+
+        var writer = new PngWriter();
+        writer.dpi = 72;
+        writer.thumbdpi = 18;
+        writer.pdf = true;
+        writer.rasterthreads = 2;
+        writer.write_document(tmpfn, create_long_code_doc(200));
+        var npages = writer.get_page_count();
+        assert_cmpint(npages, GT, 1);
+
+        string contents;
+        FileUtils.get_contents(tmpfn, out contents);
+        assert_true(contents.has_prefix("%PDF"));
+        FileUtils.unlink(tmpfn);
+
+        for(int pageno = 1; pageno <= npages; ++pageno) {
+            var pngfn = "%s-%03d.png".printf(basefn, pageno);
+            var img = new Cairo.ImageSurface.from_png(pngfn);
+            assert_true(img.status() == Cairo.Status.SUCCESS);
+            assert_cmpint(img.get_width(), EQ, 612);    // 8.5" x 11" at 72 dpi
+            assert_cmpint(img.get_height(), EQ, 792);
+            FileUtils.unlink(pngfn);
+
+            var thumbfn = "%s-%03d-thumb.png".printf(basefn, pageno);
+            img = new Cairo.ImageSurface.from_png(thumbfn);
+            assert_true(img.status() == Cairo.Status.SUCCESS);
+            assert_cmpint(img.get_width(), EQ, 153);
+            assert_cmpint(img.get_height(), EQ, 198);
+            FileUtils.unlink(thumbfn);
+        }
+        assert_false(FileUtils.test("%s-%03d.png".printf(basefn, npages+1),
+            FileTest.EXISTS));
+
+        // Without pdf=true, only the images are written
+        writer.pdf = false;
+        writer.thumbdpi = 0;
+        writer.write_document(tmpfn, create_dummy_doc());
+        assert_false(FileUtils.test(tmpfn, FileTest.EXISTS));
+        assert_false(FileUtils.test("%s-001-thumb.png".printf(basefn), FileTest.EXISTS));
+        assert_true(FileUtils.test("%s-001.png".printf(basefn), FileTest.EXISTS));
+        FileUtils.unlink("%s-001.png".printf(basefn));
+
+        // Images can't go to stdout
+        try {
+            writer.write_document("-", create_dummy_doc());
+            assert_not_reached();   // LCOV_EXCL_LINE - unreached if tests pass
+        } catch(My.Error e) {
+            assert_true(e is My.Error.WRITER);
+        }
+    } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+        warning("error: %s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+} // test_png()
+
 /** Test bad inputs to write_document */
 void test_badcall()
 {
@@ -153,6 +750,18 @@ public static int main (string[] args)
     Test.set_nonfatal_assertions();
     Test.add_func("/300-pango-markup-writer/writefile", test_writefile);
     Test.add_func("/300-pango-markup-writer/badcall", test_badcall);
+    Test.add_func("/300-pango-markup-writer/stream", test_stream);
+    Test.add_func("/300-pango-markup-writer/join_lines", test_join_lines);
+    Test.add_func("/300-pango-markup-writer/join_lines_scanner", test_join_lines_scanner);
+    Test.add_func("/300-pango-markup-writer/linear_time", test_linear_time);
+    Test.add_func("/300-pango-markup-writer/long_code_block", test_long_code_block);
+    Test.add_func("/300-pango-markup-writer/count_pages", test_count_pages);
+    Test.add_func("/300-pango-markup-writer/page_range", test_page_range);
+    Test.add_func("/300-pango-markup-writer/measuring", test_measuring);
+    Test.add_func("/300-pango-markup-writer/output_stream", test_output_stream);
+    Test.add_func("/300-pango-markup-writer/deep_nesting", test_deep_nesting);
+    Test.add_func("/300-pango-markup-writer/deep_markdown", test_deep_markdown);
+    Test.add_func("/300-pango-markup-writer/png", test_png);
 
     return Test.run();
 }
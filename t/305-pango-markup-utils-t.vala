@@ -3,6 +3,7 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
 using My;
+using My.Cmp;
 
 void test_U()
 {
@@ -18,6 +19,230 @@ void test_unit_conversions()
     assert_double_close(1, c2i(72));
 }
 
+void test_layout_cache()
+{
+    var cr = new Cairo.Context(new Cairo.ImageSurface(Cairo.Format.ARGB32, 1, 1));
+    var proto = Blocks.new_layout(cr, "Serif", 12);
+    var cache = new Blocks.LayoutCache(2);
+
+    var l1 = cache.get_layout(proto, i2p(1), LEFT, "<b>hello</b>");
+    assert_cmpuint(cache.misses, EQ, 1);
+    assert_cmpstr(l1.get_text(), EQ, "hello");
+    assert_cmpint(l1.get_width(), EQ, i2p(1));
+    assert_true(proto.get_text() != "hello");   // prototype untouched
+
+    // Same everything: hit
+    var l2 = cache.get_layout(proto, i2p(1), LEFT, "<b>hello</b>");
+    assert_true(l1 == l2);
+    assert_cmpuint(cache.hits, EQ, 1);
+
+    // Different width, alignment, or markup: miss
+    assert_true(cache.get_layout(proto, i2p(2), LEFT, "<b>hello</b>") != l1);
+    assert_true(cache.get_layout(proto, i2p(1), CENTER, "<b>hello</b>") != l1);
+    assert_cmpuint(cache.misses, EQ, 3);
+
+    // Capacity is respected, oldest first
+    assert_cmpuint(cache.size, EQ, 2);
+    assert_true(cache.get_layout(proto, i2p(1), LEFT, "<b>hello</b>") != l1);
+    assert_cmpuint(cache.misses, EQ, 4);
+
+    // Shrinking takes effect on the next insertion
+    cache.capacity = 1;
+    cache.get_layout(proto, i2p(3), LEFT, "<b>hello</b>");
+    assert_cmpuint(cache.size, EQ, 1);
+
+    cache.clear();
+    assert_cmpuint(cache.size, EQ, 0);
+}
+
+void test_image_cache()
+{
+    var fn = Test.build_filename(Test.FileType.DIST, "linux.png");
+    var cache = new Shape.ImageCache();
+    assert_true(cache.lazy);
+
+    // Lazy: size from the header, no decode
+    var img = cache.lookup(fn);
+    assert_cmpint(img.width, EQ, 128);
+    assert_cmpint(img.height, EQ, 128);
+    assert_cmpuint(cache.decodes, EQ, 0);
+
+    // Same file: same entry
+    assert_true(cache.lookup(fn) == img);
+    assert_cmpuint(cache.hits, EQ, 1);
+
+    // Painting decodes once
+    var cr = new Cairo.Context(new Cairo.ImageSurface(Cairo.Format.ARGB32, 256, 256));
+    img.paint(cr, 0, 0);
+    img.paint(cr, 128, 128);
+    assert_cmpuint(cache.decodes, EQ, 1);
+    assert_cmpuint(cache.decoded_bytes, GT, 0);
+
+    // Trimming to a zero budget drops the pixels but keeps the entry
+    cache.budget_bytes = 0;
+    cache.trim();
+    assert_cmpuint(cache.decoded_bytes, EQ, 0);
+    assert_true(cache.lookup(fn) == img);
+    img.paint(cr, 0, 0);
+    assert_cmpuint(cache.decodes, EQ, 2);
+
+    // Shapes share the entry
+    var s1 = new Shape.Image.from_href("linux.png", fn);
+    var s2 = new Shape.Image.from_href("linux.png", fn);
+    assert_cmpint(s1.get_inkP().width, EQ, c2p(128));
+    assert_cmpint(s2.get_inkP().width, EQ, c2p(128));
+}
+
+/** Old versions of a changed image are forgotten */
+void test_image_cache_changed()
+{
+    string tmpfn = null;
+    try {
+        FileUtils.close(FileUtils.open_tmp("305-XXXXXX.png", out tmpfn));
+        uint8[] png;
+        FileUtils.get_data(Test.build_filename(Test.FileType.DIST, "linux.png"), out png);
+        FileUtils.set_data(tmpfn, png);
+
+        var cache = new Shape.ImageCache();
+        var cr = new Cairo.Context(new Cairo.ImageSurface(Cairo.Format.ARGB32, 256, 256));
+        var old_img = cache.lookup(tmpfn);
+        old_img.paint(cr, 0, 0);
+        var nbytes = cache.decoded_bytes;
+        assert_cmpuint(nbytes, GT, 0);
+
+        // Change the modification time
+        var fh = File.new_for_path(tmpfn);
+        var mtime = fh.query_info(FileAttribute.TIME_MODIFIED, NONE)
+            .get_attribute_uint64(FileAttribute.TIME_MODIFIED);
+        fh.set_attribute_uint64(FileAttribute.TIME_MODIFIED, mtime + 10, NONE);
+
+        var new_img = cache.lookup(tmpfn);
+        assert_true(new_img != old_img);
+        assert_cmpuint(cache.decoded_bytes, EQ, 0);     // old pixels dropped
+
+        // Both can still be painted, but only the new one is kept
+        old_img.paint(cr, 0, 0);
+        new_img.paint(cr, 0, 0);
+        assert_cmpuint(cache.decoded_bytes, EQ, nbytes);
+        assert_true(cache.lookup(tmpfn) == new_img);
+    } catch(GLib.Error e) { // LCOV_EXCL_START - unreached if tests pass
+        warning("%s", e.message);
+        assert_not_reached();
+    }   // LCOV_EXCL_STOP
+
+    if(tmpfn != null) {
+        FileUtils.unlink(tmpfn);
+    }
+}
+
+void test_styled_text()
+{
+    var st = new Blocks.StyledText();
+    st.add_style(MONOSPACE);
+    st.append("a ");
+    var span = st.begin_span(BOLD);
+    st.append("bold\n");
+    st.end_span(span);
+    st.append("  \n");
+    assert_cmpstr(st.text, EQ, "a bold ");
+    string key = st.get_key();  // a copy
+
+    // Trailing whitespace is removed, and runs are trimmed to match
+    st.chomp();
+    assert_cmpstr(st.text, EQ, "a bold");
+    assert_true(st.get_key() != key);
+
+    var cr = new Cairo.Context(new Cairo.ImageSurface(Cairo.Format.ARGB32, 1, 1));
+    var layout = Blocks.new_layout(cr, "Serif", 12);
+    st.apply_to(layout);
+    assert_cmpstr(layout.get_text(), EQ, "a bold");
+
+    // The same attributes as the equivalent markup
+    var expected = Blocks.new_layout(cr, "Serif", 12);
+    expected.set_markup("<tt>a <b>bold</b></tt>", -1);
+    var iter = layout.get_attributes().get_iterator();
+    var expected_iter = expected.get_attributes().get_iterator();
+    do {
+        int start, end, expected_start, expected_end;
+        iter.range(out start, out end);
+        expected_iter.range(out expected_start, out expected_end);
+        assert_cmpint(start, EQ, expected_start);
+        assert_cmpint(int.min(end, 6), EQ, int.min(expected_end, 6));
+        assert_true((iter.get(Pango.AttrType.WEIGHT) == null) ==
+            (expected_iter.get(Pango.AttrType.WEIGHT) == null));
+        assert_true((iter.get(Pango.AttrType.FAMILY) == null) ==
+            (expected_iter.get(Pango.AttrType.FAMILY) == null));
+    } while(iter.next() && expected_iter.next());
+
+    // Different styles, different keys
+    var plain = new Blocks.StyledText();
+    plain.append("a bold");
+    assert_true(plain.get_key() != st.get_key());
+
+    // Markup
+    var markup = new Blocks.StyledText.from_markup("<b>hi</b>");
+    assert_true(!markup.is_empty());
+    markup.apply_to(layout);
+    assert_cmpstr(layout.get_text(), EQ, "hi");
+}
+
+/** Make a ParaBlk with @nwords words */
+Blocks.Blk make_para(Pango.Layout layout, int nwords)
+{
+    var blk = new Blocks.ParaBlk(layout);
+    for(int i=0; i<nwords; ++i) {
+        if(i%7 == 0) {
+            var span = blk.content.begin_span(BOLD);
+            blk.content.append("word");
+            blk.content.end_span(span);
+            blk.content.append(" ");
+        } else {
+            blk.content.append("word ");
+        }
+    }
+    return blk;
+}
+
+void test_layout_shaper()
+{
+    var surf = new Cairo.ImageSurface(Cairo.Format.ARGB32, 1, 1);
+    var cr = new Cairo.Context(surf);
+    var layout = Blocks.new_layout(cr, "Serif", 12);
+    var font_options = new Cairo.FontOptions();
+    surf.get_font_options(font_options);
+
+    int rightP = i2p(7.5);
+    int bottomP = i2p(1000);
+
+    var serial = new Gee.LinkedList<Blocks.Blk>();
+    var parallel = new Gee.LinkedList<Blocks.Blk>();
+    for(int i=0; i<20; ++i) {
+        serial.add(make_para(layout, i*15+1));
+        parallel.add(make_para(layout, i*15+1));
+    }
+    parallel.add(new Blocks.ParaBlk(layout));   // empty, so not shaped
+
+    var shaper = new Blocks.LayoutShaper(3, font_options);
+    assert_cmpuint(shaper.shape(parallel, i2c(1), rightP), EQ, 20);
+
+    // Blocks laid out ahead of time take the same space as those laid
+    // out while rendering
+    for(int i=0; i<20; ++i) {
+        double x1C, y1C, x2C, y2C;
+
+        cr.move_to(i2c(1), 0);
+        assert_true(serial[i].render(cr, rightP, bottomP) == COMPLETE);
+        cr.get_current_point(out x1C, out y1C);
+
+        cr.move_to(i2c(1), 0);
+        assert_true(parallel[i].render(cr, rightP, bottomP) == COMPLETE);
+        cr.get_current_point(out x2C, out y2C);
+
+        assert_cmpfloat(y1C, GT, 0);
+        assert_cmpfloat(y1C, EQ, y2C);
+    }
+}
+
 public static int main (string[] args)
 {
     // run the tests
@@ -25,6 +250,11 @@ public static int main (string[] args)
     Test.set_nonfatal_assertions();
     Test.add_func("/305-pango-markup-utils/U", test_U);
     Test.add_func("/305-pango-markup-utils/unit_conversions", test_unit_conversions);
+    Test.add_func("/305-pango-markup-utils/layout_cache", test_layout_cache);
+    Test.add_func("/305-pango-markup-utils/image_cache", test_image_cache);
+    Test.add_func("/305-pango-markup-utils/image_cache_changed", test_image_cache_changed);
+    Test.add_func("/305-pango-markup-utils/layout_shaper", test_layout_shaper);
+    Test.add_func("/305-pango-markup-utils/styled_text", test_styled_text);
 
     return Test.run();
 }
@@ -0,0 +1,481 @@
+// t/bench.vala - Benchmarks for pfft
+// Copyright (c) 2020 Christopher White.  All rights reserved.
+// SPDX-License-Identifier: BSD-3-Clause
+//
+// Not a test.  Run via `make bench`, or directly:
+//
+//     t/bench [--scale N] [--iterations N] [--output FILE] [--srcdir DIR]
+//
+// Converts each document in a corpus and reports the time taken by each
+// phase, in JSON.  The corpus is the sample documents in t/ plus documents
+// generated on the fly.  --scale makes the generated documents larger.
+//
+// It also times StyledText.append() joining the lines of each document,
+// against a byte-at-a-time loop, to measure the line-break scanner.
+
+using My;
+
+/** Benchmark driver */
+public class Bench : Object {
+
+    // Command-line options {{{1
+
+    /** How large to make the generated documents */
+    private int opt_scale = 1;
+
+    /** How many times to convert each document.  The fastest time is kept. */
+    private int opt_iterations = 1;
+
+    /** Where to write the JSON report ("" = stdout) */
+    private string opt_outfn = "";
+
+    /** Where the sample documents are */
+    private string opt_srcdir = "";
+
+    /** Whether to keep the generated documents and PDFs */
+    private bool opt_keep = false;
+
+    private GLib.OptionEntry[] get_options()
+    {
+        return {
+                   { "scale", 's', 0, OptionArg.INT, &opt_scale, "Size of the generated documents (default 1)", "N" },
+                   { "iterations", 'i', 0, OptionArg.INT, &opt_iterations, "Convert each document N times and report the fastest (default 1)", "N" },
+                   { "output", 'o', 0, OptionArg.FILENAME, &opt_outfn, "Write the JSON report to FILENAME instead of stdout", "FILENAME" },
+                   { "srcdir", 0, 0, OptionArg.FILENAME, &opt_srcdir, "Where the sample documents are (default: this program's directory)", "DIR" },
+                   { "keep", 'k', 0, OptionArg.NONE, &opt_keep, "Keep the generated documents and the output PDFs", null },
+                   { null }
+        };
+    }
+
+    // }}}1
+    // Corpus {{{1
+
+    /** Names of the documents to convert */
+    private string[] names_ = {};
+
+    /** Paths of the documents to convert, parallel to names_ */
+    private string[] paths_ = {};
+
+    /** Where the generated documents and the PDFs go */
+    private string workdir_;
+
+    /** Add a sample document from the source tree, if it exists */
+    private void add_sample(string basename)
+    {
+        var path = Path.build_filename(opt_srcdir, basename);
+        if(!FileUtils.test(path, FileTest.IS_REGULAR)) {
+            printerr("Skipping %s: not found\n", path);
+            return;
+        }
+        names_ += basename;
+        paths_ += path;
+    }
+
+    /** Add a generated document */
+    private void add_generated(string name, StringBuilder contents) throws FileError
+    {
+        var path = Path.build_filename(workdir_, name + ".md");
+        FileUtils.set_contents(path, contents.str, (ssize_t)contents.len);
+        names_ += name;
+        paths_ += path;
+    }
+
+    private const string SENTENCE = "Lorem ipsum dolor sit amet, *consectetur* adipiscing elit, sed do **eiusmod** tempor incididunt ut `labore` et dolore magna aliqua. ";
+
+    /** Many long paragraphs */
+    private StringBuilder make_long_paragraphs()
+    {
+        var sb = new StringBuilder();
+        for(int para = 0; para < 200*opt_scale; ++para) {
+            for(int sentence = 0; sentence < 40; ++sentence) {
+                sb.append(SENTENCE);
+                if(sentence % 8 == 7) {
+                    sb.append_c('\n');  // soft line break
+                }
+            }
+            sb.append("\n\n");
+        }
+        return sb;
+    }
+
+    /** Lists nested many levels deep */
+    private StringBuilder make_deep_lists()
+    {
+        var sb = new StringBuilder();
+        for(int list = 0; list < 20*opt_scale; ++list) {
+            for(int level = 0; level < 12; ++level) {
+                var indent = string.nfill(level*2, ' ');
+                for(int item = 0; item < 3; ++item) {
+                    sb.append_printf("%s- Item %d at level %d. %s\n", indent, item,
+                        level, SENTENCE);
+                }
+            }
+            sb.append("\nSeparator paragraph.\n\n");
+        }
+        return sb;
+    }
+
+    /** Huge code blocks */
+    private StringBuilder make_code_blocks()
+    {
+        var sb = new StringBuilder();
+        for(int block = 0; block < 5*opt_scale; ++block) {
+            sb.append("```c\n");
+            for(int line = 0; line < 2000; ++line) {
+                sb.append_printf("/* %5d */ for(int i=0; i<n; ++i) { sum += data[i] * weights[i %% %d]; }\n",
+                    line, block+1);
+            }
+            sb.append("```\n\nSeparator paragraph.\n\n");
+        }
+        return sb;
+    }
+
+    /** Many special blocks, as templates use for callouts */
+    private StringBuilder make_special_blocks()
+    {
+        var sb = new StringBuilder();
+        for(int block = 0; block < 500*opt_scale; ++block) {
+            sb.append_printf("```pfft: callout\n**Note %d.** %s\n\n- %s\n- %s\n```\n\n",
+                block, SENTENCE, SENTENCE, SENTENCE);
+        }
+        return sb;
+    }
+
+    /** Many images, inline and standalone with captions */
+    private StringBuilder make_images()
+    {
+        var sb = new StringBuilder();
+        var img = My.canonicalize_filename(Path.build_filename(opt_srcdir, "linux.png"));
+        for(int para = 0; para < 100*opt_scale; ++para) {
+            if(para % 10 == 9) {
+                sb.append_printf("![](%s \"Figure %d\")\n\n", img, para);
+            } else {
+                sb.append_printf("Text ![Tux](%s) more text. %s\n\n", img, SENTENCE);
+            }
+        }
+        return sb;
+    }
+
+    // }}}1
+    // Measurement {{{1
+
+    /** Results for one document */
+    private class Result {
+        public string name;
+        public int64 bytes;
+        public int pages;
+
+        // Times, in seconds.  The fastest of the iterations.
+        public double parse_s = double.MAX;     // reader
+        public double blocks_s = double.MAX;    // making blocks from the tree
+        public double render_s = double.MAX;    // pagination and rendering
+        public double finish_s = double.MAX;    // writing the PDF file
+        public double total_s = double.MAX;     // all of the above
+
+        /** Peak resident set size, in kB, or -1 if unknown */
+        public int64 peak_rss_kB = -1;
+    }
+
+    /** Reset the peak RSS counter, if possible (Linux only) */
+    private static void reset_peak_rss()
+    {
+        var fh = FileStream.open("/proc/self/clear_refs", "w");
+        if(fh != null) {
+            fh.puts("5");
+        }
+    }
+
+    /** Get the peak RSS in kB, or -1 if unknown (Linux only) */
+    private static int64 get_peak_rss_kB()
+    {
+        string status;
+        try {
+            FileUtils.get_contents("/proc/self/status", out status);
+        } catch(FileError e) {
+            return -1;
+        }
+
+        foreach(var line in status.split("\n")) {
+            if(line.has_prefix("VmHWM:")) {
+                return int64.parse(line.substring(6).strip());  // stops at " kB"
+            }
+        }
+        return -1;
+    }
+
+    /** Convert one document opt_iterations times */
+    private Result measure(string name, string path) throws GLib.Error
+    {
+        var retval = new Result();
+        retval.name = name;
+        retval.bytes = File.new_for_path(path).query_info(
+            FileAttribute.STANDARD_SIZE, FileQueryInfoFlags.NONE).get_size();
+        var outfn = Path.build_filename(workdir_, name + ".pdf");
+
+        reset_peak_rss();
+        for(int iter = 0; iter < opt_iterations; ++iter) {
+            // Fresh instances and caches so each iteration is a cold start
+            Shape.ImageCache.get_default().clear();
+            var reader = new MarkdownMd4cReader();
+            var writer = new PangoMarkupWriter();
+            var timer = new Timer();
+            Stats.reset();
+
+            timer.start();
+            var doc = reader.read_document(path);
+            var parse_s = timer.elapsed();
+
+            timer.start();
+            writer.write_document(outfn, doc, path);
+            var write_s = timer.elapsed();
+
+            // Split the writer's time into phases
+            var blocks_s = Stats.get_seconds("blocks");
+            var finish_s = Stats.get_seconds("pdf.finish");
+            var render_s = double.max(write_s - blocks_s - finish_s, 0);
+
+            retval.parse_s = double.min(retval.parse_s, parse_s);
+            retval.blocks_s = double.min(retval.blocks_s, blocks_s);
+            retval.render_s = double.min(retval.render_s, render_s);
+            retval.finish_s = double.min(retval.finish_s, finish_s);
+            retval.total_s = double.min(retval.total_s, parse_s + write_s);
+            retval.pages = writer.get_page_count();
+        }
+        retval.peak_rss_kB = get_peak_rss_kB();
+
+        if(!opt_keep) {
+            FileUtils.remove(outfn);
+        }
+        return retval;
+    } // measure()
+
+    // }}}1
+    // Microbenchmarks {{{1
+
+    /** Results of the text-joining microbenchmark */
+    private class TextResult {
+        public string name;
+        public int64 bytes;
+
+        /** Which scanner StyledText.append() used */
+        public unowned string scanner;
+
+        // Times per byte of input, in ns.  The fastest of the iterations.
+        public double append_ns = double.MAX;   // StyledText.append()
+        public double bytewise_ns = double.MAX; // a byte-at-a-time loop
+    }
+
+    /** How much text to join per timing, so the times are measurable */
+    private const int64 TEXT_BYTES_PER_RUN = 64*1024*1024;
+
+    /**
+     * Join the lines of @text the way StyledText.append() does, but
+     * looking at one byte at a time.  For comparison.
+     */
+    private static void join_bytewise(string text, StringBuilder sb)
+    {
+        char *buf = (char *)text;
+        size_t n = text.length, rd = 0, copy_from = 0;
+        bool joining = false;
+        while(rd < n) {
+            uint8 c = (uint8)buf[rd];
+            size_t brk = 0;
+            if(c == '\n' || c == '\v' || c == '\f' || c == '\r') {
+                brk = 1;
+            } else if(c == 0xc2 && rd+1 < n && (uint8)buf[rd+1] == 0x85) {
+                brk = 2;
+            } else if(c == 0xe2 && rd+2 < n && (uint8)buf[rd+1] == 0x80 &&
+                ((uint8)buf[rd+2] == 0xa8 || (uint8)buf[rd+2] == 0xa9)) {
+                brk = 3;
+            }
+            if(brk == 0) {
+                ++rd;
+                continue;
+            }
+            if(rd > copy_from) {
+                sb.append_len((string)(buf + copy_from), (ssize_t)(rd - copy_from));
+                joining = false;
+            }
+            if(!joining) {
+                sb.append_c(' ');
+                joining = true;
+            }
+            rd += brk;
+            copy_from = rd;
+        }
+        if(n > copy_from) {
+            sb.append_len((string)(buf + copy_from), (ssize_t)(n - copy_from));
+        }
+    }
+
+    /** Time joining the lines of the document at @path */
+    private TextResult measure_text(string name, string path) throws GLib.Error
+    {
+        string text;
+        FileUtils.get_contents(path, out text);
+
+        var retval = new TextResult();
+        retval.name = name;
+        retval.bytes = text.length;
+        retval.scanner = Blocks.StyledText.get_scanner();
+
+        int64 reps = int64.max(1, TEXT_BYTES_PER_RUN / int64.max(1, text.length));
+        double nbytes = (double)reps * text.length;
+        for(int iter = 0; iter < opt_iterations; ++iter) {
+            var timer = new Timer();
+            for(int64 i = 0; i < reps; ++i) {
+                var st = new Blocks.StyledText();
+                st.append(text, text.length);
+            }
+            retval.append_ns = double.min(retval.append_ns,
+                    timer.elapsed() * 1e9 / nbytes);
+
+            timer.start();
+            for(int64 i = 0; i < reps; ++i) {
+                var sb = new StringBuilder();
+                join_bytewise(text, sb);
+            }
+            retval.bytewise_ns = double.min(retval.bytewise_ns,
+                    timer.elapsed() * 1e9 / nbytes);
+        }
+        return retval;
+    } // measure_text()
+
+    // }}}1
+    // Reporting {{{1
+
+    /** Format a double for JSON, independent of locale */
+    private static string num(double d)
+    {
+        return d.to_string();
+    }
+
+    private string to_json(Result[] results, TextResult[] text_results)
+    {
+        var sb = new StringBuilder();
+        sb.append("{\n");
+        sb.append_printf("  \"scale\": %d,\n", opt_scale);
+        sb.append_printf("  \"iterations\": %d,\n", opt_iterations);
+        sb.append("  \"documents\": [\n");
+        for(int i = 0; i < results.length; ++i) {
+            var r = results[i];
+            sb.append("    {\n");
+            sb.append_printf("      \"name\": \"%s\",\n", r.name.escape());
+            sb.append_printf("      \"bytes\": %s,\n", r.bytes.to_string());
+            sb.append_printf("      \"pages\": %d,\n", r.pages);
+            sb.append_printf("      \"parse_s\": %s,\n", num(r.parse_s));
+            sb.append_printf("      \"blocks_s\": %s,\n", num(r.blocks_s));
+            sb.append_printf("      \"render_s\": %s,\n", num(r.render_s));
+            sb.append_printf("      \"finish_s\": %s,\n", num(r.finish_s));
+            sb.append_printf("      \"total_s\": %s,\n", num(r.total_s));
+            sb.append_printf("      \"ns_per_byte\": %s,\n",
+                num(r.bytes > 0 ? r.total_s * 1e9 / r.bytes : 0));
+            sb.append_printf("      \"pages_per_s\": %s,\n",
+                num(r.total_s > 0 ? r.pages / r.total_s : 0));
+            sb.append_printf("      \"peak_rss_kB\": %s\n", r.peak_rss_kB.to_string());
+            sb.append_printf("    }%s\n", (i < results.length-1) ? "," : "");
+        }
+        sb.append("  ],\n");
+        sb.append("  \"text_append\": [\n");
+        for(int i = 0; i < text_results.length; ++i) {
+            var r = text_results[i];
+            sb.append("    {\n");
+            sb.append_printf("      \"name\": \"%s\",\n", r.name.escape());
+            sb.append_printf("      \"bytes\": %s,\n", r.bytes.to_string());
+            sb.append_printf("      \"scanner\": \"%s\",\n", r.scanner);
+            sb.append_printf("      \"append_ns_per_byte\": %s,\n", num(r.append_ns));
+            sb.append_printf("      \"bytewise_ns_per_byte\": %s\n", num(r.bytewise_ns));
+            sb.append_printf("    }%s\n", (i < text_results.length-1) ? "," : "");
+        }
+        sb.append("  ]\n}\n");
+        return sb.str;
+    }
+
+    // }}}1
+    // Main {{{1
+
+    public int run(owned string[] args)
+    {
+        try {
+            var opt_context = new OptionContext("- benchmark pfft");
+            opt_context.add_main_entries(get_options(), null);
+            opt_context.parse_strv(ref args);
+        } catch(OptionError e) {
+            printerr("error: %s\n", e.message);
+            return 2;
+        }
+
+        if(opt_scale < 1 || opt_iterations < 1) {
+            printerr("--scale and --iterations must be at least 1\n");
+            return 2;
+        }
+
+        if(opt_srcdir == "") {
+            opt_srcdir = Path.get_dirname(args[0]);
+        }
+
+        Result[] results = {};
+        TextResult[] text_results = {};
+        try {
+            workdir_ = DirUtils.make_tmp("pfft-bench-XXXXXX");
+
+            add_sample("complex.md");
+            add_sample("elements-of-geology.md");
+            add_sample("pg4204.txt");
+            add_generated("gen-long-paragraphs", make_long_paragraphs());
+            add_generated("gen-deep-lists", make_deep_lists());
+            add_generated("gen-code-blocks", make_code_blocks());
+            add_generated("gen-images", make_images());
+            add_generated("gen-special-blocks", make_special_blocks());
+
+            for(int i = 0; i < names_.length; ++i) {
+                var r = measure(names_[i], paths_[i]);
+                printerr("%-24s %9s bytes %5d pages %8.3f s\n",
+                    r.name, r.bytes.to_string(), r.pages, r.total_s);
+                results += r;
+            }
+
+            for(int i = 0; i < names_.length; ++i) {
+                var r = measure_text(names_[i], paths_[i]);
+                printerr("%-24s append %.3f ns/byte (%s), bytewise %.3f ns/byte\n",
+                    r.name, r.append_ns, r.scanner, r.bytewise_ns);
+                text_results += r;
+            }
+
+            var json = to_json(results, text_results);
+            if(opt_outfn == "") {
+                print("%s", json);
+            } else {
+                FileUtils.set_contents(opt_outfn, json);
+            }
+        } catch(GLib.Error e) {
+            printerr("error: %s\n", e.message);
+            return 1;
+        } finally {
+            if(!opt_keep && workdir_ != null) {
+                foreach(var path in paths_) {
+                    if(path.has_prefix(workdir_)) {
+                        FileUtils.remove(path);
+                    }
+                }
+                DirUtils.remove(workdir_);
+            }
+        }
+
+        if(opt_keep) {
+            printerr("Output is in %s\n", workdir_);
+        }
+        return 0;
+    } // run()
+
+    // }}}1
+} // class Bench
+
+public static int main(string[] args)
+{
+    App.init_before_run();
+    Stats.enabled = true;
+    return new Bench().run(args);
+}
+
+// vi: set fdm=marker: //